@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Line-reader throughput: stream N MB (default 200) of log-like text through
+# benchmarks/lines.astr on both engines and report MB/s.
+set -euo pipefail
+
+REPO_ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+BIN="$REPO_ROOT/src/seed0/astralis"
+MB="${1:-200}"
+INPUT="$(mktemp)"
+trap 'rm -f "$INPUT"' EXIT
+
+# `yes` dies of SIGPIPE once head has enough
+{ yes "2024-05-01T12:00:00Z INFO request handled path=/api/items status=200 ms=12" || true; } |
+  head -c "$((MB * 1024 * 1024))" >"$INPUT"
+
+for mode in "" "--vm"; do
+  start=$(date +%s%N)
+  result=$("$BIN" $mode "$REPO_ROOT/benchmarks/lines.astr" <"$INPUT")
+  end=$(date +%s%N)
+  awk -v mb="$MB" -v ns="$((end - start))" -v mode="${mode:-tree}" -v res="$result" \
+    'BEGIN { printf "%-6s %s  %.2fs  %.0f MB/s\n", mode, res, ns / 1e9, mb / (ns / 1e9) }'
+done
@@ -0,0 +1,95 @@
+// Runs one command and reports what it cost: wall time, user-space
+// instructions and peak RSS, as a single JSON object on the -o file.
+// bench.py launches every workload through this so ru_maxrss measures the
+// workload rather than the (much larger) Python process it was forked from.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Counts the child's instructions from its exec on; -1 when the kernel or
+// sandbox does not allow it.
+static int open_counter(pid_t pid) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+int main(int argc, char** argv) {
+  const char* out_path = NULL;
+  int i = 1;
+  if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+    out_path = argv[i + 1];
+    i += 2;
+  }
+  if (i < argc && strcmp(argv[i], "--") == 0) i++;
+  if (!out_path || i >= argc) {
+    fprintf(stderr, "usage: %s -o <result.json> -- <command> [args...]\n", argv[0]);
+    return 2;
+  }
+
+  // the child waits on the pipe until the counter is attached
+  int gate[2];
+  if (pipe(gate) != 0) { perror("pipe"); return 2; }
+  double start = now_s();
+  pid_t pid = fork();
+  if (pid < 0) { perror("fork"); return 2; }
+  if (pid == 0) {
+    char c;
+    close(gate[1]);
+    while (read(gate[0], &c, 1) < 0 && errno == EINTR) {}
+    close(gate[0]);
+    execvp(argv[i], argv + i);
+    perror(argv[i]);
+    _exit(127);
+  }
+  close(gate[0]);
+  int counter = open_counter(pid);
+  close(gate[1]);
+
+  int status = 0;
+  struct rusage ru;
+  while (wait4(pid, &status, 0, &ru) < 0) {
+    if (errno != EINTR) { perror("wait4"); return 2; }
+  }
+  double wall = now_s() - start;
+
+  long long instructions = -1;
+  if (counter >= 0) {
+    uint64_t n = 0;
+    if (read(counter, &n, sizeof(n)) == (ssize_t)sizeof(n)) instructions = (long long)n;
+    close(counter);
+  }
+  int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+  FILE* out = fopen(out_path, "w");
+  if (!out) { perror(out_path); return 2; }
+  fprintf(out, "{\"wall_s\": %.6f, \"instructions\": ", wall);
+  if (instructions >= 0) fprintf(out, "%lld", instructions);
+  else fputs("null", out);
+  fprintf(out, ", \"peak_rss_kb\": %ld, \"exit\": %d}\n", ru.ru_maxrss, code);
+  fclose(out);
+  return code;
+}
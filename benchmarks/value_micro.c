@@ -0,0 +1,97 @@
+// Microbenchmark for the Value/Binding layout: how many bytes bindings and
+// argument arrays occupy, and how fast binding-heavy operations run.
+// Build and run with `make bench-value` from the repo root.
+#include "interp.h"
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAME_SLOTS 64
+#define NAMED 16
+#define ARGC 8
+
+static double now_ns(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char* what, double start, long ops, long check) {
+  printf("%-28s %8.2f ns/op  (check %ld)\n", what, (now_ns() - start) / (double)ops, check);
+}
+
+int main(int argc, char** argv) {
+  long iters = argc > 1 ? atol(argv[1]) : 2000000;
+  char err[128];
+
+  char text[8];
+  const char* name_ptrs[FRAME_SLOTS];
+  size_t lens[FRAME_SLOTS];
+  for (int i = 0; i < FRAME_SLOTS; i++) {
+    snprintf(text, sizeof(text), "v%d", i);
+    lens[i] = strlen(text);
+    name_ptrs[i] = intern(text, lens[i]);
+  }
+  FrameLayout layout = {name_ptrs, lens, FRAME_SLOTS};
+
+  printf("sizeof(Value)   %zu bytes\n", sizeof(Value));
+  printf("sizeof(Binding) %zu bytes\n", sizeof(Binding));
+  printf("sizeof(Expr)    %zu bytes\n", sizeof(Expr));
+  printf("%d-slot frame   %zu bytes\n", FRAME_SLOTS, FRAME_SLOTS * sizeof(Binding));
+  printf("%d-arg argv     %zu bytes\n", ARGC, ARGC * sizeof(Value));
+
+  // slot writes and reads with int arithmetic, the shape of a hot loop body
+  Env* frame = env_push_frame(NULL, &layout);
+  long check = 0;
+  double t = now_ns();
+  for (long i = 0; i < iters; i++) {
+    Binding* b = &frame->items[i & (FRAME_SLOTS - 1)];
+    Value v = value_int(i);
+    env_slot_assign(b, &v, false, err, sizeof(err));
+    Value r = value_copy(&b->value);
+    Value sum = eval_binary_op(BIN_ADD, &r, &v);
+    check += sum.i;
+    value_free(&sum);
+    value_free(&r);
+  }
+  report("slot assign + read + add", t, iters, check);
+  env_pop(frame);
+
+  // by-name set/get through the Env chain
+  Env* globals = env_push_frame(NULL, NULL);
+  Env* local = env_push_frame(globals, NULL);
+  check = 0;
+  t = now_ns();
+  for (long i = 0; i < iters; i++) {
+    int k = (int)(i & (NAMED - 1));
+    Value v = value_int(i);
+    env_set(globals, name_ptrs[k], &v, false, err, sizeof(err));
+    Value r = env_get(local, name_ptrs[k]);
+    check += r.i;
+    value_free(&r);
+  }
+  report("by-name set + get", t, iters, check);
+  env_pop(local);
+  env_pop(globals);
+
+  // call-shaped work: fill an argv, push a frame, bind params, pop
+  Value args[ARGC];
+  check = 0;
+  t = now_ns();
+  for (long i = 0; i < iters / 4; i++) {
+    for (int a = 0; a < ARGC; a++) args[a] = value_int(i + a);
+    Env* callee = env_push_frame(NULL, &layout);
+    for (int a = 0; a < ARGC; a++) {
+      env_slot_assign(&callee->items[a], &args[a], false, err, sizeof(err));
+      value_free(&args[a]);
+    }
+    check += callee->items[ARGC - 1].value.i;
+    env_pop(callee);
+  }
+  report("argv + frame push/bind/pop", t, iters / 4, check);
+  frames_release();
+  intern_release();
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t n) {
+  return (n + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static unsigned char* chunk_data(ArenaChunk* c) {
+  return (unsigned char*)c + align_up(sizeof(ArenaChunk));
+}
+
+void arena_init(Arena* a) {
+  memset(a, 0, sizeof(*a));
+}
+
+void arena_free(Arena* a) {
+  ArenaChunk* c = a->head;
+  while (c) {
+    ArenaChunk* next = c->next;
+    free(c);
+    c = next;
+  }
+  arena_init(a);
+}
+
+static ArenaChunk* chunk_new(Arena* a, size_t min) {
+  size_t cap = min > ARENA_CHUNK_SIZE ? min : ARENA_CHUNK_SIZE;
+  ArenaChunk* c = (ArenaChunk*)malloc(align_up(sizeof(ArenaChunk)) + cap);
+  if (!c) return NULL;
+  c->next = a->head;
+  c->used = 0;
+  c->cap = cap;
+  a->head = c;
+  a->stats.chunks++;
+  a->stats.reserved += cap;
+  return c;
+}
+
+void* arena_alloc(Arena* a, size_t n) {
+  size_t need = align_up(n ? n : 1);
+  ArenaChunk* c = a->head;
+  if (!c || c->cap - c->used < need) {
+    c = chunk_new(a, need);
+    if (!c) return NULL;
+  }
+  void* p = chunk_data(c) + c->used;
+  c->used += need;
+  memset(p, 0, need);
+  a->last = p;
+  a->stats.allocs++;
+  a->stats.used += need;
+  return p;
+}
+
+void* arena_grow(Arena* a, void* p, size_t old_n, size_t new_n) {
+  if (!p) return arena_alloc(a, new_n);
+  if (new_n <= old_n) return p;
+  ArenaChunk* c = a->head;
+  size_t old_need = align_up(old_n ? old_n : 1);
+  size_t new_need = align_up(new_n);
+  if (p == a->last && c->cap - (c->used - old_need) >= new_need) {
+    memset((unsigned char*)p + old_need, 0, new_need - old_need);
+    c->used += new_need - old_need;
+    a->stats.used += new_need - old_need;
+    a->stats.grows++;
+    return p;
+  }
+  void* q = arena_alloc(a, new_n);
+  if (q) memcpy(q, p, old_n);
+  return q;
+}
+
+char* arena_strndup(Arena* a, const char* s, size_t n) {
+  char* out = (char*)arena_alloc(a, n + 1);
+  if (!out) return NULL;
+  memcpy(out, s, n);
+  out[n] = '\0';
+  return out;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+
+// Bump allocator for data that lives exactly as long as one owner (the AST).
+// Allocations are zeroed and 16-byte aligned; nothing is freed individually,
+// arena_free releases every chunk at once.
+typedef struct ArenaChunk {
+  struct ArenaChunk* next;
+  size_t used;
+  size_t cap;
+} ArenaChunk;
+
+typedef struct ArenaStats {
+  size_t allocs;     // arena_alloc/arena_grow calls that needed memory
+  size_t grows;      // arena_grow calls extended in place
+  size_t chunks;     // malloc calls made on behalf of the arena
+  size_t used;       // bytes handed out
+  size_t reserved;   // bytes held in chunks
+} ArenaStats;
+
+typedef struct Arena {
+  ArenaChunk* head;  // current chunk; older chunks follow `next`
+  void* last;        // most recent allocation, the one arena_grow can extend
+  ArenaStats stats;
+} Arena;
+
+void arena_init(Arena* a);
+void arena_free(Arena* a);
+void* arena_alloc(Arena* a, size_t n);
+// resize an allocation made from `a`; extends in place when it is the newest
+void* arena_grow(Arena* a, void* p, size_t old_n, size_t new_n);
+char* arena_strndup(Arena* a, const char* s, size_t n);
@@ -0,0 +1,547 @@
+#include "bytecode.h"
+#include "intern.h"
+#include "resolve.h"
+#include <stdlib.h>
+#include <string.h>
+
+static char* dup_n(const char* s, size_t n) {
+  char* out = (char*)malloc(n + 1);
+  if (!out) return NULL;
+  memcpy(out, s, n);
+  out[n] = '\0';
+  return out;
+}
+
+FnProto* proto_new(const char* name, size_t n) {
+  FnProto* p = (FnProto*)calloc(1, sizeof(FnProto));
+  if (p && name) p->name = dup_n(name, n);
+  return p;
+}
+
+void proto_free(FnProto* p) {
+  if (!p) return;
+  free(p->name);
+  free(p->params);
+  free(p->slots);
+  frame_layout_free(&p->layout);
+  free(p->code);
+  for (size_t i = 0; i < p->const_count; i++) value_free(&p->consts[i]);
+  free(p->consts);
+  free(p->names);
+  free(p->name_lens);
+  free(p->handlers);
+  for (size_t i = 0; i < p->proto_count; i++) proto_free(p->protos[i]);
+  free(p->protos);
+  free(p);
+}
+
+void proto_emit(FnProto* p, uint8_t byte) {
+  if (p->code_count + 1 > p->code_cap) {
+    size_t nc = p->code_cap ? p->code_cap * 2 : 64;
+    p->code = (uint8_t*)realloc(p->code, nc);
+    p->code_cap = nc;
+  }
+  p->code[p->code_count++] = byte;
+}
+
+void proto_emit_u16(FnProto* p, uint16_t v) {
+  proto_emit(p, (uint8_t)(v & 0xff));
+  proto_emit(p, (uint8_t)(v >> 8));
+}
+
+void proto_emit_u32(FnProto* p, uint32_t v) {
+  proto_emit_u16(p, (uint16_t)(v & 0xffff));
+  proto_emit_u16(p, (uint16_t)(v >> 16));
+}
+
+size_t proto_add_const(FnProto* p, Value v) {
+  if (p->const_count + 1 > p->const_cap) {
+    size_t nc = p->const_cap ? p->const_cap * 2 : 16;
+    p->consts = (Value*)realloc(p->consts, nc * sizeof(Value));
+    p->const_cap = nc;
+  }
+  p->consts[p->const_count] = v;
+  return p->const_count++;
+}
+
+size_t proto_add_name(FnProto* p, const char* name, size_t n) {
+  for (size_t i = 0; i < p->name_count; i++) {
+    if (p->names[i] == name) return i;
+  }
+  if (p->name_count + 1 > p->name_cap) {
+    size_t nc = p->name_cap ? p->name_cap * 2 : 16;
+    p->names = (const char**)realloc(p->names, nc * sizeof(char*));
+    p->name_lens = (size_t*)realloc(p->name_lens, nc * sizeof(size_t));
+    p->name_cap = nc;
+  }
+  p->names[p->name_count] = name;
+  p->name_lens[p->name_count] = n;
+  return p->name_count++;
+}
+
+size_t proto_add_proto(FnProto* p, FnProto* child) {
+  if (p->proto_count + 1 > p->proto_cap) {
+    size_t nc = p->proto_cap ? p->proto_cap * 2 : 4;
+    p->protos = (FnProto**)realloc(p->protos, nc * sizeof(FnProto*));
+    p->proto_cap = nc;
+  }
+  p->protos[p->proto_count] = child;
+  return p->proto_count++;
+}
+
+void proto_add_handler(FnProto* p, Handler h) {
+  if (p->handler_count + 1 > p->handler_cap) {
+    size_t nc = p->handler_cap ? p->handler_cap * 2 : 4;
+    p->handlers = (Handler*)realloc(p->handlers, nc * sizeof(Handler));
+    p->handler_cap = nc;
+  }
+  p->handlers[p->handler_count++] = h;
+}
+
+void proto_finish(FnProto* p) {
+  frame_layout_free(&p->layout);
+  if (!p->slot_count) return;
+  p->layout.names = (const char**)malloc(p->slot_count * sizeof(char*));
+  p->layout.lens = (size_t*)malloc(p->slot_count * sizeof(size_t));
+  for (size_t i = 0; i < p->slot_count; i++) {
+    p->layout.names[i] = p->names[p->slots[i]];
+    p->layout.lens[i] = p->name_lens[p->slots[i]];
+  }
+  p->layout.count = p->slot_count;
+}
+
+size_t op_operand_bytes(OpCode op) {
+  switch (op) {
+    case OP_CONST: case OP_GET: case OP_SET: case OP_LOCK:
+    case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LOOP:
+    case OP_EXPECT_INT: case OP_FAIL:
+    case OP_SET_SLOT: case OP_LOCK_SLOT:
+      return 2;
+    case OP_APPEND_SLOT:
+      return 3;
+    case OP_CALL: case OP_TAIL_CALL:
+      return 1;
+    case OP_DEFINE: case OP_REPEAT_ITER: case OP_REPEAT_STEP: case OP_LINE:
+      return 4;
+    case OP_GET_SLOT:
+      return 5;
+    default:
+      return 0;
+  }
+}
+
+// .astrb layout: "ASTRB" 0x00, u32 version, then the top-level proto.
+// proto := str name | u32 max_stack | u32 names {str} | u32 slots {u32}
+//          | u32 params {u32}
+//          | u32 code bytes | u32 consts {const} | u32 handlers {6 x u32}
+//          | u32 protos {proto}
+// const := u8 tag (0 null, 1 int, 2 string, 3 bool) payload ; str := u32 len bytes
+// (a name length of 0xffffffff encodes the unnamed top-level script)
+static const char ASTRB_MAGIC[6] = {'A', 'S', 'T', 'R', 'B', '\0'};
+#define ASTRB_VERSION 7u
+#define ASTRB_NO_NAME 0xffffffffu
+
+bool astrb_is_bytecode(const char* src, size_t len) {
+  return len >= sizeof(ASTRB_MAGIC) && memcmp(src, ASTRB_MAGIC, sizeof(ASTRB_MAGIC)) == 0;
+}
+
+static bool put_u32(FILE* f, uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+  return fwrite(b, 1, 4, f) == 4;
+}
+
+static bool put_str(FILE* f, const char* s, size_t n) {
+  if (!s) return put_u32(f, ASTRB_NO_NAME);
+  return put_u32(f, (uint32_t)n) && fwrite(s, 1, n, f) == n;
+}
+
+static bool put_proto(FILE* f, const FnProto* p) {
+  if (!put_str(f, p->name, p->name ? strlen(p->name) : 0)) return false;
+  if (!put_u32(f, (uint32_t)p->max_stack)) return false;
+  if (!put_u32(f, (uint32_t)p->name_count)) return false;
+  for (size_t i = 0; i < p->name_count; i++) if (!put_str(f, p->names[i], p->name_lens[i])) return false;
+  if (!put_u32(f, (uint32_t)p->slot_count)) return false;
+  for (size_t i = 0; i < p->slot_count; i++) if (!put_u32(f, p->slots[i])) return false;
+  if (!put_u32(f, (uint32_t)p->param_count)) return false;
+  for (size_t i = 0; i < p->param_count; i++) if (!put_u32(f, p->params[i])) return false;
+  if (!put_u32(f, (uint32_t)p->code_count)) return false;
+  if (fwrite(p->code, 1, p->code_count, f) != p->code_count) return false;
+  if (!put_u32(f, (uint32_t)p->const_count)) return false;
+  for (size_t i = 0; i < p->const_count; i++) {
+    const Value* c = &p->consts[i];
+    if (c->type == VAL_INT) {
+      uint64_t u = (uint64_t)c->i;
+      if (fputc(1, f) == EOF) return false;
+      if (!put_u32(f, (uint32_t)u) || !put_u32(f, (uint32_t)(u >> 32))) return false;
+    } else if (c->type == VAL_STRING) {
+      const char* s = value_str(c);
+      if (fputc(2, f) == EOF || !put_str(f, s, value_strlen(c))) return false;
+    } else if (c->type == VAL_BOOL) {
+      if (fputc(3, f) == EOF || fputc(c->b ? 1 : 0, f) == EOF) return false;
+    } else {
+      if (fputc(0, f) == EOF) return false;
+    }
+  }
+  if (!put_u32(f, (uint32_t)p->handler_count)) return false;
+  for (size_t i = 0; i < p->handler_count; i++) {
+    const Handler* h = &p->handlers[i];
+    if (!put_u32(f, (uint32_t)h->kind) || !put_u32(f, h->start) || !put_u32(f, h->end) ||
+        !put_u32(f, h->target) || !put_u32(f, h->depth) || !put_u32(f, h->arg)) return false;
+  }
+  if (!put_u32(f, (uint32_t)p->proto_count)) return false;
+  for (size_t i = 0; i < p->proto_count; i++) if (!put_proto(f, p->protos[i])) return false;
+  return true;
+}
+
+bool astrb_save(const FnProto* p, FILE* f) {
+  if (fwrite(ASTRB_MAGIC, 1, sizeof(ASTRB_MAGIC), f) != sizeof(ASTRB_MAGIC)) return false;
+  return put_u32(f, ASTRB_VERSION) && put_proto(f, p);
+}
+
+typedef struct Reader {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool bad;
+} Reader;
+
+static uint32_t get_u32(Reader* r) {
+  if (r->bad || r->end - r->p < 4) { r->bad = true; return 0; }
+  uint32_t v = (uint32_t)r->p[0] | ((uint32_t)r->p[1] << 8) | ((uint32_t)r->p[2] << 16) | ((uint32_t)r->p[3] << 24);
+  r->p += 4;
+  return v;
+}
+
+// returns a pointer into the buffer; *n receives the length
+static const char* get_str(Reader* r, size_t* n) {
+  uint32_t len = get_u32(r);
+  *n = 0;
+  if (r->bad || len == ASTRB_NO_NAME) return NULL;
+  if ((size_t)(r->end - r->p) < len) { r->bad = true; return NULL; }
+  const char* s = (const char*)r->p;
+  r->p += len;
+  *n = len;
+  return s;
+}
+
+static bool count_fits(Reader* r, uint32_t count, size_t min_bytes_each) {
+  if (r->bad) return false;
+  if ((size_t)count > (size_t)(r->end - r->p) / min_bytes_each) { r->bad = true; return false; }
+  return true;
+}
+
+typedef struct ProtoChain {
+  const FnProto* proto;
+  const struct ProtoChain* up;
+} ProtoChain;
+
+// Operand stack effect of the instruction whose operands start at ip: how
+// many values it takes off the stack and how many it leaves in their place.
+static void op_stack_effect(OpCode op, const uint8_t* ip, size_t* pops, size_t* pushes) {
+  *pops = 0;
+  *pushes = 0;
+  if (op >= OP_ADD && op <= OP_OR) { *pops = 2; *pushes = 1; return; }
+  switch (op) {
+    case OP_CONST: case OP_NULL: case OP_GET: case OP_GET_SLOT:
+      *pushes = 1;
+      break;
+    case OP_POP: case OP_SET: case OP_LOCK: case OP_SET_SLOT: case OP_LOCK_SLOT:
+    case OP_JUMP_IF_FALSE: case OP_RETURN: case OP_SHOW: case OP_WARN:
+      *pops = 1;
+      break;
+    case OP_APPEND_SLOT:
+      *pops = (size_t)ip[2] + 1;
+      break;
+    case OP_NEGATE: case OP_NOT: case OP_EXPECT_INT:
+      *pops = 1; *pushes = 1;
+      break;
+    case OP_CALL: case OP_TAIL_CALL:
+      *pops = (size_t)ip[0] + 1; *pushes = 1;
+      break;
+    case OP_REPEAT_ITER: case OP_REPEAT_STEP:
+      *pops = 2; *pushes = 2;
+      break;
+    default:
+      break;
+  }
+}
+
+typedef struct StackWalk {
+  const FnProto* proto;
+  const uint8_t* is_start; // 1 where an instruction begins
+  uint32_t* depth;         // operand depth on entry; UINT32_MAX when unreached
+  size_t* work;
+  size_t work_count;
+  size_t peak;             // deepest point reached
+} StackWalk;
+
+static bool walk_reach(StackWalk* w, size_t at, size_t depth) {
+  if (at >= w->proto->code_count || !w->is_start[at] || depth > w->proto->max_stack) return false;
+  if (depth > w->peak) w->peak = depth;
+  if (w->depth[at] == UINT32_MAX) {
+    w->depth[at] = (uint32_t)depth;
+    w->work[w->work_count++] = at;
+    return true;
+  }
+  return w->depth[at] == depth;
+}
+
+// Give every instruction reachable from the entry or a try handler one
+// operand stack depth. Jumps must land on instruction starts, paths that
+// meet must agree, nothing pops below the frame base or pushes past
+// max_stack, and a try body never drops below the depth its handler
+// unwinds to. The VM's pushes are unchecked beyond the max_stack that frame
+// entry reserves, so this is what keeps them inside the stack. max_stack
+// then drops to the depth actually reached, so a file cannot make frame
+// entry reserve more than its code uses.
+static bool proto_verify_stack(FnProto* p, const uint8_t* is_start) {
+  StackWalk w = {p, is_start, NULL, NULL, 0, 0};
+  w.depth = (uint32_t*)malloc(p->code_count * sizeof(uint32_t));
+  w.work = (size_t*)malloc(p->code_count * sizeof(size_t));
+  bool ok = w.depth && w.work && p->max_stack < UINT32_MAX;
+  if (ok) {
+    for (size_t i = 0; i < p->code_count; i++) w.depth[i] = UINT32_MAX;
+    ok = walk_reach(&w, 0, 0);
+  }
+  for (size_t k = 0; ok && k < p->handler_count; k++) {
+    const Handler* h = &p->handlers[k];
+    if (h->kind == HANDLER_TRY) ok = walk_reach(&w, h->target, h->depth);
+  }
+  while (ok && w.work_count) {
+    size_t at = w.work[--w.work_count];
+    OpCode op = (OpCode)p->code[at];
+    const uint8_t* ip = p->code + at + 1;
+    size_t next = at + 1 + op_operand_bytes(op);
+    size_t pops, pushes;
+    op_stack_effect(op, ip, &pops, &pushes);
+    if (pops > w.depth[at]) { ok = false; break; }
+    size_t after = w.depth[at] - pops + pushes;
+    switch (op) {
+      case OP_RETURN: case OP_FAIL:
+        break;
+      case OP_JUMP:
+        ok = walk_reach(&w, next + read_u16(ip), after);
+        break;
+      case OP_JUMP_IF_FALSE:
+        ok = walk_reach(&w, next, after) && walk_reach(&w, next + read_u16(ip), after);
+        break;
+      case OP_LOOP:
+        ok = walk_reach(&w, next - read_u16(ip), after);
+        break;
+      case OP_REPEAT_ITER:
+        ok = walk_reach(&w, next, after) && walk_reach(&w, next + read_u16(ip + 2), after);
+        break;
+      case OP_REPEAT_STEP:
+        ok = walk_reach(&w, next, after) && walk_reach(&w, next - read_u16(ip + 2), after);
+        break;
+      default:
+        ok = walk_reach(&w, next, after);
+        break;
+    }
+  }
+  // a failure at offset off unwinds to a handler covering (start, end]; the
+  // failing instruction has already dropped its operands
+  for (size_t k = 0; ok && k < p->handler_count; k++) {
+    const Handler* h = &p->handlers[k];
+    if (h->kind != HANDLER_TRY) continue;
+    size_t from = h->start > 5 ? h->start - 5 : 0;
+    for (size_t at = from; ok && at < h->end && at < p->code_count; at++) {
+      if (!is_start[at] || w.depth[at] == UINT32_MAX) continue;
+      OpCode op = (OpCode)p->code[at];
+      if (at + 1 + op_operand_bytes(op) <= h->start) continue;
+      size_t pops, pushes;
+      op_stack_effect(op, p->code + at + 1, &pops, &pushes);
+      if (w.depth[at] - pops < h->depth) ok = false;
+    }
+  }
+  free(w.depth);
+  free(w.work);
+  if (ok) p->max_stack = w.peak;
+  return ok;
+}
+
+// Reject code whose operands point outside the proto's tables (or, for
+// outer slots, the enclosing protos' frames) or whose operand stack could
+// leave the frame's max_stack (proto_verify_stack), so a corrupt file fails
+// at load time instead of inside the VM. Operand types are not checked.
+static bool proto_verify(FnProto* p, const ProtoChain* up) {
+  ProtoChain here = {p, up};
+  if (!p->code_count) return false;
+  uint8_t* is_start = (uint8_t*)calloc(p->code_count, 1);
+  if (!is_start) return false;
+  bool ok = true;
+  size_t i = 0;
+  while (ok && i < p->code_count) {
+    OpCode op = (OpCode)p->code[i];
+    if (op >= OP_COUNT) { ok = false; break; }
+    size_t nb = op_operand_bytes(op);
+    if (i + 1 + nb > p->code_count) { ok = false; break; }
+    is_start[i] = 1;
+    const uint8_t* ip = p->code + i + 1;
+    size_t next = i + 1 + nb;
+    switch (op) {
+      case OP_CONST: case OP_EXPECT_INT: case OP_FAIL:
+        ok = read_u16(ip) < p->const_count;
+        break;
+      case OP_GET: case OP_SET: case OP_LOCK:
+        ok = read_u16(ip) < p->name_count;
+        break;
+      case OP_LOOP:
+        ok = read_u16(ip) <= next;
+        break;
+      case OP_REPEAT_STEP:
+        ok = read_u16(ip) < p->slot_count && read_u16(ip + 2) <= next;
+        break;
+      case OP_GET_SLOT: {
+        const ProtoChain* c = &here;
+        for (unsigned d = ip[0]; d && c; d--) c = c->up;
+        ok = read_u16(ip + 3) < p->name_count && c && read_u16(ip + 1) < c->proto->slot_count;
+        break;
+      }
+      case OP_SET_SLOT: case OP_LOCK_SLOT:
+        ok = read_u16(ip) < p->slot_count;
+        break;
+      case OP_APPEND_SLOT:
+        ok = read_u16(ip) < p->slot_count && ip[2] != 0 && ip[2] <= APPEND_MAX_PIECES;
+        break;
+      case OP_DEFINE:
+        ok = read_u16(ip) < p->proto_count && read_u16(ip + 2) < p->slot_count;
+        break;
+      case OP_REPEAT_ITER:
+        ok = read_u16(ip) < p->slot_count;
+        break;
+      default:
+        break;
+    }
+    i = next;
+  }
+  for (size_t k = 0; ok && k < p->slot_count; k++) if (p->slots[k] >= p->name_count) ok = false;
+  for (size_t k = 0; ok && k < p->param_count; k++) if (p->params[k] >= p->slot_count) ok = false;
+  for (size_t k = 0; ok && k < p->handler_count; k++) {
+    const Handler* h = &p->handlers[k];
+    if (h->end > p->code_count || h->target > p->code_count) ok = false;
+    if (h->kind == HANDLER_MESSAGE && h->arg >= p->const_count) ok = false;
+  }
+  ok = ok && proto_verify_stack(p, is_start);
+  free(is_start);
+  for (size_t k = 0; ok && k < p->proto_count; k++) ok = proto_verify(p->protos[k], &here);
+  return ok;
+}
+
+static FnProto* get_proto(Reader* r, int nesting) {
+  if (nesting > 256) { r->bad = true; return NULL; }
+  FnProto* p = proto_new(NULL, 0);
+  size_t n = 0;
+  const char* name = get_str(r, &n);
+  if (name) p->name = dup_n(name, n);
+  p->max_stack = get_u32(r);
+
+  uint32_t names = get_u32(r);
+  if (count_fits(r, names, 4)) {
+    for (uint32_t i = 0; i < names && !r->bad; i++) {
+      const char* s = get_str(r, &n);
+      const char* name = s ? intern(s, n) : NULL;
+      if (!name) { r->bad = true; break; }
+      // names are unique when written, so indices are preserved
+      proto_add_name(p, name, n);
+    }
+  }
+
+  uint32_t sc = get_u32(r);
+  if (count_fits(r, sc, 4) && sc) {
+    p->slots = (uint16_t*)calloc(sc, sizeof(uint16_t));
+    p->slot_count = sc;
+    for (uint32_t i = 0; i < sc; i++) {
+      uint32_t k = get_u32(r);
+      if (k >= p->name_count) r->bad = true;
+      p->slots[i] = (uint16_t)k;
+    }
+  }
+
+  uint32_t pc = get_u32(r);
+  if (count_fits(r, pc, 4) && pc) {
+    p->params = (uint16_t*)calloc(pc, sizeof(uint16_t));
+    p->param_count = pc;
+    for (uint32_t i = 0; i < pc; i++) p->params[i] = (uint16_t)get_u32(r);
+  }
+
+  uint32_t cc = get_u32(r);
+  if (count_fits(r, cc, 1)) {
+    for (uint32_t i = 0; i < cc; i++) proto_emit(p, r->p[i]);
+    r->p += cc;
+  }
+
+  uint32_t kc = get_u32(r);
+  if (count_fits(r, kc, 1)) {
+    for (uint32_t i = 0; i < kc && !r->bad; i++) {
+      if (r->p >= r->end) { r->bad = true; break; }
+      uint8_t tag = *r->p++;
+      if (tag == 1) {
+        uint64_t lo = get_u32(r), hi = get_u32(r);
+        proto_add_const(p, value_int((long)(lo | (hi << 32))));
+      } else if (tag == 2) {
+        const char* s = get_str(r, &n);
+        if (r->bad) break;
+        const char* text = intern(s ? s : "", n);
+        if (!text) { r->bad = true; break; }
+        proto_add_const(p, intern_value(text));
+      } else if (tag == 3) {
+        if (r->p >= r->end) { r->bad = true; break; }
+        proto_add_const(p, value_bool(*r->p++ != 0));
+      } else {
+        proto_add_const(p, value_null());
+      }
+    }
+  }
+
+  uint32_t hc = get_u32(r);
+  if (count_fits(r, hc, 24)) {
+    for (uint32_t i = 0; i < hc && !r->bad; i++) {
+      Handler h;
+      h.kind = (HandlerKind)get_u32(r);
+      h.start = get_u32(r);
+      h.end = get_u32(r);
+      h.target = get_u32(r);
+      h.depth = get_u32(r);
+      h.arg = get_u32(r);
+      proto_add_handler(p, h);
+    }
+  }
+
+  uint32_t nc = get_u32(r);
+  if (count_fits(r, nc, 4)) {
+    for (uint32_t i = 0; i < nc && !r->bad; i++) {
+      FnProto* child = get_proto(r, nesting + 1);
+      if (child) proto_add_proto(p, child);
+    }
+  }
+  if (r->bad || p->name_count != names) {
+    r->bad = true;
+    proto_free(p);
+    return NULL;
+  }
+  proto_finish(p);
+  return p;
+}
+
+FnProto* astrb_load(const char* src, size_t len, char* errbuf, size_t errbuf_n) {
+  if (!astrb_is_bytecode(src, len)) {
+    snprintf(errbuf, errbuf_n, "not an .astrb file");
+    return NULL;
+  }
+  Reader r;
+  r.p = (const uint8_t*)src + sizeof(ASTRB_MAGIC);
+  r.end = (const uint8_t*)src + len;
+  r.bad = false;
+  uint32_t version = get_u32(&r);
+  if (r.bad || version != ASTRB_VERSION) {
+    snprintf(errbuf, errbuf_n, "unsupported .astrb version");
+    return NULL;
+  }
+  FnProto* p = get_proto(&r, 0);
+  if (p && !proto_verify(p, NULL)) {
+    proto_free(p);
+    p = NULL;
+  }
+  if (!p) snprintf(errbuf, errbuf_n, "truncated or corrupt .astrb file");
+  return p;
+}
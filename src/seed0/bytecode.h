@@ -0,0 +1,127 @@
+#pragma once
+#include "parser.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Bytecode for the seed0 VM (`.astrb`). Operands are little-endian and
+// follow the opcode byte; `u16` operands index the owning proto's tables.
+typedef enum OpCode {
+  OP_CONST = 0,     // u16 const        -> push consts[k]
+  OP_NULL,          //                  -> push null
+  OP_POP,           // pop and free top
+  OP_GET,           // u16 name         -> push env_get(name)
+  OP_SET,           // u16 name         pop -> env_set(name)
+  OP_LOCK,          // u16 name         pop -> env_set(name, locked)
+  OP_GET_SLOT,      // u8 depth, u16 slot, u16 name  by-name fallback when unset
+  OP_SET_SLOT,      // u16 slot         pop -> assign the local slot
+  OP_LOCK_SLOT,     // u16 slot         pop -> assign the local slot, locked
+  OP_APPEND_SLOT,   // u16 slot, u8 n   [x, y1..yn] -> slot = x + y1 + ... + yn, in place when unshared
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EQ,
+  OP_NEQ,
+  OP_LT,
+  OP_LTE,
+  OP_GT,
+  OP_GTE,
+  OP_AND,
+  OP_OR,
+  OP_NEGATE,
+  OP_NOT,
+  OP_JUMP,          // u16 offset       forward jump
+  OP_JUMP_IF_FALSE, // u16 offset       pop; forward jump when falsey
+  OP_LOOP,          // u16 offset       backward jump
+  OP_CALL,          // u8 argc          [callee, args...] -> result
+  OP_RETURN,        // pop -> return from the current frame
+  OP_SHOW,          // pop -> rt_show
+  OP_WARN,          // pop -> rt_warn
+  OP_DEFINE,        // u16 proto, u16 slot  bind a new function locally
+  OP_EXPECT_INT,    // u16 const        fail with consts[k] unless top is int
+  OP_REPEAT_ITER,   // u16 slot, u16 offset  [i, end]: bind i, or jump when i > end
+  OP_REPEAT_STEP,   // u16 slot, u16 offset  [i, end]: unless i == end, i++, bind i and jump back to the body
+  OP_FAIL,          // u16 const        fail with consts[k]
+  OP_LINE,          // u32 line         a statement starts (profiling builds only)
+  OP_TAIL_CALL,     // u8 argc          `return f(...)`: run f in this frame; else like OP_CALL
+  OP_COUNT
+} OpCode;
+
+// What happens when a failure is raised inside (start, end] of a proto.
+typedef enum HandlerKind {
+  HANDLER_RETURN = 0, // `return <expr>`: the error value becomes the result
+  HANDLER_TRY,        // `try ... otherwise`: unwind to depth, jump to target
+  HANDLER_MESSAGE     // replace the message with consts[arg], keep unwinding
+} HandlerKind;
+
+typedef struct Handler {
+  HandlerKind kind;
+  uint32_t start;
+  uint32_t end;
+  uint32_t target;   // HANDLER_TRY jump target
+  uint32_t depth;    // HANDLER_TRY stack depth relative to the frame base
+  uint32_t arg;      // HANDLER_MESSAGE const index
+} Handler;
+
+typedef struct FnProto {
+  char* name;              // NULL for the top-level script
+  uint16_t* params;        // frame slot of each parameter
+  size_t param_count;
+  uint16_t* slots;         // name index of each frame slot
+  size_t slot_count;
+  FrameLayout layout;      // slots resolved to names, built by proto_finish
+  size_t max_stack;        // deepest operand stack use, checked at frame entry
+
+  uint8_t* code;
+  size_t code_count;
+  size_t code_cap;
+
+  Value* consts;
+  size_t const_count;
+  size_t const_cap;
+
+  const char** names;      // interned identifiers referenced by OP_GET/OP_SET/...
+  size_t* name_lens;
+  size_t name_count;
+  size_t name_cap;
+
+  Handler* handlers;       // innermost first
+  size_t handler_count;
+  size_t handler_cap;
+
+  struct FnProto** protos; // nested `define`s
+  size_t proto_count;
+  size_t proto_cap;
+} FnProto;
+
+FnProto* proto_new(const char* name, size_t n);
+void proto_free(FnProto* p);
+
+void proto_emit(FnProto* p, uint8_t byte);
+void proto_emit_u16(FnProto* p, uint16_t v);
+void proto_emit_u32(FnProto* p, uint32_t v);
+size_t proto_add_const(FnProto* p, Value v);
+// name must be interned
+size_t proto_add_name(FnProto* p, const char* name, size_t n);
+size_t proto_add_proto(FnProto* p, FnProto* child);
+void proto_add_handler(FnProto* p, Handler h);
+// build the frame layout once names and slots are final
+void proto_finish(FnProto* p);
+
+// bytes of operands following each opcode
+size_t op_operand_bytes(OpCode op);
+
+static inline uint16_t read_u16(const uint8_t* ip) {
+  return (uint16_t)(ip[0] | (ip[1] << 8));
+}
+
+static inline uint32_t read_u32(const uint8_t* ip) {
+  return (uint32_t)read_u16(ip) | ((uint32_t)read_u16(ip + 2) << 16);
+}
+
+// `.astrb` serialization
+bool astrb_is_bytecode(const char* src, size_t len);
+bool astrb_save(const FnProto* p, FILE* f);
+FnProto* astrb_load(const char* src, size_t len, char* errbuf, size_t errbuf_n);
@@ -0,0 +1,460 @@
+#include "compile.h"
+#include "resolve.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef struct PatchList {
+  size_t* at;
+  size_t count;
+  size_t cap;
+} PatchList;
+
+typedef struct Loop {
+  struct Loop* outer;
+  bool is_repeat;
+  size_t top;            // loop forever: continue target
+  PatchList breaks;
+  PatchList continues;   // repeat: jumps to the step instruction
+} Loop;
+
+typedef struct Compiler {
+  FnProto* proto;
+  CompileOptions opts;
+  Loop* loop;
+  size_t depth;          // operand stack depth at the current point
+  char* errbuf;
+  size_t errbuf_n;
+  bool failed;
+} Compiler;
+
+static void fail(Compiler* c, const char* msg) {
+  if (c->failed) return;
+  c->failed = true;
+  snprintf(c->errbuf, c->errbuf_n, "%s", msg);
+}
+
+static void push_depth(Compiler* c, size_t n) {
+  c->depth += n;
+  if (c->depth > c->proto->max_stack) c->proto->max_stack = c->depth;
+}
+
+static void pop_depth(Compiler* c, size_t n) {
+  c->depth -= n;
+}
+
+static void emit(Compiler* c, OpCode op) {
+  proto_emit(c->proto, (uint8_t)op);
+}
+
+static void emit_u16(Compiler* c, size_t v) {
+  if (v > 0xffff) { fail(c, "bytecode operand out of range"); v = 0; }
+  proto_emit_u16(c->proto, (uint16_t)v);
+}
+
+static size_t name_index(Compiler* c, const Token* t) {
+  return proto_add_name(c->proto, t->start, t->length);
+}
+
+static void set_layout(Compiler* c, const FrameLayout* l) {
+  FnProto* p = c->proto;
+  if (l->count > 0xffff) { fail(c, "too many variables in one frame for bytecode"); return; }
+  if (l->count) p->slots = (uint16_t*)calloc(l->count, sizeof(uint16_t));
+  p->slot_count = l->count;
+  for (size_t i = 0; i < l->count; i++) {
+    p->slots[i] = (uint16_t)proto_add_name(p, l->names[i], l->lens[i]);
+  }
+}
+
+static void require_slot(Compiler* c, const VarRef* r) {
+  if (r->slot < 0) fail(c, "program was not resolved before compiling");
+}
+
+static size_t message_const(Compiler* c, const char* msg) {
+  return proto_add_const(c->proto, value_string(msg, strlen(msg)));
+}
+
+// forward jump with a placeholder offset; returns the operand position
+static size_t emit_jump(Compiler* c, OpCode op) {
+  emit(c, op);
+  size_t at = c->proto->code_count;
+  proto_emit_u16(c->proto, 0xffff);
+  return at;
+}
+
+static void patch_jump_to(Compiler* c, size_t at, size_t target) {
+  size_t off = target - (at + 2);
+  if (off > 0xffff) { fail(c, "jump too large for bytecode"); return; }
+  c->proto->code[at] = (uint8_t)(off & 0xff);
+  c->proto->code[at + 1] = (uint8_t)(off >> 8);
+}
+
+static void patch_jump(Compiler* c, size_t at) {
+  patch_jump_to(c, at, c->proto->code_count);
+}
+
+static void emit_loop(Compiler* c, OpCode op, size_t target) {
+  emit(c, op);
+  size_t off = c->proto->code_count + 2 - target;
+  emit_u16(c, off);
+}
+
+static void patch_push(PatchList* l, size_t at) {
+  if (l->count + 1 > l->cap) {
+    size_t nc = l->cap ? l->cap * 2 : 4;
+    l->at = (size_t*)realloc(l->at, nc * sizeof(size_t));
+    l->cap = nc;
+  }
+  l->at[l->count++] = at;
+}
+
+static void patch_all(Compiler* c, PatchList* l) {
+  for (size_t i = 0; i < l->count; i++) patch_jump(c, l->at[i]);
+  free(l->at);
+  l->at = NULL; l->count = 0; l->cap = 0;
+}
+
+static void compile_expr(Compiler* c, const Expr* e);
+static void compile_block(Compiler* c, const Block* b);
+
+static void compile_binary(Compiler* c, const Expr* e) {
+  compile_expr(c, e->left);
+  compile_expr(c, e->right);
+  switch (e->op) {
+    case BIN_ADD: emit(c, OP_ADD); break;
+    case BIN_SUB: emit(c, OP_SUB); break;
+    case BIN_MUL: emit(c, OP_MUL); break;
+    case BIN_DIV: emit(c, OP_DIV); break;
+    case BIN_EQ: emit(c, OP_EQ); break;
+    case BIN_NEQ: emit(c, OP_NEQ); break;
+    case BIN_LT: emit(c, OP_LT); break;
+    case BIN_LTE: emit(c, OP_LTE); break;
+    case BIN_GT: emit(c, OP_GT); break;
+    case BIN_GTE: emit(c, OP_GTE); break;
+    case BIN_AND: emit(c, OP_AND); break;
+    case BIN_OR: emit(c, OP_OR); break;
+  }
+  pop_depth(c, 1);
+}
+
+static void emit_bool(Compiler* c, bool b) {
+  emit(c, OP_CONST);
+  emit_u16(c, proto_add_const(c->proto, value_bool(b)));
+  push_depth(c, 1);
+}
+
+// truthiness of `e` as a bool, as eager and/or produce it
+static void compile_truth(Compiler* c, const Expr* e) {
+  compile_expr(c, e);
+  emit(c, OP_NOT);
+  emit(c, OP_NOT);
+}
+
+// left; if falsey jump to the second arm; `and` then tests the right operand
+// and `or` is already true, and the second arm is the other way round
+static void compile_logical(Compiler* c, const Expr* e) {
+  bool is_or = e->op == BIN_OR;
+  compile_expr(c, e->left);
+  size_t to_else = emit_jump(c, OP_JUMP_IF_FALSE);
+  pop_depth(c, 1);
+  if (is_or) emit_bool(c, true);
+  else compile_truth(c, e->right);
+  size_t to_end = emit_jump(c, OP_JUMP);
+  pop_depth(c, 1);
+  patch_jump(c, to_else);
+  if (is_or) compile_truth(c, e->right);
+  else emit_bool(c, false);
+  patch_jump(c, to_end);
+}
+
+static void compile_expr(Compiler* c, const Expr* e) {
+  if (c->failed) return;
+  if (!e) { fail(c, "null expr"); return; }
+  switch (e->type) {
+    case EXPR_LITERAL:
+      emit(c, OP_CONST);
+      emit_u16(c, proto_add_const(c->proto, value_copy(&e->lit)));
+      push_depth(c, 1);
+      return;
+    case EXPR_IDENT:
+      if (e->ref.slot >= 0 && e->ref.depth <= 0xff) {
+        emit(c, OP_GET_SLOT);
+        proto_emit(c->proto, (uint8_t)e->ref.depth);
+        emit_u16(c, (size_t)e->ref.slot);
+      } else {
+        emit(c, OP_GET);
+      }
+      emit_u16(c, name_index(c, &e->tok));
+      push_depth(c, 1);
+      return;
+    case EXPR_GROUP:
+      compile_expr(c, e->left);
+      return;
+    case EXPR_UNARY:
+      compile_expr(c, e->left);
+      emit(c, e->unop == UN_NEGATE ? OP_NEGATE : OP_NOT);
+      return;
+    case EXPR_BINARY:
+      compile_binary(c, e);
+      return;
+    case EXPR_CONDITIONAL: {
+      compile_expr(c, e->cond);
+      size_t to_else = emit_jump(c, OP_JUMP_IF_FALSE);
+      pop_depth(c, 1);
+      compile_expr(c, e->left);
+      size_t to_end = emit_jump(c, OP_JUMP);
+      pop_depth(c, 1);
+      patch_jump(c, to_else);
+      compile_expr(c, e->right);
+      patch_jump(c, to_end);
+      return;
+    }
+    case EXPR_LOGICAL:
+      compile_logical(c, e);
+      return;
+    case EXPR_CALL: {
+      compile_expr(c, e->call.callee);
+      for (size_t i = 0; i < e->call.arg_count; i++) compile_expr(c, e->call.args[i]);
+      if (e->call.arg_count > 0xff) { fail(c, "too many call arguments for bytecode"); return; }
+      emit(c, OP_CALL);
+      proto_emit(c->proto, (uint8_t)e->call.arg_count);
+      pop_depth(c, e->call.arg_count);
+      return;
+    }
+  }
+  fail(c, "unknown expr");
+}
+
+// Compile an expression whose failures are reported with a fixed message,
+// matching the tree-walker's repeat-bound errors.
+static void compile_expr_with_message(Compiler* c, const Expr* e, const char* msg) {
+  size_t k = message_const(c, msg);
+  uint32_t start = (uint32_t)c->proto->code_count;
+  compile_expr(c, e);
+  emit(c, OP_EXPECT_INT);
+  emit_u16(c, k);
+  Handler h = {HANDLER_MESSAGE, start, (uint32_t)c->proto->code_count, 0, 0, (uint32_t)k};
+  proto_add_handler(c->proto, h);
+}
+
+static FnProto* compile_function(Compiler* parent, const Stmt* s) {
+  Compiler fc;
+  memset(&fc, 0, sizeof(fc));
+  fc.proto = proto_new(s->name.start, s->name.length);
+  fc.opts = parent->opts;
+  fc.errbuf = parent->errbuf;
+  fc.errbuf_n = parent->errbuf_n;
+  if (s->param_count > 0xff) fail(&fc, "too many parameters for bytecode");
+  if (s->param_count && !s->param_slots) fail(&fc, "program was not resolved before compiling");
+  set_layout(&fc, &s->frame);
+  if (s->param_count) fc.proto->params = (uint16_t*)calloc(s->param_count, sizeof(uint16_t));
+  fc.proto->param_count = s->param_count;
+  for (size_t i = 0; i < s->param_count && !fc.failed; i++) {
+    fc.proto->params[i] = (uint16_t)s->param_slots[i];
+  }
+  compile_block(&fc, s->block);
+  emit(&fc, OP_NULL);
+  emit(&fc, OP_RETURN);
+  push_depth(&fc, 1);
+  proto_finish(fc.proto);
+  if (fc.failed) parent->failed = true;
+  return fc.proto;
+}
+
+static void compile_stmt(Compiler* c, const Stmt* s) {
+  if (c->failed) return;
+  if (c->opts.line_marks) {
+    emit(c, OP_LINE);
+    proto_emit_u32(c->proto, s->line > 0xffffffffu ? 0xffffffffu : (uint32_t)s->line);
+  }
+  switch (s->type) {
+    case STMT_SHOW:
+    case STMT_WARN:
+      compile_expr(c, s->expr);
+      emit(c, s->type == STMT_SHOW ? OP_SHOW : OP_WARN);
+      pop_depth(c, 1);
+      return;
+    case STMT_SET:
+    case STMT_LOCK: {
+      const Expr* pieces[APPEND_MAX_PIECES];
+      size_t n = resolve_append_pieces(s, pieces);
+      if (n) {
+        const Expr* x = s->expr;
+        for (size_t i = 0; i < n; i++) x = x->left;
+        compile_expr(c, x);
+        for (size_t i = 0; i < n; i++) compile_expr(c, pieces[i]);
+        emit(c, OP_APPEND_SLOT);
+        emit_u16(c, (size_t)s->ref.slot);
+        proto_emit(c->proto, (uint8_t)n);
+        pop_depth(c, n + 1);
+        return;
+      }
+      compile_expr(c, s->expr);
+      if (s->ref.slot >= 0 && !s->ref.shadowed) {
+        emit(c, s->type == STMT_LOCK ? OP_LOCK_SLOT : OP_SET_SLOT);
+        emit_u16(c, (size_t)s->ref.slot);
+      } else {
+        emit(c, s->type == STMT_LOCK ? OP_LOCK : OP_SET);
+        emit_u16(c, name_index(c, &s->name));
+      }
+      pop_depth(c, 1);
+      return;
+    }
+    case STMT_EXPR:
+      compile_expr(c, s->expr);
+      emit(c, OP_POP);
+      pop_depth(c, 1);
+      return;
+    case STMT_IF: {
+      compile_expr(c, s->expr);
+      size_t to_else = emit_jump(c, OP_JUMP_IF_FALSE);
+      pop_depth(c, 1);
+      compile_block(c, s->block);
+      if (s->else_block) {
+        size_t to_end = emit_jump(c, OP_JUMP);
+        patch_jump(c, to_else);
+        compile_block(c, s->else_block);
+        patch_jump(c, to_end);
+      } else {
+        patch_jump(c, to_else);
+      }
+      return;
+    }
+    case STMT_LOOP_FOREVER: {
+      Loop loop;
+      memset(&loop, 0, sizeof(loop));
+      loop.outer = c->loop;
+      loop.top = c->proto->code_count;
+      c->loop = &loop;
+      compile_block(c, s->block);
+      emit_loop(c, OP_LOOP, loop.top);
+      c->loop = loop.outer;
+      patch_all(c, &loop.breaks);
+      return;
+    }
+    case STMT_REPEAT: {
+      compile_expr_with_message(c, s->expr, "repeat start must be int");
+      compile_expr_with_message(c, s->expr_b, "repeat end must be int");
+      Loop loop;
+      memset(&loop, 0, sizeof(loop));
+      loop.outer = c->loop;
+      loop.is_repeat = true;
+      require_slot(c, &s->ref);
+      emit(c, OP_REPEAT_ITER);
+      emit_u16(c, (size_t)s->ref.slot);
+      size_t to_exit = c->proto->code_count;
+      proto_emit_u16(c->proto, 0xffff);
+      size_t body = c->proto->code_count;
+      c->loop = &loop;
+      compile_block(c, s->block);
+      c->loop = loop.outer;
+      patch_all(c, &loop.continues);
+      // steps, checks and rebinds in one instruction, back into the body
+      emit(c, OP_REPEAT_STEP);
+      emit_u16(c, (size_t)s->ref.slot);
+      emit_u16(c, c->proto->code_count + 2 - body);
+      patch_jump(c, to_exit);
+      patch_all(c, &loop.breaks);
+      emit(c, OP_POP);
+      emit(c, OP_POP);
+      pop_depth(c, 2);
+      return;
+    }
+    case STMT_DEFINE: {
+      require_slot(c, &s->ref);
+      FnProto* fn = compile_function(c, s);
+      size_t idx = proto_add_proto(c->proto, fn);
+      emit(c, OP_DEFINE);
+      emit_u16(c, idx);
+      emit_u16(c, (size_t)s->ref.slot);
+      return;
+    }
+    case STMT_TRY: {
+      uint32_t start = (uint32_t)c->proto->code_count;
+      size_t depth = c->depth;
+      compile_block(c, s->block);
+      if (!s->else_block) return;  // a bare try re-raises, so it needs no handler
+      uint32_t end = (uint32_t)c->proto->code_count;
+      size_t to_end = emit_jump(c, OP_JUMP);
+      Handler h = {HANDLER_TRY, start, end, (uint32_t)c->proto->code_count, (uint32_t)depth, 0};
+      proto_add_handler(c->proto, h);
+      compile_block(c, s->else_block);
+      patch_jump(c, to_end);
+      return;
+    }
+    case STMT_RETURN: {
+      if (!s->expr) {
+        emit(c, OP_NULL);
+      } else if (c->proto->name && s->expr->type == EXPR_CALL) {
+        // OP_TAIL_CALL falls back to an ordinary call, so OP_RETURN follows
+        uint32_t start = (uint32_t)c->proto->code_count;
+        const CallExpr* call = &s->expr->call;
+        compile_expr(c, call->callee);
+        for (size_t i = 0; i < call->arg_count; i++) compile_expr(c, call->args[i]);
+        if (call->arg_count > 0xff) { fail(c, "too many call arguments for bytecode"); return; }
+        emit(c, OP_TAIL_CALL);
+        proto_emit(c->proto, (uint8_t)call->arg_count);
+        pop_depth(c, call->arg_count);
+        Handler h = {HANDLER_RETURN, start, (uint32_t)c->proto->code_count, 0, 0, 0};
+        proto_add_handler(c->proto, h);
+        pop_depth(c, 1);
+      } else {
+        uint32_t start = (uint32_t)c->proto->code_count;
+        compile_expr(c, s->expr);
+        Handler h = {HANDLER_RETURN, start, (uint32_t)c->proto->code_count, 0, 0, 0};
+        proto_add_handler(c->proto, h);
+        pop_depth(c, 1);
+      }
+      emit(c, OP_RETURN);
+      return;
+    }
+    case STMT_BREAK:
+    case STMT_CONTINUE: {
+      // outside a loop these end the enclosing function (or the program)
+      if (!c->loop) {
+        emit(c, OP_NULL);
+        emit(c, OP_RETURN);
+        push_depth(c, 1);
+        pop_depth(c, 1);
+        return;
+      }
+      if (s->type == STMT_BREAK) {
+        patch_push(&c->loop->breaks, emit_jump(c, OP_JUMP));
+      } else if (c->loop->is_repeat) {
+        patch_push(&c->loop->continues, emit_jump(c, OP_JUMP));
+      } else {
+        emit_loop(c, OP_LOOP, c->loop->top);
+      }
+      return;
+    }
+    default:
+      emit(c, OP_FAIL);
+      emit_u16(c, message_const(c, "unsupported statement (seed0)"));
+      return;
+  }
+}
+
+static void compile_block(Compiler* c, const Block* b) {
+  if (!b) return;
+  for (size_t i = 0; i < b->count && !c->failed; i++) compile_stmt(c, &b->stmts[i]);
+}
+
+FnProto* compile_program(const Program* p, const CompileOptions* opts, char* errbuf, size_t errbuf_n) {
+  Compiler c;
+  memset(&c, 0, sizeof(c));
+  if (opts) c.opts = *opts;
+  c.proto = proto_new(NULL, 0);
+  c.errbuf = errbuf;
+  c.errbuf_n = errbuf_n;
+  set_layout(&c, &p->globals);
+  compile_block(&c, &p->block);
+  emit(&c, OP_NULL);
+  emit(&c, OP_RETURN);
+  push_depth(&c, 1);
+  proto_finish(c.proto);
+  if (c.failed) {
+    proto_free(c.proto);
+    return NULL;
+  }
+  return c.proto;
+}
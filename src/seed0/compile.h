@@ -0,0 +1,12 @@
+#pragma once
+#include "parser.h"
+#include "bytecode.h"
+
+typedef struct CompileOptions {
+  bool line_marks;   // emit OP_LINE before every statement for --profile
+} CompileOptions;
+
+// Lower a parsed program to bytecode. Returns NULL and fills errbuf when a
+// construct does not fit the encoding (e.g. a function over 64 KiB of code).
+// NULL options means the defaults (all false).
+FnProto* compile_program(const Program* p, const CompileOptions* opts, char* errbuf, size_t errbuf_n);
@@ -0,0 +1,982 @@
+#define _POSIX_C_SOURCE 200809L
+#include "emit_c.h"
+#include "interp.h"
+#include "resolve.h"
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function bodies are written to a memory stream first, so the tables they
+// reference (names N[], string literals S[], frame layouts) can be declared
+// ahead of them once all are known.
+typedef struct Emitter {
+  FILE* out;
+  unsigned indent;
+  unsigned next_id;       // temporaries and labels
+  const char** names;     // N[i]; interned
+  size_t name_count;
+  size_t name_cap;
+  const Value** strings;  // S[i]; interned string literals of the AST
+  size_t string_count;
+  size_t string_cap;
+  const Stmt** defines;   // compiled to fn<i>, in the order they were met
+  size_t define_count;
+  size_t define_cap;
+  bool oom;
+} Emitter;
+
+typedef struct Label {
+  unsigned id;
+  bool used;
+} Label;
+
+// what the statement being emitted is nested in
+typedef struct Body {
+  const Stmt* def;        // NULL at the top level
+  const bool* unboxed;    // per frame slot: lives in the C long l<slot>
+  Label* fail;            // innermost try's handler; NULL: return false
+  Label* brk;             // innermost loop; NULL outside loops
+  Label* cont;
+} Body;
+
+static const char* const BIN_NAMES[] = {
+  "BIN_ADD", "BIN_SUB", "BIN_MUL", "BIN_DIV", "BIN_EQ", "BIN_NEQ",
+  "BIN_LT", "BIN_LTE", "BIN_GT", "BIN_GTE", "BIN_AND", "BIN_OR"
+};
+static const char* const C_COMPARE[] = {
+  [BIN_EQ] = "==", [BIN_NEQ] = "!=", [BIN_LT] = "<", [BIN_LTE] = "<=", [BIN_GT] = ">", [BIN_GTE] = ">="
+};
+static const char* const C_ARITH[] = {[BIN_ADD] = "i_add", [BIN_SUB] = "i_sub", [BIN_MUL] = "i_mul"};
+
+static void put(Emitter* em, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(em->out, fmt, ap);
+  va_end(ap);
+}
+
+static void start(Emitter* em) {
+  for (unsigned i = 0; i < em->indent; i++) fputs("  ", em->out);
+}
+
+static void line(Emitter* em, const char* fmt, ...) {
+  start(em);
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(em->out, fmt, ap);
+  va_end(ap);
+  fputc('\n', em->out);
+}
+
+// a line ending in `{`; close() ends the block
+static void open(Emitter* em, const char* fmt, ...) {
+  start(em);
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(em->out, fmt, ap);
+  va_end(ap);
+  fputs(*fmt ? " {\n" : "{\n", em->out);
+  em->indent++;
+}
+
+static void close(Emitter* em) {
+  em->indent--;
+  line(em, "}");
+}
+
+static bool reserve(Emitter* em, void** items, size_t* cap, size_t count, size_t size) {
+  if (count < *cap) return true;
+  size_t nc = *cap ? *cap * 2 : 32;
+  void* grown = realloc(*items, nc * size);
+  if (!grown) {
+    em->oom = true;
+    return false;
+  }
+  *items = grown;
+  *cap = nc;
+  return true;
+}
+
+static size_t name_index(Emitter* em, const char* name) {
+  for (size_t i = 0; i < em->name_count; i++) {
+    if (em->names[i] == name) return i;
+  }
+  if (!reserve(em, (void**)&em->names, &em->name_cap, em->name_count, sizeof(*em->names))) return 0;
+  em->names[em->name_count] = name;
+  return em->name_count++;
+}
+
+static size_t string_index(Emitter* em, const Value* lit) {
+  for (size_t i = 0; i < em->string_count; i++) {
+    if (em->strings[i]->str == lit->str) return i;
+  }
+  if (!reserve(em, (void**)&em->strings, &em->string_cap, em->string_count, sizeof(*em->strings))) return 0;
+  em->strings[em->string_count] = lit;
+  return em->string_count++;
+}
+
+static size_t define_index(Emitter* em, const Stmt* s) {
+  for (size_t i = 0; i < em->define_count; i++) {
+    if (em->defines[i] == s) return i;
+  }
+  if (!reserve(em, (void**)&em->defines, &em->define_cap, em->define_count, sizeof(*em->defines))) return 0;
+  em->defines[em->define_count] = s;
+  return em->define_count++;
+}
+
+// bytes as a C string literal; octal escapes stop after three digits, so a
+// digit that follows one stays a digit
+static void put_c_string(Emitter* em, const char* s, size_t n) {
+  fputc('"', em->out);
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ' ') fputc(c, em->out);
+    else fprintf(em->out, "\\%03o", c);
+  }
+  fputc('"', em->out);
+}
+
+static void put_long(Emitter* em, long v) {
+  if (v == LONG_MIN) put(em, "(-%ldL - 1)", LONG_MAX);
+  else if (v < 0) put(em, "(%ldL)", v);
+  else put(em, "%ldL", v);
+}
+
+// ---- which function locals can live in C longs ----
+
+static bool is_unboxed_ref(const VarRef* r, const bool* unboxed) {
+  return unboxed && r->slot >= 0 && r->depth == 0 && unboxed[r->slot];
+}
+
+static const Expr* ungroup(const Expr* e) {
+  while (e->type == EXPR_GROUP) e = e->left;
+  return e;
+}
+
+// e always yields an int, given the unboxed locals are ints. With
+// with_div, division (which can also fail) counts too.
+static bool int_typed(const Expr* e, const bool* unboxed, bool with_div) {
+  e = ungroup(e);
+  switch (e->type) {
+    case EXPR_LITERAL:
+      return e->lit.type == VAL_INT;
+    case EXPR_IDENT:
+      return is_unboxed_ref(&e->ref, unboxed);
+    case EXPR_UNARY:
+      return e->unop == UN_NEGATE && int_typed(e->left, unboxed, with_div);
+    case EXPR_BINARY:
+      if (e->op != BIN_ADD && e->op != BIN_SUB && e->op != BIN_MUL && !(with_div && e->op == BIN_DIV)) return false;
+      return int_typed(e->left, unboxed, with_div) && int_typed(e->right, unboxed, with_div);
+    default:
+      return false;
+  }
+}
+
+static bool is_int_compare(const Expr* e, const bool* unboxed) {
+  e = ungroup(e);
+  return e->type == EXPR_BINARY && e->op >= BIN_EQ && e->op <= BIN_GTE &&
+         int_typed(e->left, unboxed, false) && int_typed(e->right, unboxed, false);
+}
+
+typedef struct Unbox {
+  const Stmt* def;
+  bool* ok;
+  bool changed;
+} Unbox;
+
+static void drop(Unbox* u, int slot) {
+  if (slot >= 0 && u->ok[slot]) {
+    u->ok[slot] = false;
+    u->changed = true;
+  }
+}
+
+static void drop_name(Unbox* u, const char* name) {
+  for (size_t i = 0; i < u->def->frame.count; i++) {
+    if (u->def->frame.names[i] == name) drop(u, (int)i);
+  }
+}
+
+static bool has_define(const Block* b) {
+  if (!b) return false;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    if (s->type == STMT_DEFINE || has_define(s->block) || has_define(s->else_block)) return true;
+  }
+  return false;
+}
+
+// writes that bypass the slot (by name, locks) or store a non-int
+static void unbox_writes(Unbox* u, const Block* b) {
+  if (!b) return;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    if (s->type == STMT_LOCK) drop_name(u, s->name.start);
+    if (s->type == STMT_SET) {
+      if (s->ref.slot < 0 || s->ref.shadowed) drop_name(u, s->name.start);
+      else if (u->ok[s->ref.slot] && !int_typed(s->expr, u->ok, true)) drop(u, s->ref.slot);
+    }
+    if (s->type == STMT_REPEAT && s->ref.slot < 0) drop_name(u, s->loop_var.start);
+    unbox_writes(u, s->block);
+    unbox_writes(u, s->else_block);
+  }
+}
+
+// reads before a definite assignment would see the frame's unset slot
+static void unbox_reads(Unbox* u, const Expr* e, const bool* assigned) {
+  if (!e) return;
+  if (e->type == EXPR_IDENT && is_unboxed_ref(&e->ref, u->ok) && !assigned[e->ref.slot]) drop(u, e->ref.slot);
+  unbox_reads(u, e->left, assigned);
+  unbox_reads(u, e->right, assigned);
+  unbox_reads(u, e->cond, assigned);
+  if (e->type == EXPR_CALL) {
+    unbox_reads(u, e->call.callee, assigned);
+    for (size_t i = 0; i < e->call.arg_count; i++) unbox_reads(u, e->call.args[i], assigned);
+  }
+}
+
+static void unbox_flow(Unbox* u, const Block* b, bool* assigned) {
+  if (!b) return;
+  size_t n = u->def->frame.count;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    unbox_reads(u, s->expr, assigned);
+    unbox_reads(u, s->expr_b, assigned);
+    bool* entry = (bool*)malloc(n);
+    bool* other = (bool*)malloc(n);
+    if (!entry || !other) {
+      free(entry);
+      free(other);
+      memset(u->ok, 0, n);
+      return;
+    }
+    memcpy(entry, assigned, n);
+    switch (s->type) {
+      case STMT_SET:
+        if (s->ref.slot >= 0 && !s->ref.shadowed) assigned[s->ref.slot] = true;
+        break;
+      case STMT_IF:
+        unbox_flow(u, s->block, assigned);
+        memcpy(other, entry, n);
+        unbox_flow(u, s->else_block, other);
+        for (size_t k = 0; k < n; k++) assigned[k] = assigned[k] && other[k];
+        break;
+      case STMT_REPEAT:
+        if (s->ref.slot >= 0) assigned[s->ref.slot] = true;
+        unbox_flow(u, s->block, assigned);
+        memcpy(assigned, entry, n);
+        break;
+      case STMT_LOOP_FOREVER:
+      case STMT_TRY:
+        // a loop may run its body any number of times; a try may stop
+        // anywhere in its block
+        unbox_flow(u, s->block, assigned);
+        memcpy(assigned, entry, n);
+        unbox_flow(u, s->else_block, assigned);
+        memcpy(assigned, entry, n);
+        break;
+      default:
+        break;
+    }
+    free(entry);
+    free(other);
+  }
+}
+
+// Locals of a function that only ever hold ints: never a parameter, never
+// written by name or locked, only set to int expressions, and assigned on
+// every path before they are read. Functions with nested `define`s keep
+// all locals in the frame, where closures can see them.
+static bool* find_unboxed(const Stmt* def) {
+  size_t n = def->frame.count;
+  bool* ok = (bool*)calloc(n ? n : 1, sizeof(bool));
+  if (!ok || !n || has_define(def->block)) return ok;
+  for (size_t i = 0; i < n; i++) ok[i] = true;
+  for (size_t i = 0; i < def->param_count; i++) ok[def->param_slots[i]] = false;
+  Unbox u = {def, ok, false};
+  bool* assigned = (bool*)malloc(n);
+  if (!assigned) {
+    memset(ok, 0, n);
+    return ok;
+  }
+  do {
+    u.changed = false;
+    unbox_writes(&u, def->block);
+    memset(assigned, 0, n);
+    for (size_t i = 0; i < def->param_count; i++) assigned[def->param_slots[i]] = true;
+    unbox_flow(&u, def->block, assigned);
+  } while (u.changed);
+  free(assigned);
+  return ok;
+}
+
+// ---- expressions ----
+
+static void gen_int(Emitter* em, const Expr* e) {
+  e = ungroup(e);
+  switch (e->type) {
+    case EXPR_LITERAL:
+      put_long(em, e->lit.i);
+      return;
+    case EXPR_IDENT:
+      put(em, "l%d", e->ref.slot);
+      return;
+    case EXPR_UNARY:
+      put(em, "i_neg(");
+      gen_int(em, e->left);
+      put(em, ")");
+      return;
+    default:
+      put(em, "%s(", C_ARITH[e->op]);
+      gen_int(em, e->left);
+      put(em, ", ");
+      gen_int(em, e->right);
+      put(em, ")");
+      return;
+  }
+}
+
+static void gen_compare(Emitter* em, const Expr* e) {
+  e = ungroup(e);
+  gen_int(em, e->left);
+  put(em, " %s ", C_COMPARE[e->op]);
+  gen_int(em, e->right);
+}
+
+static void gen_value(Emitter* em, const Body* b, const Expr* e, const char* dst);
+
+// Evaluate the callee and then each argument, as eval_call_parts does. On
+// success `body` is emitted with them in c<id> and a<id>[]; otherwise `dst`
+// (or st->ret for a tail call) gets the first error.
+static unsigned gen_call_parts(Emitter* em, const Body* b, const CallExpr* call, const char* dst, const char* argv) {
+  unsigned id = em->next_id++;
+  char name[32];
+  snprintf(name, sizeof(name), "c%u", id);
+  line(em, "Value c%u;", id);
+  gen_value(em, b, call->callee, name);
+  open(em, "if (c%u.type == VAL_ERROR)", id);
+  line(em, "%s = c%u;", dst, id);
+  em->indent--;
+  open(em, "} else");
+  for (size_t i = 0; i < call->arg_count; i++) {
+    snprintf(name, sizeof(name), "%s[%zu]", argv, i);
+    gen_value(em, b, call->args[i], name);
+    open(em, "if (%s.type == VAL_ERROR)", name);
+    line(em, "%s = %s;", dst, name);
+    for (size_t k = 0; k < i; k++) line(em, "value_free(&%s[%zu]);", argv, k);
+    line(em, "value_free(&c%u);", id);
+    em->indent--;
+    open(em, "} else");
+  }
+  return id;
+}
+
+static void end_call_parts(Emitter* em, const CallExpr* call) {
+  for (size_t i = 0; i <= call->arg_count; i++) close(em);
+}
+
+static void gen_value(Emitter* em, const Body* b, const Expr* e, const char* dst) {
+  if (int_typed(e, b->unboxed, false)) {
+    start(em);
+    put(em, "%s = value_int(", dst);
+    gen_int(em, e);
+    put(em, ");\n");
+    return;
+  }
+  if (is_int_compare(e, b->unboxed)) {
+    start(em);
+    put(em, "%s = value_bool(", dst);
+    gen_compare(em, e);
+    put(em, ");\n");
+    return;
+  }
+  unsigned id;
+  switch (e->type) {
+    case EXPR_LITERAL:
+      if (e->lit.type == VAL_STRING) line(em, "%s = value_copy(&S[%zu]);", dst, string_index(em, &e->lit));
+      else if (e->lit.type == VAL_BOOL) line(em, "%s = value_bool(%s);", dst, e->lit.b ? "true" : "false");
+      else line(em, "%s = value_null();", dst);
+      return;
+    case EXPR_IDENT: {
+      size_t name = name_index(em, e->tok.start);
+      if (e->ref.slot < 0) {
+        line(em, "%s = env_get(env, N[%zu]);", dst, name);
+        return;
+      }
+      id = em->next_id++;
+      open(em, "");
+      line(em, "Binding* b%u = env_slot(env, %u, %d);", id, e->ref.depth, e->ref.slot);
+      line(em, "%s = b%u->is_set ? value_copy(&b%u->value) : env_get(env, N[%zu]);", dst, id, id, name);
+      close(em);
+      return;
+    }
+    case EXPR_GROUP:
+      gen_value(em, b, e->left, dst);
+      return;
+    case EXPR_UNARY: {
+      id = em->next_id++;
+      char inner[16];
+      snprintf(inner, sizeof(inner), "t%u", id);
+      open(em, "");
+      line(em, "Value t%u;", id);
+      gen_value(em, b, e->left, inner);
+      line(em, "%s = t%u.type == VAL_ERROR ? t%u : eval_unary_op(%s, &t%u);", dst, id, id, e->unop == UN_NEGATE ? "UN_NEGATE" : "UN_NOT", id);
+      line(em, "if (t%u.type != VAL_ERROR) value_free(&t%u);", id, id);
+      close(em);
+      return;
+    }
+    case EXPR_BINARY: {
+      id = em->next_id++;
+      char l[16], r[16];
+      snprintf(l, sizeof(l), "l%u_", id);
+      snprintf(r, sizeof(r), "r%u_", id);
+      open(em, "");
+      line(em, "Value %s, %s;", l, r);
+      gen_value(em, b, e->left, l);
+      open(em, "if (%s.type == VAL_ERROR)", l);
+      line(em, "%s = %s;", dst, l);
+      em->indent--;
+      open(em, "} else");
+      gen_value(em, b, e->right, r);
+      open(em, "if (%s.type == VAL_ERROR)", r);
+      line(em, "value_free(&%s);", l);
+      line(em, "%s = %s;", dst, r);
+      em->indent--;
+      open(em, "} else");
+      line(em, "%s = eval_binary_op(%s, &%s, &%s);", dst, BIN_NAMES[e->op], l, r);
+      line(em, "value_free(&%s);", l);
+      line(em, "value_free(&%s);", r);
+      close(em);
+      close(em);
+      close(em);
+      return;
+    }
+    case EXPR_CONDITIONAL: {
+      id = em->next_id++;
+      char cond[16];
+      snprintf(cond, sizeof(cond), "t%u", id);
+      open(em, "");
+      line(em, "Value t%u;", id);
+      gen_value(em, b, e->cond, cond);
+      open(em, "if (t%u.type == VAL_ERROR)", id);
+      line(em, "%s = t%u;", dst, id);
+      em->indent--;
+      open(em, "} else");
+      line(em, "bool truth = value_is_truthy(&t%u);", id);
+      line(em, "value_free(&t%u);", id);
+      open(em, "if (truth)");
+      gen_value(em, b, e->left, dst);
+      em->indent--;
+      open(em, "} else");
+      gen_value(em, b, e->right, dst);
+      close(em);
+      close(em);
+      close(em);
+      return;
+    }
+    case EXPR_LOGICAL: {
+      id = em->next_id++;
+      char side[16];
+      snprintf(side, sizeof(side), "t%u", id);
+      open(em, "");
+      line(em, "Value t%u;", id);
+      gen_value(em, b, e->left, side);
+      open(em, "if (t%u.type == VAL_ERROR)", id);
+      line(em, "%s = t%u;", dst, id);
+      em->indent--;
+      open(em, "} else");
+      line(em, "bool truth = value_is_truthy(&t%u);", id);
+      line(em, "value_free(&t%u);", id);
+      open(em, "if (truth == %s)", e->op == BIN_OR ? "true" : "false");
+      line(em, "%s = value_bool(truth);", dst);
+      em->indent--;
+      open(em, "} else");
+      gen_value(em, b, e->right, side);
+      open(em, "if (t%u.type == VAL_ERROR)", id);
+      line(em, "%s = t%u;", dst, id);
+      em->indent--;
+      open(em, "} else");
+      line(em, "%s = value_bool(value_is_truthy(&t%u));", dst, id);
+      line(em, "value_free(&t%u);", id);
+      close(em);
+      close(em);
+      close(em);
+      close(em);
+      return;
+    }
+    case EXPR_CALL: {
+      const CallExpr* call = &e->call;
+      open(em, "");
+      char argv[16];
+      snprintf(argv, sizeof(argv), "a%u", em->next_id);
+      if (call->arg_count) line(em, "Value %s[%zu];", argv, call->arg_count);
+      id = gen_call_parts(em, b, call, dst, argv);
+      line(em, "%s = call_value(&c%u, %s, %zu, env);", dst, id, call->arg_count ? argv : "NULL", call->arg_count);
+      for (size_t i = 0; i < call->arg_count; i++) line(em, "value_free(&%s[%zu]);", argv, i);
+      end_call_parts(em, call);
+      close(em);
+      return;
+    }
+  }
+}
+
+// ---- statements ----
+
+static void gen_fail(Emitter* em, const Body* b) {
+  if (b->fail) {
+    b->fail->used = true;
+    line(em, "goto catch%u;", b->fail->id);
+  } else {
+    line(em, "return false;");
+  }
+}
+
+// a statement whose value `v` is an error fails with its message
+static void gen_check(Emitter* em, const Body* b, const char* v) {
+  open(em, "if (%s.type == VAL_ERROR)", v);
+  line(em, "set_error(&%s, errbuf, errbuf_n);", v);
+  gen_fail(em, b);
+  close(em);
+}
+
+// evaluate a condition into the C bool `truth`, failing on an error
+static void gen_truth(Emitter* em, const Body* b, const Expr* e, const char* truth) {
+  if (is_int_compare(e, b->unboxed)) {
+    start(em);
+    put(em, "bool %s = ", truth);
+    gen_compare(em, e);
+    put(em, ";\n");
+    return;
+  }
+  unsigned id = em->next_id++;
+  char v[16];
+  snprintf(v, sizeof(v), "t%u", id);
+  line(em, "Value %s;", v);
+  gen_value(em, b, e, v);
+  gen_check(em, b, v);
+  line(em, "bool %s = value_is_truthy(&%s);", truth, v);
+  line(em, "value_free(&%s);", v);
+}
+
+static void gen_block(Emitter* em, const Body* b, const Block* block);
+
+static void gen_loop_body(Emitter* em, const Body* b, const Block* block, Label* brk, Label* cont) {
+  Body inner = *b;
+  inner.brk = brk;
+  inner.cont = cont;
+  gen_block(em, &inner, block);
+  if (cont->used) line(em, "cont%u:;", cont->id);
+}
+
+static void gen_set(Emitter* em, const Body* b, const Stmt* s) {
+  if (s->type == STMT_SET && is_unboxed_ref(&s->ref, b->unboxed)) {
+    if (int_typed(s->expr, b->unboxed, false)) {
+      start(em);
+      put(em, "l%d = ", s->ref.slot);
+      gen_int(em, s->expr);
+      put(em, ";\n");
+      return;
+    }
+    // a division, which may fail
+    open(em, "");
+    line(em, "Value v;");
+    gen_value(em, b, s->expr, "v");
+    gen_check(em, b, "v");
+    line(em, "l%d = v.i;", s->ref.slot);
+    close(em);
+    return;
+  }
+  open(em, "");
+  line(em, "Value v;");
+  const Expr* pieces[APPEND_MAX_PIECES];
+  size_t n = resolve_append_pieces(s, pieces);
+  if (n) {
+    // eval_append: evaluate every operand, then grow x in place if unshared
+    const Expr* x = s->expr;
+    for (size_t i = 0; i < n; i++) x = x->left;
+    line(em, "bool done = false;");
+    gen_value(em, b, x, "v");
+    open(em, "if (v.type != VAL_ERROR)");
+    line(em, "Value vals[%zu];", n);
+    char name[24];
+    for (size_t i = 0; i < n; i++) {
+      snprintf(name, sizeof(name), "vals[%zu]", i);
+      gen_value(em, b, pieces[i], name);
+      open(em, "if (%s.type == VAL_ERROR)", name);
+      for (size_t k = 0; k < i; k++) line(em, "value_free(&vals[%zu]);", k);
+      line(em, "value_free(&v);");
+      line(em, "v = %s;", name);
+      em->indent--;
+      open(em, "} else");
+    }
+    open(em, "if (env_slot_append(env_slot(env, 0, %d), &v, vals, %zu))", s->ref.slot, n);
+    line(em, "for (size_t i = 0; i < %zu; i++) value_free(&vals[i]);", n);
+    line(em, "done = true;");
+    em->indent--;
+    open(em, "} else");
+    open(em, "for (size_t i = 0; i < %zu; i++)", n);
+    line(em, "Value next = eval_binary_op(BIN_ADD, &v, &vals[i]);");
+    line(em, "value_free(&v);");
+    line(em, "value_free(&vals[i]);");
+    line(em, "v = next;");
+    close(em);
+    close(em);
+    for (size_t i = 0; i < n; i++) close(em);
+    close(em);
+    open(em, "if (!done)");
+  } else {
+    gen_value(em, b, s->expr, "v");
+  }
+  gen_check(em, b, "v");
+  const char* lock = s->type == STMT_LOCK ? "true" : "false";
+  if (s->ref.slot >= 0 && !s->ref.shadowed) {
+    line(em, "bool ok = env_slot_assign(env_slot(env, 0, %d), &v, %s, errbuf, errbuf_n);", s->ref.slot, lock);
+  } else {
+    line(em, "bool ok = env_set(env, N[%zu], &v, %s, errbuf, errbuf_n);", name_index(em, s->name.start), lock);
+  }
+  line(em, "value_free(&v);");
+  open(em, "if (!ok)");
+  gen_fail(em, b);
+  close(em);
+  if (n) close(em);
+  close(em);
+}
+
+static void gen_repeat(Emitter* em, const Body* b, const Stmt* s) {
+  unsigned id = em->next_id++;
+  open(em, "");
+  line(em, "Value start, end;");
+  gen_value(em, b, s->expr, "start");
+  open(em, "if (start.type != VAL_INT)");
+  line(em, "snprintf(errbuf, errbuf_n, \"repeat start must be int\");");
+  line(em, "value_free(&start);");
+  gen_fail(em, b);
+  close(em);
+  gen_value(em, b, s->expr_b, "end");
+  open(em, "if (end.type != VAL_INT)");
+  line(em, "snprintf(errbuf, errbuf_n, \"repeat end must be int\");");
+  line(em, "value_free(&end);");
+  gen_fail(em, b);
+  close(em);
+  Label brk = {id, false}, cont = {id, false};
+  open(em, "if (start.i <= end.i)");
+  open(em, "for (long i = start.i;; i++)");
+  if (is_unboxed_ref(&s->ref, b->unboxed)) {
+    line(em, "l%d = i;", s->ref.slot);
+  } else {
+    if (s->ref.slot >= 0) {
+      line(em, "bool bound = env_slot_set_int(&env->items[%d], i, errbuf, errbuf_n);", s->ref.slot);
+    } else {
+      line(em, "Value iv = value_int(i);");
+      line(em, "bool bound = env_define_local(env, N[%zu], &iv, false, errbuf, errbuf_n);", name_index(em, s->loop_var.start));
+    }
+    open(em, "if (!bound)");
+    gen_fail(em, b);
+    close(em);
+  }
+  gen_loop_body(em, b, s->block, &brk, &cont);
+  // compared before the increment, so an end of LONG_MAX terminates
+  line(em, "if (i == end.i) break;");
+  close(em);
+  close(em);
+  if (brk.used) line(em, "brk%u:;", id);
+  close(em);
+}
+
+static void gen_define(Emitter* em, const Body* b, const Stmt* s) {
+  size_t fn = define_index(em, s);
+  size_t name = name_index(em, s->name.start);
+  open(em, "");
+  line(em, "Function* fn = (Function*)calloc(1, sizeof(Function));");
+  line(em, "fn->name.start = N[%zu];", name);
+  line(em, "fn->name.length = %zu;", s->name.length);
+  line(em, "fn->param_count = %zu;", s->param_count);
+  line(em, "fn->native = fn%zu;", fn);
+  line(em, "fn->closure = env;");
+  line(em, "fn->layout = &F%zu;", fn);
+  if (s->param_count) line(em, "fn->param_slots = F%zu_params;", fn);
+  open(em, "if (!env_bind_function(env, %d, N[%zu], fn, errbuf, errbuf_n))", s->ref.slot, name);
+  gen_fail(em, b);
+  close(em);
+  close(em);
+}
+
+static void gen_try(Emitter* em, const Body* b, const Stmt* s) {
+  unsigned id = em->next_id++;
+  Label fail = {id, false};
+  Body inner = *b;
+  inner.fail = &fail;
+  line(em, "errbuf[0] = '\\0';");
+  open(em, "");
+  gen_block(em, &inner, s->block);
+  close(em);
+  if (!fail.used) return;
+  line(em, "goto done%u;", id);
+  open(em, "catch%u:", id);
+  if (s->else_block) {
+    gen_block(em, b, s->else_block);
+  } else {
+    line(em, "if (!errbuf[0]) snprintf(errbuf, errbuf_n, \"error\");");
+    gen_fail(em, b);
+  }
+  close(em);
+  line(em, "done%u:;", id);
+}
+
+static void gen_return(Emitter* em, const Body* b, const Stmt* s) {
+  line(em, "st->returned = true;");
+  if (!s->expr) {
+    line(em, "st->ret = value_null();");
+    line(em, "return true;");
+    return;
+  }
+  if (!b->def || s->expr->type != EXPR_CALL) {
+    gen_value(em, b, s->expr, "st->ret");
+    line(em, "return true;");
+    return;
+  }
+  // a tail call: call_function runs it in this frame once we have returned
+  const CallExpr* call = &s->expr->call;
+  size_t n = call->arg_count;
+  open(em, "");
+  if (n > CALL_INLINE_ARGS) {
+    line(em, "Value* argv = call_args_alloc(%zu);", n);
+    open(em, "if (!argv)");
+    line(em, "st->ret = value_error(\"out of memory\", 13);");
+    line(em, "return true;");
+    close(em);
+  }
+  else line(em, "Value* argv = st->tail_buf;");
+  unsigned id = gen_call_parts(em, b, call, "st->ret", "argv");
+  open(em, "if (tail_call_reusable(&c%u, argv, %zu, env))", id, n);
+  line(em, "st->tail = c%u.func;", id);
+  line(em, "st->tail_args = argv;");
+  line(em, "st->tail_argc = %zu;", n);
+  line(em, "st->ret = value_null();");
+  line(em, "return true;");
+  close(em);
+  line(em, "st->ret = call_value(&c%u, argv, %zu, env);", id, n);
+  if (n) line(em, "for (size_t i = 0; i < %zu; i++) value_free(&argv[i]);", n);
+  end_call_parts(em, call);
+  if (n > CALL_INLINE_ARGS) line(em, "call_args_release(argv, %zu);", n);
+  close(em);
+  line(em, "return true;");
+}
+
+static void gen_stmt(Emitter* em, const Body* b, const Stmt* s) {
+  switch (s->type) {
+    case STMT_SHOW:
+    case STMT_WARN:
+    case STMT_EXPR:
+      open(em, "");
+      line(em, "Value v;");
+      gen_value(em, b, s->expr, "v");
+      gen_check(em, b, "v");
+      if (s->type == STMT_SHOW) line(em, "rt_show(&v);");
+      if (s->type == STMT_WARN) line(em, "rt_warn(&v);");
+      line(em, "value_free(&v);");
+      close(em);
+      return;
+    case STMT_SET:
+    case STMT_LOCK:
+      gen_set(em, b, s);
+      return;
+    case STMT_IF: {
+      open(em, "");
+      gen_truth(em, b, s->expr, "truth");
+      open(em, "if (truth)");
+      gen_block(em, b, s->block);
+      if (s->else_block) {
+        em->indent--;
+        open(em, "} else");
+        gen_block(em, b, s->else_block);
+      }
+      close(em);
+      close(em);
+      return;
+    }
+    case STMT_LOOP_FOREVER: {
+      unsigned id = em->next_id++;
+      Label brk = {id, false}, cont = {id, false};
+      open(em, "for (;;)");
+      gen_loop_body(em, b, s->block, &brk, &cont);
+      close(em);
+      if (brk.used) line(em, "brk%u:;", id);
+      return;
+    }
+    case STMT_REPEAT:
+      gen_repeat(em, b, s);
+      return;
+    case STMT_DEFINE:
+      gen_define(em, b, s);
+      return;
+    case STMT_TRY:
+      gen_try(em, b, s);
+      return;
+    case STMT_RETURN:
+      gen_return(em, b, s);
+      return;
+    case STMT_BREAK:
+    case STMT_CONTINUE: {
+      Label* target = s->type == STMT_BREAK ? b->brk : b->cont;
+      if (target) {
+        target->used = true;
+        line(em, "goto %s%u;", s->type == STMT_BREAK ? "brk" : "cont", target->id);
+      } else {
+        // outside a loop it ends the function (or the program)
+        line(em, "st->%s = true;", s->type == STMT_BREAK ? "broke" : "cont");
+        line(em, "return true;");
+      }
+      return;
+    }
+    default:
+      line(em, "snprintf(errbuf, errbuf_n, \"unsupported statement (seed0)\");");
+      gen_fail(em, b);
+      return;
+  }
+}
+
+static void gen_block(Emitter* em, const Body* b, const Block* block) {
+  if (!block) return;
+  for (size_t i = 0; i < block->count; i++) gen_stmt(em, b, &block->stmts[i]);
+}
+
+static void gen_function(Emitter* em, const char* name, const Stmt* def, const Block* block, const bool* unboxed) {
+  if (def) line(em, "// %.*s, line %zu", (int)def->name.length, def->name.start, def->line);
+  open(em, "static bool %s(Env* env, ExecState* st, char* errbuf, size_t errbuf_n)", name);
+  line(em, "(void)env, (void)st, (void)errbuf, (void)errbuf_n;");
+  for (size_t i = 0; unboxed && i < def->frame.count; i++) {
+    if (!unboxed[i]) continue;
+    line(em, "long l%zu = 0;  // %s", i, def->frame.names[i]);
+    line(em, "(void)l%zu;", i);
+  }
+  Body b = {def, unboxed, NULL, NULL, NULL};
+  gen_block(em, &b, block);
+  line(em, "return true;");
+  close(em);
+  line(em, "");
+}
+
+// ---- the translation unit ----
+
+static void put_layout(Emitter* em, const char* name, const FrameLayout* l) {
+  if (l->count) {
+    put(em, "static const char* %s_names[%zu];\n", name, l->count);
+    put(em, "static const FrameLayout %s = {%s_names, NULL, %zu};\n", name, name, l->count);
+  } else {
+    put(em, "static const FrameLayout %s = {NULL, NULL, 0};\n", name);
+  }
+}
+
+static void put_layout_init(Emitter* em, const char* name, const FrameLayout* l) {
+  for (size_t i = 0; i < l->count; i++) put(em, "  %s_names[%zu] = N[%zu];\n", name, i, name_index(em, l->names[i]));
+}
+
+static const char PRELUDE[] =
+  "#include \"interp.h\"\n"
+  "#include \"intern.h\"\n"
+  "#include \"runtime.h\"\n"
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "\n"
+  "// ints wrap on overflow like the interpreter's\n"
+  "static inline long i_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }\n"
+  "static inline long i_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }\n"
+  "static inline long i_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }\n"
+  "static inline long i_neg(long a) { return (long)(0UL - (unsigned long)a); }\n"
+  "\n"
+  "// a failing statement's message, as exec_stmt reports it\n"
+  "static inline void set_error(Value* v, char* errbuf, size_t errbuf_n) {\n"
+  "  snprintf(errbuf, errbuf_n, \"%s\", v->str ? v->str->data : \"error\");\n"
+  "  value_free(v);\n"
+  "}\n";
+
+bool emit_c_program(const Program* p, const char* source_name, FILE* out, char* errbuf, size_t errbuf_n) {
+  Emitter em;
+  memset(&em, 0, sizeof(em));
+  char* bodies = NULL;
+  size_t bodies_len = 0;
+  em.out = open_memstream(&bodies, &bodies_len);
+  if (!em.out) {
+    snprintf(errbuf, errbuf_n, "out of memory");
+    return false;
+  }
+  gen_function(&em, "top", NULL, &p->block, NULL);
+  for (size_t i = 0; i < em.define_count; i++) {
+    const Stmt* def = em.defines[i];
+    bool* unboxed = find_unboxed(def);
+    if (!unboxed) em.oom = true;
+    char name[32];
+    snprintf(name, sizeof(name), "fn%zu", i);
+    gen_function(&em, name, def, def->block, unboxed);
+    free(unboxed);
+  }
+  // every name main() fills a layout with gets an N[] entry first
+  for (size_t i = 0; i < p->globals.count; i++) name_index(&em, p->globals.names[i]);
+  for (size_t i = 0; i < em.define_count; i++) {
+    for (size_t k = 0; k < em.defines[i]->frame.count; k++) name_index(&em, em.defines[i]->frame.names[k]);
+  }
+  bool ok = fclose(em.out) == 0 && !em.oom;
+
+  em.out = out;
+  if (ok) {
+    put(&em, "// Generated by `astralis --emit-c` from %s; do not edit.\n", source_name);
+    put(&em, "// cc -O2 -I src/seed0 <this file> src/seed0/libseed0.a -pthread\n");
+    put(&em, "%s\n", PRELUDE);
+    put(&em, "static const char* N[%zu];\n", em.name_count ? em.name_count : 1);
+    put(&em, "static Value S[%zu];\n", em.string_count ? em.string_count : 1);
+    put_layout(&em, "G", &p->globals);
+    for (size_t i = 0; i < em.define_count; i++) {
+      const Stmt* def = em.defines[i];
+      char name[32];
+      snprintf(name, sizeof(name), "F%zu", i);
+      put_layout(&em, name, &def->frame);
+      if (def->param_count) {
+        put(&em, "static const int F%zu_params[] = {", i);
+        for (size_t k = 0; k < def->param_count; k++) put(&em, "%s%d", k ? ", " : "", def->param_slots[k]);
+        put(&em, "};\n");
+      }
+      put(&em, "static bool fn%zu(Env* env, ExecState* st, char* errbuf, size_t errbuf_n);\n", i);
+    }
+    put(&em, "\n");
+    fwrite(bodies, 1, bodies_len, out);
+
+    put(&em, "int main(void) {\n");
+    for (size_t i = 0; i < em.name_count; i++) {
+      put(&em, "  N[%zu] = intern(", i);
+      put_c_string(&em, em.names[i], strlen(em.names[i]));
+      put(&em, ", %zu);\n", strlen(em.names[i]));
+    }
+    for (size_t i = 0; i < em.string_count; i++) {
+      put(&em, "  S[%zu] = intern_value(intern(", i);
+      put_c_string(&em, value_str(em.strings[i]), value_strlen(em.strings[i]));
+      put(&em, ", %zu));\n", value_strlen(em.strings[i]));
+    }
+    put_layout_init(&em, "G", &p->globals);
+    for (size_t i = 0; i < em.define_count; i++) {
+      char name[32];
+      snprintf(name, sizeof(name), "F%zu", i);
+      put_layout_init(&em, name, &em.defines[i]->frame);
+    }
+    put(&em,
+        "  rt_output_init(RT_OUTPUT_DEFAULT);\n"
+        "  Env env;\n"
+        "  env_init(&env);\n"
+        "  char err[256] = {0};\n"
+        "  bool ok = run_native(top, &G, &env, err, sizeof(err));\n"
+        "  if (!ok) fprintf(stderr, \"runtime error: %%s\\n\", err[0] ? err : \"unknown\");\n"
+        "  env_free(&env);\n"
+        "  intern_release();\n"
+        "  return ok ? 0 : 1;\n"
+        "}\n");
+  } else {
+    snprintf(errbuf, errbuf_n, "out of memory");
+  }
+  free(bodies);
+  free(em.names);
+  free(em.strings);
+  free(em.defines);
+  return ok;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "parser.h"
+#include <stdio.h>
+
+// Ahead-of-time backend (--emit-c): translate a resolved, usually optimized,
+// program into one C translation unit with its own main(). The top level and
+// each `define` body become a C function that does what exec_stmt would do
+// for every statement, calling into the seed0 runtime (libseed0.a) for
+// values, frames, calls and output, so results and error messages match the
+// tree-walker byte for byte. Repeat counters and function locals that only
+// ever hold ints are kept in C `long`s instead of frame slots.
+//
+//   astralis --emit-c prog.c prog.astr
+//   cc -O2 -I src/seed0 prog.c src/seed0/libseed0.a -pthread -o prog
+bool emit_c_program(const Program* p, const char* source_name, FILE* out, char* errbuf, size_t errbuf_n);
@@ -0,0 +1,99 @@
+#include "intern.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// An interned text carries the Str that literals of it share (refs == 0).
+typedef struct Interned {
+  Str str;
+  size_t hash;
+  char text[];
+} Interned;
+
+typedef struct InternTable {
+  Interned** slots;   // open addressing; NULL is empty
+  size_t cap;
+  size_t count;
+  Arena arena;        // the Interned entries themselves
+} InternTable;
+
+static InternTable names;
+
+static size_t hash_bytes(const char* s, size_t n) {
+  size_t h = 1469598103934665603ULL;
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static Interned* entry_of(const char* name) {
+  return (Interned*)(name - offsetof(Interned, text));
+}
+
+static bool table_grow(InternTable* t) {
+  size_t nc = t->cap ? t->cap * 2 : 256;
+  Interned** slots = (Interned**)calloc(nc, sizeof(Interned*));
+  if (!slots) return false;
+  for (size_t i = 0; i < t->cap; i++) {
+    Interned* e = t->slots[i];
+    if (!e) continue;
+    size_t j = e->hash & (nc - 1);
+    while (slots[j]) j = (j + 1) & (nc - 1);
+    slots[j] = e;
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->cap = nc;
+  return true;
+}
+
+// the slot holding that text, or the empty slot where it belongs
+static Interned** find_slot(InternTable* t, const char* s, size_t n, size_t h) {
+  size_t mask = t->cap - 1;
+  for (size_t i = h & mask;; i = (i + 1) & mask) {
+    Interned* e = t->slots[i];
+    if (!e || (e->hash == h && e->str.len == n && memcmp(e->text, s, n) == 0)) return &t->slots[i];
+  }
+}
+
+const char* intern(const char* s, size_t n) {
+  InternTable* t = &names;
+  size_t h = hash_bytes(s, n);
+  if (t->cap) {
+    Interned** found = find_slot(t, s, n, h);
+    if (*found) return (*found)->text;
+  }
+  if ((t->count + 1) * 2 > t->cap && !table_grow(t)) return NULL;
+  Interned** slot = find_slot(t, s, n, h);
+  Interned* e = (Interned*)arena_alloc(&t->arena, sizeof(Interned) + n + 1);
+  if (!e) return NULL;
+  memcpy(e->text, s, n);
+  e->text[n] = '\0';
+  e->hash = h;
+  e->str.refs = 0;
+  e->str.len = n;
+  e->str.cap = n;
+  e->str.data = e->text;
+  *slot = e;
+  t->count++;
+  return e->text;
+}
+
+size_t intern_hash(const char* name) {
+  return entry_of(name)->hash;
+}
+
+Value intern_value(const char* name) {
+  Value v;
+  v.type = VAL_STRING;
+  v.str = &entry_of(name)->str;
+  return v;
+}
+
+void intern_release(void) {
+  free(names.slots);
+  arena_free(&names.arena);
+  memset(&names, 0, sizeof(names));
+}
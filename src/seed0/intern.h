@@ -0,0 +1,18 @@
+#pragma once
+#include "value.h"
+#include <stddef.h>
+
+// Process-wide table of names and string literals. Each distinct text is
+// stored once, NUL-terminated, with its hash, so two interned pointers are
+// equal exactly when their texts are. Identifier tokens, frame layouts,
+// bytecode name tables and Env bindings all carry interned names, and the
+// engines compare names by pointer.
+
+// the canonical copy of the n bytes at s; NULL only when out of memory
+const char* intern(const char* s, size_t n);
+// hash cached with an interned name
+size_t intern_hash(const char* name);
+// VAL_STRING over an interned text; copies share it without counting
+Value intern_value(const char* name);
+// frees every interned text once nothing uses them any more
+void intern_release(void);
@@ -1,136 +1,460 @@
+#define _DEFAULT_SOURCE
 #include "interp.h"
+#include "intern.h"
+#include "jit.h"
+#include "list.h"
+#include "resolve.h"
+#include "profile.h"
 #include "runtime.h"
+#include "stats.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
-static char* dup_n(const char* s, size_t n) {
-  char* out = (char*)malloc(n + 1);
-  if (!out) return NULL;
-  memcpy(out, s, n);
-  out[n] = '\0';
-  return out;
+void env_init(Env* e) {
+  e->items = e->inline_items;
+  e->count = 0;
+  e->cap = ENV_INLINE_BINDINGS;
+  e->parent = NULL;
+  e->index = NULL;
+  e->index_cap = 0;
+  e->indexed = 0;
 }
 
-void env_init(Env* e) {
-  e->items = NULL; e->count = 0; e->cap = 0; e->parent = NULL;
+// Bumped whenever a binding is added by name or an Env is freed, the only
+// ways a name can come to mean a different binding than before. CallSite
+// caches (parser.h) are valid while it stays the same.
+static size_t names_version = 1;
+
+// room for n bindings; keeps the first `keep` of them
+static bool env_reserve(Env* e, size_t n, size_t keep) {
+  if (n <= e->cap) return true;
+  Binding* items;
+  if (e->items == e->inline_items) {
+    items = (Binding*)malloc(n * sizeof(Binding));
+    if (items && keep) memcpy(items, e->inline_items, keep * sizeof(Binding));
+  } else {
+    items = (Binding*)realloc(e->items, n * sizeof(Binding));
+  }
+  if (!items) return false;
+  e->items = items;
+  e->cap = n;
+  return true;
 }
 
-Env* env_push(Env* parent) {
-  Env* e = (Env*)calloc(1, sizeof(Env));
-  env_init(e);
+// Function frames of both engines come from one stack of Envs. A push takes
+// the Env the last pop at that depth left behind, bindings array included,
+// so steady-state calls allocate nothing. Envs are allocated in blocks that
+// never move, because closures and child frames point at them.
+typedef struct FrameStack {
+  Env** frames;      // frames[0, depth) are live
+  size_t depth;
+  size_t count;      // Envs allocated so far
+  size_t cap;
+  Env** blocks;      // allocations backing frames, for frames_release
+  size_t block_count;
+  size_t max_depth;
+  char error[64];
+} FrameStack;
+
+static FrameStack fstack = {.max_depth = MAX_DEPTH_DEFAULT};
+
+void set_max_depth(size_t depth) {
+  fstack.max_depth = depth;
+}
+
+size_t max_depth(void) {
+  return fstack.max_depth;
+}
+
+static bool frames_grow(FrameStack* fs) {
+  size_t n = fs->count ? fs->count : 16;
+  if (n > fs->max_depth - fs->count) n = fs->max_depth - fs->count;
+  Env* block = (Env*)calloc(n, sizeof(Env));
+  Env** frames = (Env**)realloc(fs->frames, (fs->count + n) * sizeof(Env*));
+  Env** blocks = (Env**)realloc(fs->blocks, (fs->block_count + 1) * sizeof(Env*));
+  if (frames) fs->frames = frames;
+  if (blocks) fs->blocks = blocks;
+  if (!block || !frames || !blocks) {
+    free(block);
+    return false;
+  }
+  fs->blocks[fs->block_count++] = block;
+  for (size_t i = 0; i < n; i++) {
+    env_init(&block[i]);
+    fs->frames[fs->count++] = &block[i];
+  }
+  return true;
+}
+
+Env* env_push_frame(Env* parent, const FrameLayout* layout) {
+  FrameStack* fs = &fstack;
+  if (fs->depth >= fs->max_depth) {
+    snprintf(fs->error, sizeof(fs->error), "call depth limit exceeded (--max-depth %zu)", fs->max_depth);
+    return NULL;
+  }
+  if (fs->depth == fs->count && !frames_grow(fs)) {
+    snprintf(fs->error, sizeof(fs->error), "out of memory");
+    return NULL;
+  }
+  Env* e = fs->frames[fs->depth++];
   e->parent = parent;
+  env_bind_layout(e, layout);
+  STAT_INC(frames);
+  STAT_INC(live_frames);
+  STAT_MAX(peak_frames, astr_stats.live_frames);
   return e;
 }
 
-void env_pop(Env* env) {
-  env_free(env);
-  free(env);
+const char* env_push_error(void) {
+  return fstack.error;
 }
 
-void env_free(Env* e) {
-  if (!e) return;
+// Arguments of calls wider than CALL_INLINE_ARGS go on a stack of chunks
+// that never move. Calls nest, so they are released in LIFO order and a
+// chunk is only ever popped when empty.
+typedef struct ArgChunk {
+  struct ArgChunk* prev;
+  size_t cap;
+  size_t top;
+  Value items[];
+} ArgChunk;
+
+#define ARG_CHUNK_VALUES 256
+
+static ArgChunk* arg_chunk;   // holds the top of the stack
+static ArgChunk* arg_spare;   // the last chunk popped, kept for reuse
+
+Value* call_args_alloc(size_t n) {
+  ArgChunk* c = arg_chunk;
+  if (!c || c->cap - c->top < n) {
+    if (arg_spare && arg_spare->cap >= n) {
+      c = arg_spare;
+      arg_spare = NULL;
+    } else {
+      size_t cap = n > ARG_CHUNK_VALUES ? n : ARG_CHUNK_VALUES;
+      c = (ArgChunk*)malloc(sizeof(ArgChunk) + cap * sizeof(Value));
+      if (!c) return NULL;
+      c->cap = cap;
+    }
+    c->top = 0;
+    c->prev = arg_chunk;
+    arg_chunk = c;
+  }
+  Value* argv = c->items + c->top;
+  c->top += n;
+  return argv;
+}
+
+void call_args_release(Value* argv, size_t n) {
+  (void)argv;
+  ArgChunk* c = arg_chunk;
+  c->top -= n;
+  if (!c->top && c->prev) {
+    arg_chunk = c->prev;
+    free(arg_spare);
+    arg_spare = c;
+  }
+}
+
+void frames_release(void) {
+  while (arg_chunk) {
+    ArgChunk* prev = arg_chunk->prev;
+    free(arg_chunk);
+    arg_chunk = prev;
+  }
+  free(arg_spare);
+  arg_spare = NULL;
+  FrameStack* fs = &fstack;
+  for (size_t i = 0; i < fs->count; i++) env_free(fs->frames[i]);
+  for (size_t i = 0; i < fs->block_count; i++) free(fs->blocks[i]);
+  free(fs->frames);
+  free(fs->blocks);
+  size_t limit = fs->max_depth;
+  memset(fs, 0, sizeof(*fs));
+  fs->max_depth = limit;
+}
+
+void env_bind_layout(Env* e, const FrameLayout* layout) {
+  if (!layout || !layout->count) return;
+  if (!env_reserve(e, layout->count, 0)) return;
+  for (size_t i = 0; i < layout->count; i++) {
+    Binding* b = &e->items[i];
+    b->name = layout->names[i];
+    b->value = value_null();
+    b->is_lock = false;
+    b->is_set = false;
+    b->owns_func = false;
+  }
+  e->count = layout->count;
+  STAT_MAX(peak_bindings, e->count);
+}
+
+static void release_bindings(Env* e) {
   for (size_t i = 0; i < e->count; i++) {
-    if (e->items[i].value.type == VAL_FUNC && e->items[i].value.func) {
+    if (!e->items[i].is_set) continue;
+    if (e->items[i].owns_func && e->items[i].value.func) {
       free(e->items[i].value.func);
       e->items[i].value.func = NULL;
     }
-    free(e->items[i].name);
     value_free(&e->items[i].value);
   }
-  free(e->items);
-  e->items = NULL; e->count = 0; e->cap = 0; e->parent = NULL;
+  e->count = 0;
+  if (e->indexed) {
+    for (size_t i = 0; i < e->index_cap; i++) e->index[i] = -1;
+    e->indexed = 0;
+  }
 }
 
-static Binding* find_binding(Env* e, const char* name, size_t n) {
-  for (Env* cur = e; cur; cur = cur->parent) {
-    for (size_t i = 0; i < cur->count; i++) {
-      if (strlen(cur->items[i].name) == n && memcmp(cur->items[i].name, name, n) == 0) {
-        return &cur->items[i];
-      }
+void env_free(Env* e) {
+  if (!e) return;
+  names_version++;
+  release_bindings(e);
+  if (e->items != e->inline_items) free(e->items);
+  free(e->index);
+  env_init(e);
+}
+
+// frames are popped in the order they were pushed
+void env_pop(Env* env) {
+  STAT_DEC(live_frames);
+  release_bindings(env);
+  env->parent = NULL;
+  fstack.depth--;
+}
+
+void env_reset_frame(Env* e, Env* parent, const FrameLayout* layout) {
+  release_bindings(e);
+  e->parent = parent;
+  env_bind_layout(e, layout);
+}
+
+// Whether v is, or holds at any depth, a function defined in frame. Lists
+// are the only containers, and packed ones hold no functions.
+static bool value_reaches_frame(const Value* v, const Env* frame) {
+  if (v->type == VAL_FUNC) return v->func && v->func->closure == frame;
+  if (v->type != VAL_LIST) return false;
+  size_t off;
+  const List* s = list_store(v->list, &off);
+  if (s->packed) return false;
+  for (size_t i = 0; i < v->list->len; i++) {
+    if (value_reaches_frame(&s->items[off + i], frame)) return true;
+  }
+  return false;
+}
+
+bool tail_call_reusable(const Value* callee, const Value* args, size_t argc, const Env* frame) {
+  if (callee->type != VAL_FUNC || !callee->func) return false;
+  const Function* fn = callee->func;
+  if (!fn->closure || fn->closure == frame || argc != fn->param_count) return false;
+  for (size_t i = 0; i < argc; i++) {
+    if (value_reaches_frame(&args[i], frame)) return false;
+  }
+  return true;
+}
+
+// Index the bindings appended since the last lookup. False leaves the frame
+// to the linear scan: it is small, or the index could not be allocated.
+static bool env_index_sync(Env* e) {
+  if (e->count < ENV_INDEX_MIN) return false;
+  if (e->indexed == e->count) return true;
+  if (e->count * 2 > e->index_cap) {
+    size_t nc = e->index_cap ? e->index_cap : 64;
+    while (e->count * 2 > nc) nc *= 2;
+    int* table = (int*)malloc(nc * sizeof(int));
+    if (!table) return false;
+    for (size_t i = 0; i < nc; i++) table[i] = -1;
+    free(e->index);
+    e->index = table;
+    e->index_cap = nc;
+    e->indexed = 0;
+  }
+  size_t mask = e->index_cap - 1;
+  for (; e->indexed < e->count; e->indexed++) {
+    size_t i = intern_hash(e->items[e->indexed].name) & mask;
+    while (e->index[i] >= 0) i = (i + 1) & mask;
+    e->index[i] = (int)e->indexed;
+  }
+  return true;
+}
+
+// the binding of that name in e alone, set or not; names are unique per frame
+static Binding* frame_find(Env* e, const char* name) {
+  if (env_index_sync(e)) {
+    size_t mask = e->index_cap - 1;
+    for (size_t i = intern_hash(name) & mask;; i = (i + 1) & mask) {
+      int slot = e->index[i];
+      if (slot < 0) return NULL;
+      if (e->items[slot].name == name) return &e->items[slot];
     }
   }
+  for (size_t i = 0; i < e->count; i++) {
+    if (e->items[i].name == name) return &e->items[i];
+  }
   return NULL;
 }
 
-static Binding* find_local_binding(Env* e, const char* name, size_t n) {
-  for (size_t i = 0; i < e->count; i++) {
-    if (strlen(e->items[i].name) == n && memcmp(e->items[i].name, name, n) == 0) {
-      return &e->items[i];
+// by-name lookups only see assigned bindings; unset slots are invisible.
+// *where, when given, receives the frame the binding is in.
+static Binding* find_binding_in(Env* e, const char* name, Env** where) {
+  STAT_INC(lookups);
+  for (Env* cur = e; cur; cur = cur->parent) {
+    STAT_INC(lookup_frames);
+    Binding* b = frame_find(cur, name);
+    if (b && b->is_set) {
+      if (where) *where = cur;
+      return b;
     }
   }
   return NULL;
 }
 
-Value env_get(const Env* e, const char* name, size_t n) {
-  Binding* b = find_binding((Env*)e, name, n);
-  return b ? value_copy(&b->value) : value_error("undefined variable", strlen("undefined variable"));
+static Binding* find_binding(Env* e, const char* name) {
+  return find_binding_in(e, name, NULL);
+}
+
+// includes unset slots, so a by-name definition lands in the resolver's slot
+static Binding* find_local_binding(Env* e, const char* name) {
+  STAT_INC(lookups);
+  STAT_INC(lookup_frames);
+  return frame_find(e, name);
+}
+
+static const Builtin* fallback_builtin(const char* name);
+
+Value env_get(const Env* e, const char* name) {
+  Binding* b = find_binding((Env*)e, name);
+  if (b) return value_copy(&b->value);
+  const Builtin* fallback = fallback_builtin(name);
+  if (fallback) return value_builtin(fallback);
+  return value_error("undefined variable", strlen("undefined variable"));
 }
 
-static bool env_set_internal(Env* e, const char* name, size_t n, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n, bool only_local) {
-  Binding* existing = only_local ? find_local_binding(e, name, n) : find_binding(e, name, n);
-  if (existing) {
-    if (existing->is_lock) { snprintf(errbuf, errbuf_n, "cannot assign to locked binding"); return false; }
-    value_free(&existing->value);
-    existing->value = value_copy(v);
+bool env_slot_assign(Binding* b, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n) {
+  if (b->is_set) {
+    if (b->is_lock) { snprintf(errbuf, errbuf_n, "cannot assign to locked binding"); return false; }
+    value_free(&b->value);
+    b->value = value_copy(v);
     return true;
   }
-  if (e->count + 1 > e->cap) {
-    size_t nc = e->cap ? e->cap * 2 : 16;
-    e->items = (Binding*)realloc(e->items, nc * sizeof(Binding));
-    e->cap = nc;
+  b->value = value_copy(v);
+  b->is_lock = is_lock;
+  b->is_set = true;
+  return true;
+}
+
+bool env_slot_append(Binding* b, Value* left, const Value* pieces, size_t n) {
+  if (!b->is_set || b->is_lock) return false;
+  if (left->type != VAL_STRING || !left->str) return false;
+  if (b->value.type != VAL_STRING || b->value.str != left->str) return false;
+  // the binding and `left` are the only holders
+  if (left->str->refs != 2) return false;
+  char* text[APPEND_MAX_PIECES] = {0};
+  size_t total = 0;
+  bool ok = n <= APPEND_MAX_PIECES;
+  for (size_t i = 0; ok && i < n; i++) {
+    if (pieces[i].type == VAL_STRING) { total += value_strlen(&pieces[i]); continue; }
+    text[i] = value_to_cstring(&pieces[i]);
+    if (!text[i]) ok = false;
+    else total += strlen(text[i]);
+  }
+  if (ok) {
+    value_free(left);
+    ok = value_string_reserve(&b->value, total);
+    for (size_t i = 0; ok && i < n; i++) {
+      const char* s = text[i] ? text[i] : value_str(&pieces[i]);
+      size_t len = text[i] ? strlen(text[i]) : value_strlen(&pieces[i]);
+      if (len) value_string_append(&b->value, s, len);
+    }
+    if (!ok) *left = value_copy(&b->value);
   }
+  for (size_t i = 0; i < n && i < APPEND_MAX_PIECES; i++) free(text[i]);
+  return ok;
+}
+
+static bool env_set_internal(Env* e, const char* name, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n, bool only_local) {
+  Binding* existing = only_local ? find_local_binding(e, name) : find_binding(e, name);
+  if (!existing && !only_local) existing = find_local_binding(e, name);
+  if (existing) return env_slot_assign(existing, v, is_lock, errbuf, errbuf_n);
+  if (e->count == e->cap && !env_reserve(e, e->cap ? e->cap * 2 : 16, e->count)) {
+    snprintf(errbuf, errbuf_n, "out of memory");
+    return false;
+  }
+  names_version++;
   Binding nb;
-  nb.name = dup_n(name, n);
+  nb.name = name;
   nb.value = value_copy(v);
   nb.is_lock = is_lock;
+  nb.is_set = true;
+  nb.owns_func = false;
   e->items[e->count++] = nb;
+  STAT_MAX(peak_bindings, e->count);
   return true;
 }
 
-bool env_set(Env* e, const char* name, size_t n, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n) {
-  return env_set_internal(e, name, n, v, is_lock, errbuf, errbuf_n, false);
+bool env_set(Env* e, const char* name, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n) {
+  return env_set_internal(e, name, v, is_lock, errbuf, errbuf_n, false);
+}
+
+bool env_define_local(Env* e, const char* name, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n) {
+  return env_set_internal(e, name, v, is_lock, errbuf, errbuf_n, true);
 }
 
-bool env_define_local(Env* e, const char* name, size_t n, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n) {
-  return env_set_internal(e, name, n, v, is_lock, errbuf, errbuf_n, true);
+bool env_bind_function(Env* e, int slot, const char* name, Function* fn, char* errbuf, size_t errbuf_n) {
+  Value fv = value_func(fn);
+  Binding* b = NULL;
+  if (slot >= 0) {
+    b = &e->items[slot];
+    if (!env_slot_assign(b, &fv, true, errbuf, errbuf_n)) b = NULL;
+  } else if (env_define_local(e, name, &fv, true, errbuf, errbuf_n)) {
+    b = find_local_binding(e, name);
+  }
+  if (!b) {
+    free(fn);
+    return false;
+  }
+  b->owns_func = true;
+  return true;
 }
 
 static Value add_values(const Value* a, const Value* b) {
   if (a->type == VAL_INT && b->type == VAL_INT) {
-    return value_int(a->i + b->i);
-  }
-  char* sa = value_to_cstring(a);
-  char* sb = value_to_cstring(b);
-  if (!sa || !sb) {
-    if (sa) free(sa);
-    if (sb) free(sb);
-    return value_error("out of memory", strlen("out of memory"));
+    return value_int(int_add(a->i, b->i));
   }
-  size_t na = strlen(sa), nb = strlen(sb);
-  char* out = (char*)malloc(na + nb + 1);
-  if (!out) {
-    free(sa); free(sb);
+  // strings are used in place; only other operands need rendering
+  char* ta = a->type == VAL_STRING ? NULL : value_to_cstring(a);
+  char* tb = b->type == VAL_STRING ? NULL : value_to_cstring(b);
+  const char* sa = ta ? ta : value_str(a);
+  const char* sb = tb ? tb : value_str(b);
+  size_t na = ta ? strlen(ta) : value_strlen(a);
+  size_t nb = tb ? strlen(tb) : value_strlen(b);
+  char* out = NULL;
+  bool rendered = (ta || a->type == VAL_STRING) && (tb || b->type == VAL_STRING);
+  Value v = rendered ? value_string_uninit(na + nb, &out) : value_null();
+  if (!v.str) {
+    free(ta); free(tb);
     return value_error("out of memory", strlen("out of memory"));
   }
-  memcpy(out, sa, na);
-  memcpy(out + na, sb, nb);
-  out[na + nb] = '\0';
-  free(sa); free(sb);
-  Value v; v.type = VAL_STRING; v.i = 0; v.s = out; v.func = NULL; v.builtin = NULL; v.b = false;
+  if (na) memcpy(out, sa, na);
+  if (nb) memcpy(out + na, sb, nb);
+  free(ta); free(tb);
   return v;
 }
 
 static Value sub_values(const Value* a, const Value* b) {
   if (a->type == VAL_INT && b->type == VAL_INT) {
-    return value_int(a->i - b->i);
+    return value_int(int_sub(a->i, b->i));
   }
   return value_error("sub expects ints", strlen("sub expects ints"));
 }
 
 static Value mul_values(const Value* a, const Value* b) {
   if (a->type == VAL_INT && b->type == VAL_INT) {
-    return value_int(a->i * b->i);
+    return value_int(int_mul(a->i, b->i));
   }
   return value_error("mul expects ints", strlen("mul expects ints"));
 }
@@ -138,7 +462,7 @@ static Value mul_values(const Value* a, const Value* b) {
 static Value div_values(const Value* a, const Value* b) {
   if (a->type == VAL_INT && b->type == VAL_INT) {
     if (b->i == 0) return value_error("division by zero", strlen("division by zero"));
-    return value_int(a->i / b->i);
+    return value_int(int_div(a->i, b->i));
   }
   return value_error("div expects ints", strlen("div expects ints"));
 }
@@ -149,11 +473,54 @@ static int compare_ints(long a, long b) {
   return 0;
 }
 
-static int compare_strings(const char* a, const char* b) {
-  if (!a && !b) return 0;
-  if (!a) return -1;
-  if (!b) return 1;
-  return strcmp(a, b);
+static int compare_strings(const Value* a, const Value* b) {
+  if (a->str == b->str) return 0;
+  if (!a->str) return -1;
+  if (!b->str) return 1;
+  size_t na = value_strlen(a), nb = value_strlen(b);
+  int cmp = memcmp(a->str->data, b->str->data, na < nb ? na : nb);
+  if (cmp) return cmp;
+  return na < nb ? -1 : na > nb;
+}
+
+// two interned strings are equal only when they are the same Str
+static bool strings_equal(const Value* a, const Value* b) {
+  if (a->str == b->str) return true;
+  if (a->str && b->str && !a->str->refs && !b->str->refs) return false;
+  return compare_strings(a, b) == 0;
+}
+
+static bool values_equal(const Value* a, const Value* b);
+
+// same length and equal items; packed lists compare as arrays
+static bool lists_equal(const List* a, const List* b) {
+  if (a == b) return true;
+  if (a->len != b->len) return false;
+  size_t ao, bo;
+  const List* as = list_store(a, &ao);
+  const List* bs = list_store(b, &bo);
+  if (as->packed && bs->packed) return !a->len || !memcmp(as->ints + ao, bs->ints + bo, a->len * sizeof(long));
+  for (size_t i = 0; i < a->len; i++) {
+    Value x = list_get(a, i), y = list_get(b, i);
+    bool eq = values_equal(&x, &y);
+    value_free(&x);
+    value_free(&y);
+    if (!eq) return false;
+  }
+  return true;
+}
+
+static bool values_equal(const Value* a, const Value* b) {
+  if (a->type != b->type) return false;
+  switch (a->type) {
+    case VAL_INT: return a->i == b->i;
+    case VAL_BOOL: return a->b == b->b;
+    case VAL_STRING: return strings_equal(a, b);
+    case VAL_FUNC: return a->func == b->func;
+    case VAL_BUILTIN: return a->builtin == b->builtin;
+    case VAL_LIST: return lists_equal(a->list, b->list);
+    default: return true;
+  }
 }
 
 static Value compare_values(const Value* a, const Value* b, BinOp op) {
@@ -170,10 +537,9 @@ static Value compare_values(const Value* a, const Value* b, BinOp op) {
     }
   }
   if (a->type == VAL_STRING && b->type == VAL_STRING) {
-    int cmp = compare_strings(a->s, b->s);
     switch (op) {
-      case BIN_EQ: return value_bool(cmp == 0);
-      case BIN_NEQ: return value_bool(cmp != 0);
+      case BIN_EQ: return value_bool(strings_equal(a, b));
+      case BIN_NEQ: return value_bool(!strings_equal(a, b));
       default: break;
     }
   }
@@ -192,117 +558,281 @@ static Value compare_values(const Value* a, const Value* b, BinOp op) {
     }
   }
   if (op == BIN_EQ || op == BIN_NEQ) {
-    bool eq = false;
-    if (a->type == b->type) {
-      eq = true;
-      switch (a->type) {
-        case VAL_INT: eq = a->i == b->i; break;
-        case VAL_BOOL: eq = a->b == b->b; break;
-        case VAL_STRING: eq = compare_strings(a->s, b->s) == 0; break;
-        case VAL_FUNC: eq = a->func == b->func; break;
-        case VAL_BUILTIN: eq = a->builtin == b->builtin; break;
-        default: break;
-      }
-    }
+    bool eq = values_equal(a, b);
     return value_bool(op == BIN_EQ ? eq : !eq);
   }
   return value_error("unsupported comparison", strlen("unsupported comparison"));
 }
 
-static Value call_function(const Function* fn, const Value* args, size_t argc, Env* env, char* errbuf, size_t errbuf_n);
+Value eval_binary_op(BinOp op, const Value* l, const Value* r) {
+  switch (op) {
+    case BIN_ADD: return add_values(l, r);
+    case BIN_SUB: return sub_values(l, r);
+    case BIN_MUL: return mul_values(l, r);
+    case BIN_DIV: return div_values(l, r);
+    case BIN_EQ: case BIN_NEQ: case BIN_LT: case BIN_LTE: case BIN_GT: case BIN_GTE:
+      return compare_values(l, r, op);
+    case BIN_AND:
+      if (!value_is_truthy(l)) return value_bool(false);
+      return value_bool(value_is_truthy(r));
+    case BIN_OR:
+      if (value_is_truthy(l)) return value_bool(true);
+      return value_bool(value_is_truthy(r));
+    default:
+      return value_error("unknown binary", strlen("unknown binary"));
+  }
+}
 
-static Value eval_call(const CallExpr* call, Env* env, char* errbuf, size_t errbuf_n) {
-  if (!call) return value_error("null call", strlen("null call"));
-  Value callee = eval_expr(call->callee, env);
-  if (callee.type == VAL_ERROR) return callee;
-  Value* argv = NULL;
-  if (call->arg_count) {
-    argv = (Value*)calloc(call->arg_count, sizeof(Value));
-    for (size_t i = 0; i < call->arg_count; i++) {
-      argv[i] = eval_expr(call->args[i], env);
-      if (argv[i].type == VAL_ERROR) {
-        for (size_t j = 0; j < i; j++) value_free(&argv[j]);
-        Value err = argv[i];
-        free(argv);
-        value_free(&callee);
-        return err;
-      }
-    }
+Value eval_unary_op(UnOp op, const Value* v) {
+  switch (op) {
+    case UN_NEGATE:
+      if (v->type == VAL_INT) return value_int(int_neg(v->i));
+      return value_error("negate expects int", strlen("negate expects int"));
+    case UN_NOT:
+      return value_bool(!value_is_truthy(v));
   }
+  return value_error("bad unary", strlen("bad unary"));
+}
+
+// The tree-walker recurses in C for every Astralis call, so run_program runs
+// it on a stack of its own sized for --max-depth. Calls fail cleanly once
+// the stack pointer gets within NATIVE_STACK_RESERVE of its end.
+#define NATIVE_STACK_BASE ((size_t)1 << 20)
+#define NATIVE_STACK_PER_CALL ((size_t)2048)
+#define NATIVE_STACK_RESERVE ((size_t)64 * 1024)
+static uintptr_t stack_floor;
+
+// A failing function body reports here; call_function turns the message
+// into the call's error value before anything else can fail.
+static char call_err[256];
+
+static Value call_function(Function* fn, const Value* args, size_t argc, Env* env);
 
-  char local_err[256] = {0};
-  char* errp = errbuf ? errbuf : local_err;
-  size_t errn = errbuf ? errbuf_n : sizeof(local_err);
+static void free_args(Value* argv, size_t argc, const Value* inline_buf) {
+  for (size_t i = 0; i < argc; i++) value_free(&argv[i]);
+  if (argv != inline_buf) call_args_release(argv, argc);
+}
+
+// operands that are set slots or literals, read without a recursive call
+static inline Value eval_operand(const Expr* e, Env* env) {
+  if (e->type == EXPR_IDENT && e->ref.slot >= 0) {
+    Binding* b = env_slot(env, e->ref.depth, e->ref.slot);
+    if (b->is_set) return value_copy(&b->value);
+  } else if (e->type == EXPR_LITERAL) {
+    return value_copy(&e->lit);
+  }
+  return eval_expr(e, env);
+}
+
+// A callee the resolver could not place, through its CallSite: a hit reads
+// the global binding or names the fallback builtin directly, a miss looks
+// the name up and caches a global binding or a fallback builtin.
+static Value eval_site_callee(const CallExpr* call, Env* env) {
+  CallSite* site = call->site;
+  if (site->version == names_version) {
+    return site->frame ? value_copy(&site->frame->items[site->slot].value) : value_builtin(site->builtin);
+  }
+  const char* name = call->callee->tok.start;
+  Env* where = NULL;
+  Binding* b = find_binding_in(env, name, &where);
+  if (!b) {
+    const Builtin* fallback = fallback_builtin(name);
+    if (!fallback) return value_error("undefined variable", strlen("undefined variable"));
+    site->version = names_version;
+    site->frame = NULL;
+    site->builtin = fallback;
+    return value_builtin(fallback);
+  }
+  if (!where->parent) {
+    site->version = names_version;
+    site->frame = where;
+    site->slot = (size_t)(b - where->items);
+  }
+  return value_copy(&b->value);
+}
+
+// Evaluate the callee and then the arguments, into `buf` (CALL_INLINE_ARGS
+// long) when they fit. On failure *err holds the error and nothing is left
+// to free.
+static bool eval_call_parts(const CallExpr* call, Env* env, Value* buf, Value* callee, Value** argv, Value* err) {
+  *callee = call->site ? eval_site_callee(call, env) : eval_operand(call->callee, env);
+  *argv = buf;
+  if (callee->type == VAL_ERROR) { *err = *callee; return false; }
+  if (!call->arg_count) return true;
+  Value* args = call->arg_count <= CALL_INLINE_ARGS ? buf : call_args_alloc(call->arg_count);
+  if (!args) {
+    value_free(callee);
+    *err = value_error("out of memory", strlen("out of memory"));
+    return false;
+  }
+  for (size_t i = 0; i < call->arg_count; i++) {
+    args[i] = eval_operand(call->args[i], env);
+    if (args[i].type == VAL_ERROR) {
+      *err = args[i];
+      for (size_t k = 0; k < i; k++) value_free(&args[k]);
+      if (args != buf) call_args_release(args, call->arg_count);
+      value_free(callee);
+      return false;
+    }
+  }
+  *argv = args;
+  return true;
+}
 
-  Value result = value_error("unsupported call", strlen("unsupported call"));
-  if (callee.type == VAL_BUILTIN) {
-    result = callee.builtin->fn(argv, call->arg_count);
-  } else if (callee.type == VAL_FUNC) {
-    result = call_function(callee.func, argv, call->arg_count, env, errp, errn);
+Value call_value(Value* callee, Value* argv, size_t argc, Env* env) {
+  Value result;
+  if (callee->type == VAL_BUILTIN) {
+    STAT_INC(builtin_calls);
+    if (trace_enabled) trace_begin(TRACE_BUILTIN, callee->builtin->name, strlen(callee->builtin->name));
+    result = callee->builtin->fn(argv, argc);
+    if (trace_enabled) trace_end();
+  } else if (callee->type == VAL_FUNC) {
+    result = call_function(callee->func, argv, argc, env);
+  } else {
+    result = value_error("unsupported call", strlen("unsupported call"));
   }
+  value_free(callee);
+  return result;
+}
 
-  for (size_t i = 0; i < call->arg_count; i++) value_free(&argv[i]);
-  free(argv);
-  value_free(&callee);
+static Value eval_call(const CallExpr* call, Env* env) {
+  if (!call) return value_error("null call", strlen("null call"));
+  Value buf[CALL_INLINE_ARGS];
+  Value callee, err;
+  Value* argv;
+  if (!eval_call_parts(call, env, buf, &callee, &argv, &err)) return err;
+  Value result = call_value(&callee, argv, call->arg_count, env);
+  free_args(argv, call->arg_count, buf);
   return result;
 }
 
+// eval_binary_op on two ints, without building Values for them. Division
+// by zero is left to the generic path for its error.
+static inline bool int_binary(BinOp op, long a, long b, Value* out) {
+  out->type = VAL_INT;
+  switch (op) {
+    case BIN_ADD: out->i = int_add(a, b); return true;
+    case BIN_SUB: out->i = int_sub(a, b); return true;
+    case BIN_MUL: out->i = int_mul(a, b); return true;
+    case BIN_DIV:
+      if (b == 0) return false;
+      out->i = int_div(a, b);
+      return true;
+    default: break;
+  }
+  out->type = VAL_BOOL;
+  switch (op) {
+    case BIN_EQ: out->b = a == b; return true;
+    case BIN_NEQ: out->b = a != b; return true;
+    case BIN_LT: out->b = a < b; return true;
+    case BIN_LTE: out->b = a <= b; return true;
+    case BIN_GT: out->b = a > b; return true;
+    case BIN_GTE: out->b = a >= b; return true;
+    default: return false;
+  }
+}
+
+// The guard of a QUICK_INT node, one operand at a time: int literals and
+// set int slots are read in place, anything else is evaluated into *v.
+// Returns false with the operand (or its error) in *v when it is no int.
+static inline bool quick_int_operand(const Expr* e, Env* env, long* out, Value* v) {
+  if (e->type == EXPR_LITERAL) {
+    if (e->lit.type == VAL_INT) { *out = e->lit.i; return true; }
+  } else if (e->type == EXPR_IDENT && e->ref.slot >= 0) {
+    Binding* b = env_slot(env, e->ref.depth, e->ref.slot);
+    if (b->is_set && b->value.type == VAL_INT) { *out = b->value.i; return true; }
+  }
+  *v = eval_operand(e, env);
+  if (v->type != VAL_INT) return false;
+  *out = v->i;
+  return true;
+}
+
+static void quick_miss(QuickSite* q) {
+  q->state = ++q->misses >= QUICK_MAX_MISSES ? QUICK_GENERIC : QUICK_NONE;
+}
+
+static inline Value eval_binary(const Expr* e, Env* env) {
+  QuickSite* q = e->quick;
+  Value l, r, out;
+  if (q && q->state == QUICK_INT) {
+    long a, b;
+    if (!quick_int_operand(e->left, env, &a, &l)) {
+      if (l.type == VAL_ERROR) return l;
+      r = eval_operand(e->right, env);
+      if (r.type == VAL_ERROR) { value_free(&l); return r; }
+      quick_miss(q);
+    } else if (!quick_int_operand(e->right, env, &b, &r)) {
+      if (r.type == VAL_ERROR) return r;
+      l = value_int(a);
+      quick_miss(q);
+    } else if (int_binary(e->op, a, b, &out)) {
+      q->hits++;
+      return out;
+    } else {
+      l = value_int(a);
+      r = value_int(b);
+    }
+  } else {
+    l = eval_operand(e->left, env);
+    if (l.type == VAL_ERROR) return l;
+    r = eval_operand(e->right, env);
+    if (r.type == VAL_ERROR) { value_free(&l); return r; }
+    // a polymorphic node still skips eval_binary_op on ints; it just stops
+    // paying for the guard's misses
+    if (l.type == VAL_INT && r.type == VAL_INT && int_binary(e->op, l.i, r.i, &out)) {
+      if (q) {
+        q->generic++;
+        if (q->state == QUICK_NONE) q->state = QUICK_INT;
+      }
+      return out;
+    }
+  }
+  if (q) q->generic++;
+  out = eval_binary_op(e->op, &l, &r);
+  value_free(&l);
+  value_free(&r);
+  return out;
+}
+
+void quick_stats_print(const Program* p, FILE* f) {
+  unsigned long hits = 0, total = 0;
+  size_t sites = 0, specialized = 0, misses = 0, gave_up = 0;
+  for (const QuickSite* q = p->quick_sites; q; q = q->next) {
+    if (!q->hits && !q->generic) continue;
+    sites++;
+    hits += q->hits;
+    total += q->hits + q->generic;
+    if (q->state != QUICK_NONE || q->misses) specialized++;
+    misses += q->misses;
+    if (q->state == QUICK_GENERIC) gave_up++;
+  }
+  fprintf(f, "quicken: %lu of %lu binary ops on the int fast path (%.1f%%); %zu of %zu nodes specialized, %zu guard misses, %zu gave up\n",
+          hits, total, total ? 100.0 * (double)hits / (double)total : 0.0, specialized, sites, misses, gave_up);
+}
+
 Value eval_expr(const Expr* e, Env* env) {
   if (!e) return value_error("null expr", strlen("null expr"));
   switch (e->type) {
     case EXPR_LITERAL:
       return value_copy(&e->lit);
     case EXPR_IDENT:
-      return env_get(env, e->tok.start, e->tok.length);
+      if (e->ref.slot >= 0) {
+        Binding* b = env_slot(env, e->ref.depth, e->ref.slot);
+        if (b->is_set) return value_copy(&b->value);
+      }
+      return env_get(env, e->tok.start);
     case EXPR_GROUP:
       return eval_expr(e->left, env);
     case EXPR_UNARY: {
       Value inner = eval_expr(e->left, env);
       if (inner.type == VAL_ERROR) return inner;
-      Value out = value_error("bad unary", strlen("bad unary"));
-      switch (e->unop) {
-        case UN_NEGATE:
-          if (inner.type == VAL_INT) out = value_int(-inner.i);
-          else out = value_error("negate expects int", strlen("negate expects int"));
-          break;
-        case UN_NOT:
-          out = value_bool(!value_is_truthy(&inner));
-          break;
-      }
+      Value out = eval_unary_op(e->unop, &inner);
       value_free(&inner);
       return out;
     }
-    case EXPR_BINARY: {
-      Value l = eval_expr(e->left, env);
-      if (l.type == VAL_ERROR) return l;
-      Value r = eval_expr(e->right, env);
-      if (r.type == VAL_ERROR) { value_free(&l); return r; }
-      Value out = value_error("unknown binary", strlen("unknown binary"));
-      switch (e->op) {
-        case BIN_ADD: out = add_values(&l, &r); break;
-        case BIN_SUB: out = sub_values(&l, &r); break;
-        case BIN_MUL: out = mul_values(&l, &r); break;
-        case BIN_DIV: out = div_values(&l, &r); break;
-        case BIN_EQ: case BIN_NEQ: case BIN_LT: case BIN_LTE: case BIN_GT: case BIN_GTE:
-          out = compare_values(&l, &r, e->op); break;
-        case BIN_AND: {
-          bool lv = value_is_truthy(&l);
-          if (!lv) out = value_bool(false);
-          else out = value_bool(value_is_truthy(&r));
-          break;
-        }
-        case BIN_OR: {
-          bool lv = value_is_truthy(&l);
-          if (lv) out = value_bool(true);
-          else out = value_bool(value_is_truthy(&r));
-          break;
-        }
-        default: break;
-      }
-      value_free(&l);
-      value_free(&r);
-      return out;
-    }
+    case EXPR_BINARY:
+      return eval_binary(e, env);
     case EXPR_CONDITIONAL: {
       Value cond = eval_expr(e->cond, env);
       if (cond.type == VAL_ERROR) return cond;
@@ -310,49 +840,102 @@ Value eval_expr(const Expr* e, Env* env) {
       value_free(&cond);
       return truth ? eval_expr(e->left, env) : eval_expr(e->right, env);
     }
+    case EXPR_LOGICAL: {
+      Value l = eval_expr(e->left, env);
+      if (l.type == VAL_ERROR) return l;
+      bool truth = value_is_truthy(&l);
+      value_free(&l);
+      // a truthy left decides `or`, a falsey one decides `and`
+      if (truth == (e->op == BIN_OR)) return value_bool(truth);
+      Value r = eval_expr(e->right, env);
+      if (r.type == VAL_ERROR) return r;
+      truth = value_is_truthy(&r);
+      value_free(&r);
+      return value_bool(truth);
+    }
     case EXPR_CALL:
-      return eval_call(&e->call, env, NULL, 0);
+      return eval_call(&e->call, env);
     default:
       return value_error("unknown expr", strlen("unknown expr"));
   }
 }
 
-typedef struct ExecState {
-  bool returned;
-  bool broke;
-  bool cont;
-  Value ret;
-} ExecState;
-
 static bool exec_block(const Block* b, Env* env, ExecState* st, char* errbuf, size_t errbuf_n);
 
+// `set x to x + ...` (see resolve_append_pieces): evaluate every operand in
+// the order the adds would, then grow x in place when it is unshared. Sets
+// *done when the slot was updated; otherwise returns the value to assign.
+static Value eval_append(const Stmt* s, const Expr** pieces, size_t n, Env* env, bool* done) {
+  const Expr* x = s->expr;
+  for (size_t i = 0; i < n; i++) x = x->left;
+  Value l = eval_expr(x, env);
+  if (l.type == VAL_ERROR) return l;
+  Value vals[APPEND_MAX_PIECES];
+  for (size_t i = 0; i < n; i++) {
+    vals[i] = eval_expr(pieces[i], env);
+    if (vals[i].type == VAL_ERROR) {
+      Value err = vals[i];
+      for (size_t j = 0; j < i; j++) value_free(&vals[j]);
+      value_free(&l);
+      return err;
+    }
+  }
+  if (env_slot_append(env_slot(env, 0, s->ref.slot), &l, vals, n)) {
+    for (size_t i = 0; i < n; i++) value_free(&vals[i]);
+    *done = true;
+    return value_null();
+  }
+  for (size_t i = 0; i < n; i++) {
+    Value next = eval_binary_op(BIN_ADD, &l, &vals[i]);
+    value_free(&l);
+    value_free(&vals[i]);
+    l = next;
+  }
+  return l;
+}
+
 static bool exec_stmt(const Stmt* s, Env* env, ExecState* st, char* errbuf, size_t errbuf_n) {
+  if (prof_enabled) prof_line(s->line);
   switch (s->type) {
     case STMT_SHOW: {
       Value v = eval_expr(s->expr, env);
-      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.s ? v.s : "error"); value_free(&v); return false; }
+      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.str ? v.str->data : "error"); value_free(&v); return false; }
       rt_show(&v);
       value_free(&v);
       return true;
     }
     case STMT_WARN: {
       Value v = eval_expr(s->expr, env);
-      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.s ? v.s : "error"); value_free(&v); return false; }
+      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.str ? v.str->data : "error"); value_free(&v); return false; }
       rt_warn(&v);
       value_free(&v);
       return true;
     }
     case STMT_SET:
     case STMT_LOCK: {
-      Value v = eval_expr(s->expr, env);
-      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.s ? v.s : "error"); value_free(&v); return false; }
-      bool ok = env_set(env, s->name.start, s->name.length, &v, s->type == STMT_LOCK, errbuf, errbuf_n);
+      Value v;
+      const Expr* pieces[APPEND_MAX_PIECES];
+      size_t n = resolve_append_pieces(s, pieces);
+      if (n) {
+        bool done = false;
+        v = eval_append(s, pieces, n, env, &done);
+        if (done) return true;
+      } else {
+        v = eval_expr(s->expr, env);
+      }
+      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.str ? v.str->data : "error"); value_free(&v); return false; }
+      bool ok;
+      if (s->ref.slot >= 0 && !s->ref.shadowed) {
+        ok = env_slot_assign(env_slot(env, 0, s->ref.slot), &v, s->type == STMT_LOCK, errbuf, errbuf_n);
+      } else {
+        ok = env_set(env, s->name.start, &v, s->type == STMT_LOCK, errbuf, errbuf_n);
+      }
       value_free(&v);
       return ok;
     }
     case STMT_IF: {
       Value cond = eval_expr(s->expr, env);
-      if (cond.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", cond.s ? cond.s : "error"); value_free(&cond); return false; }
+      if (cond.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", cond.str ? cond.str->data : "error"); value_free(&cond); return false; }
       bool truth = value_is_truthy(&cond);
       value_free(&cond);
       if (truth && s->block) return exec_block(s->block, env, st, errbuf, errbuf_n);
@@ -368,21 +951,29 @@ static bool exec_stmt(const Stmt* s, Env* env, ExecState* st, char* errbuf, size
       }
     }
     case STMT_REPEAT: {
+      // ints own nothing, so the bounds are plain longs from here on
       Value start = eval_expr(s->expr, env);
       if (start.type != VAL_INT) { snprintf(errbuf, errbuf_n, "repeat start must be int"); value_free(&start); return false; }
       Value end = eval_expr(s->expr_b, env);
-      if (end.type != VAL_INT) { snprintf(errbuf, errbuf_n, "repeat end must be int"); value_free(&start); value_free(&end); return false; }
-      for (long i = start.i; i <= end.i; i++) {
-        Value iv = value_int(i);
-        if (!env_define_local(env, s->loop_var.start, s->loop_var.length, &iv, false, errbuf, errbuf_n)) { value_free(&iv); value_free(&start); value_free(&end); return false; }
-        value_free(&iv);
-        if (!exec_block(s->block, env, st, errbuf, errbuf_n)) { value_free(&start); value_free(&end); return false; }
-        if (st->returned) { value_free(&start); value_free(&end); return true; }
-        if (st->broke) { st->broke = false; break; }
-        if (st->cont) { st->cont = false; continue; }
+      if (end.type != VAL_INT) { snprintf(errbuf, errbuf_n, "repeat end must be int"); value_free(&end); return false; }
+      if (start.i > end.i) return true;
+      for (long i = start.i;; i++) {
+        // the frame's items may move while the body runs, so re-index each time
+        bool bound;
+        if (s->ref.slot >= 0) {
+          bound = env_slot_set_int(&env->items[s->ref.slot], i, errbuf, errbuf_n);
+        } else {
+          Value iv = value_int(i);
+          bound = env_define_local(env, s->loop_var.start, &iv, false, errbuf, errbuf_n);
+        }
+        if (!bound) return false;
+        if (!exec_block(s->block, env, st, errbuf, errbuf_n)) return false;
+        if (st->returned) return true;
+        if (st->broke) { st->broke = false; return true; }
+        st->cont = false;
+        // compared before the increment, so an end of LONG_MAX terminates
+        if (i == end.i) return true;
       }
-      value_free(&start); value_free(&end);
-      return true;
     }
     case STMT_DEFINE: {
       Function* fn = (Function*)calloc(1, sizeof(Function));
@@ -391,15 +982,15 @@ static bool exec_stmt(const Stmt* s, Env* env, ExecState* st, char* errbuf, size
       fn->param_count = s->param_count;
       fn->body = s->block;
       fn->closure = env;
-      Value fv = value_func(fn);
-      bool ok = env_define_local(env, s->name.start, s->name.length, &fv, true, errbuf, errbuf_n);
-      value_free(&fv);
-      return ok;
+      fn->layout = &s->frame;
+      fn->param_slots = s->param_slots;
+      return env_bind_function(env, s->ref.slot, s->name.start, fn, errbuf, errbuf_n);
     }
     case STMT_TRY: {
-      char local_err[256] = {0};
+      // a caught failure's message is simply overwritten later
+      errbuf[0] = '\0';
       ExecState inner = *st;
-      if (exec_block(s->block, env, &inner, local_err, sizeof(local_err))) {
+      if (exec_block(s->block, env, &inner, errbuf, errbuf_n)) {
         *st = inner;
         return true;
       }
@@ -409,20 +1000,40 @@ static bool exec_stmt(const Stmt* s, Env* env, ExecState* st, char* errbuf, size
         if (ok) *st = else_state;
         return ok;
       }
-      snprintf(errbuf, errbuf_n, "%s", local_err[0] ? local_err : "error");
+      if (!errbuf[0]) snprintf(errbuf, errbuf_n, "error");
       return false;
     }
     case STMT_RETURN: {
       st->returned = true;
-      if (s->expr) st->ret = eval_expr(s->expr, env);
-      else st->ret = value_null();
+      if (!s->expr) {
+        st->ret = value_null();
+        return true;
+      }
+      if (st->in_call && s->expr->type == EXPR_CALL) {
+        const CallExpr* call = &s->expr->call;
+        Value callee;
+        Value* argv;
+        if (!eval_call_parts(call, env, st->tail_buf, &callee, &argv, &st->ret)) return true;
+        if (tail_call_reusable(&callee, argv, call->arg_count, env)) {
+          // call_function runs it in this frame once the body has unwound
+          st->tail = callee.func;
+          st->tail_args = argv;
+          st->tail_argc = call->arg_count;
+          st->ret = value_null();
+          return true;
+        }
+        st->ret = call_value(&callee, argv, call->arg_count, env);
+        free_args(argv, call->arg_count, st->tail_buf);
+        return true;
+      }
+      st->ret = eval_expr(s->expr, env);
       return true;
     }
     case STMT_BREAK: st->broke = true; return true;
     case STMT_CONTINUE: st->cont = true; return true;
     case STMT_EXPR: {
       Value v = eval_expr(s->expr, env);
-      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.s ? v.s : "error"); value_free(&v); return false; }
+      if (v.type == VAL_ERROR) { snprintf(errbuf, errbuf_n, "%s", v.str ? v.str->data : "error"); value_free(&v); return false; }
       value_free(&v);
       return true;
     }
@@ -441,23 +1052,93 @@ static bool exec_block(const Block* b, Env* env, ExecState* st, char* errbuf, si
   return true;
 }
 
-static Value call_function(const Function* fn, const Value* args, size_t argc, Env* env, char* errbuf, size_t errbuf_n) {
-  if (!fn) return value_error("null function", strlen("null function"));
-  if (argc != fn->param_count) return value_error("arity mismatch", strlen("arity mismatch"));
-  Env* frame = env_push(fn->closure ? fn->closure : env);
-  for (size_t i = 0; i < argc; i++) {
-    if (!env_define_local(frame, fn->params[i].start, fn->params[i].length, &args[i], false, errbuf, errbuf_n)) {
-      env_pop(frame);
-      return value_error(errbuf, strlen(errbuf));
+// Code that keeps giving up is only retried once the calls since outnumber
+// its bail-outs this many times over.
+#define JIT_BAIL_RATIO 16
+
+// > 0 while a call that ran out of depth natively is interpreted: the calls
+// it makes would only run out again, one level further down each time
+static unsigned jit_paused;
+
+// Hot functions run as machine code once jit.c has compiled them (not while
+// profiling or tracing, which need the interpreter's hooks).
+static JitResult jit_call(Function* fn, const Value* args, size_t argc, Value* out) {
+  fn->calls++;
+  if (!fn->jit && (fn->jit_rejected || fn->calls < jit_threshold() || !jit_compile(fn))) return JIT_BAIL;
+  if (fn->jit_bails * JIT_BAIL_RATIO > fn->calls) return JIT_BAIL;
+  JitResult r = jit_run(fn->jit, args, argc, fstack.max_depth - fstack.depth, stack_floor, out);
+  if (r != JIT_OK) fn->jit_bails++;
+  return r;
+}
+
+// Tail calls (`return g(...)`) come back here with g and its arguments, and
+// g runs in the same Env and C frame, so tail recursion needs no stack.
+static Value call_function(Function* fn, const Value* args, size_t argc, Env* env) {
+  char probe;
+  if ((uintptr_t)&probe < stack_floor) return value_error("native stack exhausted", strlen("native stack exhausted"));
+  bool paused = false;
+  if (fn && jit_threshold() && !jit_paused && !prof_enabled && !trace_enabled) {
+    Value jitted;
+    JitResult r = jit_call(fn, args, argc, &jitted);
+    if (r == JIT_OK) return jitted;
+    if (r == JIT_TOO_DEEP) {
+      jit_paused++;
+      paused = true;
     }
   }
-  ExecState st = {0};
-  char local_err[256] = {0};
-  bool ok = exec_block(fn->body, frame, &st, local_err, sizeof(local_err));
-  env_pop(frame);
-  if (!ok) return value_error(local_err[0] ? local_err : "error", strlen(local_err[0] ? local_err : "error"));
-  if (st.returned) return st.ret;
-  return value_null();
+  Env* frame = NULL;
+  Value tail_buf[CALL_INLINE_ARGS];
+  Value* tail_args = NULL;  // arguments of a tail call, owned here
+  Value result = value_null();
+  for (;;) {
+    if (!fn) { result = value_error("null function", strlen("null function")); break; }
+    if (argc != fn->param_count) { result = value_error("arity mismatch", strlen("arity mismatch")); break; }
+    STAT_INC(calls);
+    Env* parent = fn->closure ? fn->closure : env;
+    if (frame) {
+      env_reset_frame(frame, parent, fn->layout);
+    } else if (!(frame = env_push_frame(parent, fn->layout))) {
+      result = value_error(env_push_error(), strlen(env_push_error()));
+      break;
+    }
+    bool bound = true;
+    for (size_t i = 0; bound && i < argc; i++) {
+      bound = fn->param_slots
+        ? env_slot_assign(env_slot(frame, 0, fn->param_slots[i]), &args[i], false, call_err, sizeof(call_err))
+        : env_define_local(frame, fn->params[i].start, &args[i], false, call_err, sizeof(call_err));
+    }
+    if (tail_args) {
+      free_args(tail_args, argc, tail_buf);
+      tail_args = NULL;
+    }
+    if (!bound) { result = value_error(call_err, strlen(call_err)); break; }
+    ExecState st = {0};
+    st.in_call = true;
+    st.tail_buf = tail_buf;
+    call_err[0] = '\0';
+    if (prof_enabled) prof_enter(fn->name.start, fn->name.length);
+    if (trace_enabled) trace_begin(TRACE_CALL, fn->name.start, fn->name.length);
+    bool ok = fn->native ? fn->native(frame, &st, call_err, sizeof(call_err))
+                         : exec_block(fn->body, frame, &st, call_err, sizeof(call_err));
+    if (trace_enabled) trace_end();
+    if (prof_enabled) prof_leave();
+    if (!ok) {
+      result = value_error(call_err[0] ? call_err : "error", strlen(call_err[0] ? call_err : "error"));
+      break;
+    }
+    if (!st.tail) {
+      if (st.returned) result = st.ret;
+      break;
+    }
+    STAT_INC(tail_calls);
+    fn = st.tail;
+    args = tail_args = st.tail_args;
+    argc = st.tail_argc;
+  }
+  if (tail_args) free_args(tail_args, argc, tail_buf);
+  if (frame) env_pop(frame);
+  if (paused) jit_paused--;
+  return result;
 }
 
 // Builtins
@@ -466,17 +1147,174 @@ static Value builtin_ask(const Value* args, size_t count) {
   return rt_ask(&args[0]);
 }
 
-static const Builtin BUILTIN_ASK = {"ask", 1, builtin_ask};
+// has_line() / next_line() read stdin; has_line(path) / next_line(path) a file
+static Value builtin_has_line(const Value* args, size_t count) {
+  if (count > 1) return value_error("has_line expects 0 or 1 args", strlen("has_line expects 0 or 1 args"));
+  return rt_has_line(count ? &args[0] : NULL);
+}
 
-bool run_program(const Program* p, Env* env, char* errbuf, size_t errbuf_n) {
-  // preload builtins
-  Value askv = value_builtin(&BUILTIN_ASK);
-  if (!env_define_local(env, "ask", strlen("ask"), &askv, true, errbuf, errbuf_n)) {
-    value_free(&askv);
-    return false;
+static Value builtin_next_line(const Value* args, size_t count) {
+  if (count > 1) return value_error("next_line expects 0 or 1 args", strlen("next_line expects 0 or 1 args"));
+  return rt_next_line(count ? &args[0] : NULL);
+}
+
+static const Builtin BUILTIN_ASK = {"ask", builtin_ask};
+static const Builtin BUILTIN_HAS_LINE = {"has_line", builtin_has_line};
+static const Builtin BUILTIN_NEXT_LINE = {"next_line", builtin_next_line};
+
+static const Builtin* const BUILTINS[] = {&BUILTIN_ASK, &BUILTIN_HAS_LINE, &BUILTIN_NEXT_LINE};
+
+const char* const BUILTIN_NAMES[] = {"ask", "has_line", "next_line"};
+const size_t BUILTIN_COUNT = sizeof(BUILTINS) / sizeof(BUILTINS[0]);
+
+// List builtins (list.h)
+static Value builtin_list(const Value* args, size_t count) {
+  return list_new(args, count);
+}
+
+static Value builtin_push(const Value* args, size_t count) {
+  if (count != 2) return value_error("push expects 2 args", strlen("push expects 2 args"));
+  return list_push(&args[0], &args[1]);
+}
+
+static Value builtin_item(const Value* args, size_t count) {
+  if (count != 2) return value_error("item expects 2 args", strlen("item expects 2 args"));
+  return list_item(&args[0], &args[1]);
+}
+
+static Value builtin_slice(const Value* args, size_t count) {
+  if (count != 3) return value_error("slice expects 3 args", strlen("slice expects 3 args"));
+  return list_slice(&args[0], &args[1], &args[2]);
+}
+
+// lists count items, strings bytes
+static Value builtin_length(const Value* args, size_t count) {
+  if (count != 1) return value_error("length expects 1 arg", strlen("length expects 1 arg"));
+  if (args[0].type == VAL_LIST) return value_int((long)args[0].list->len);
+  if (args[0].type == VAL_STRING) return value_int((long)value_strlen(&args[0]));
+  return value_error("length expects a list or a string", strlen("length expects a list or a string"));
+}
+
+static Value builtin_sum(const Value* args, size_t count) {
+  if (count != 1) return value_error("sum expects 1 arg", strlen("sum expects 1 arg"));
+  return list_sum(&args[0]);
+}
+
+static Value builtin_min(const Value* args, size_t count) {
+  if (count != 1) return value_error("min expects 1 arg", strlen("min expects 1 arg"));
+  return list_min(&args[0]);
+}
+
+static Value builtin_max(const Value* args, size_t count) {
+  if (count != 1) return value_error("max expects 1 arg", strlen("max expects 1 arg"));
+  return list_max(&args[0]);
+}
+
+static Value builtin_sort(const Value* args, size_t count) {
+  if (count != 1) return value_error("sort expects 1 arg", strlen("sort expects 1 arg"));
+  return list_sort(&args[0]);
+}
+
+static const Builtin BUILTIN_LIST = {"list", builtin_list};
+static const Builtin BUILTIN_PUSH = {"push", builtin_push};
+static const Builtin BUILTIN_ITEM = {"item", builtin_item};
+static const Builtin BUILTIN_SLICE = {"slice", builtin_slice};
+static const Builtin BUILTIN_LENGTH = {"length", builtin_length};
+static const Builtin BUILTIN_SUM = {"sum", builtin_sum};
+static const Builtin BUILTIN_MIN = {"min", builtin_min};
+static const Builtin BUILTIN_MAX = {"max", builtin_max};
+static const Builtin BUILTIN_SORT = {"sort", builtin_sort};
+
+// Names like `sum` and `length` are common variables, so these are not
+// bound anywhere: env_get falls back to them for names nothing binds, and a
+// program's own binding of the same name always wins.
+static const Builtin* const FALLBACK_BUILTINS[] = {
+  &BUILTIN_LIST, &BUILTIN_PUSH, &BUILTIN_ITEM, &BUILTIN_SLICE, &BUILTIN_LENGTH,
+  &BUILTIN_SUM, &BUILTIN_MIN, &BUILTIN_MAX, &BUILTIN_SORT
+};
+#define FALLBACK_COUNT (sizeof(FALLBACK_BUILTINS) / sizeof(FALLBACK_BUILTINS[0]))
+static const char* fallback_names[FALLBACK_COUNT]; // interned by define_builtins
+
+static const Builtin* fallback_builtin(const char* name) {
+  for (size_t i = 0; i < FALLBACK_COUNT; i++) {
+    if (fallback_names[i] == name) return FALLBACK_BUILTINS[i];
   }
-  value_free(&askv);
+  return NULL;
+}
 
+bool define_builtins(Env* env, char* errbuf, size_t errbuf_n) {
+  for (size_t i = 0; i < FALLBACK_COUNT; i++) {
+    fallback_names[i] = intern(FALLBACK_BUILTINS[i]->name, strlen(FALLBACK_BUILTINS[i]->name));
+    if (!fallback_names[i]) { snprintf(errbuf, errbuf_n, "out of memory"); return false; }
+  }
+  for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+    const char* name = intern(BUILTINS[i]->name, strlen(BUILTINS[i]->name));
+    if (!name) { snprintf(errbuf, errbuf_n, "out of memory"); return false; }
+    Value bv = value_builtin(BUILTINS[i]);
+    bool ok = env_define_local(env, name, &bv, true, errbuf, errbuf_n);
+    value_free(&bv);
+    if (!ok) return false;
+  }
+  return true;
+}
+
+// the top level of a parsed program, or of one compiled by --emit-c
+typedef struct Run {
+  const Program* program;
+  NativeBody native;
+  Env* env;
+  char* errbuf;
+  size_t errbuf_n;
+  bool ok;
+} Run;
+
+static void* run_thread(void* arg) {
+  Run* r = (Run*)arg;
   ExecState st = {0};
-  return exec_block(&p->block, env, &st, errbuf, errbuf_n);
+  r->ok = r->native ? r->native(r->env, &st, r->errbuf, r->errbuf_n)
+                    : exec_block(&r->program->block, r->env, &st, r->errbuf, r->errbuf_n);
+  return NULL;
+}
+
+static bool run_top_level(Run* r, const FrameLayout* globals) {
+  Env* env = r->env;
+  char* errbuf = r->errbuf;
+  size_t errbuf_n = r->errbuf_n;
+  env_bind_layout(env, globals);
+  if (!define_builtins(env, errbuf, errbuf_n)) return false;
+
+  // pages are only committed as deep recursion touches them
+  size_t size = NATIVE_STACK_BASE + max_depth() * NATIVE_STACK_PER_CALL;
+  void* stack = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stack == MAP_FAILED) {
+    snprintf(errbuf, errbuf_n, "could not reserve %zu bytes of stack for --max-depth %zu", size, max_depth());
+    return false;
+  }
+  mprotect(stack, 4096, PROT_NONE);
+  stack_floor = (uintptr_t)stack + NATIVE_STACK_RESERVE;
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  bool started = pthread_attr_init(&attr) == 0;
+  if (started) {
+    started = pthread_attr_setstack(&attr, stack, size) == 0 && pthread_create(&thread, &attr, run_thread, r) == 0;
+    pthread_attr_destroy(&attr);
+  }
+  if (started) pthread_join(thread, NULL);
+  else snprintf(errbuf, errbuf_n, "could not start the interpreter thread");
+  munmap(stack, size);
+  stack_floor = 0;
+  frames_release();
+  jit_release();
+  return started && r->ok;
+}
+
+bool run_program(const Program* p, Env* env, char* errbuf, size_t errbuf_n) {
+  Run r = {p, NULL, env, errbuf, errbuf_n, false};
+  return run_top_level(&r, &p->globals);
+}
+
+bool run_native(NativeBody top, const FrameLayout* globals, Env* env, char* errbuf, size_t errbuf_n) {
+  Run r = {NULL, top, env, errbuf, errbuf_n, false};
+  return run_top_level(&r, globals);
 }
@@ -1,42 +1,158 @@
 #pragma once
 #include "parser.h"
+#include "stats.h"
 
+// Binding names are interned (intern.h) and compared by pointer.
 typedef struct Binding {
-  char* name;
+  const char* name;
   Value value;
   bool is_lock;
+  bool is_set;       // resolver slots exist before their first assignment
+  bool owns_func;    // made by `define`: the Function is freed with the binding
 } Binding;
 
+#define ENV_INLINE_BINDINGS 4
+// by-name lookups scan smaller frames and hash into larger ones
+#define ENV_INDEX_MIN 16
+
+// items[0, layout count) are resolver slots; by-name definitions of names
+// without a slot are appended after them. Frames with few bindings keep them
+// in inline_items, so an Env must not be moved once initialised.
 typedef struct Env {
   Binding* items;
   size_t count;
   size_t cap;
   struct Env* parent;
+  int* index;        // open addressing over items; -1 is empty
+  size_t index_cap;
+  size_t indexed;    // items[0, indexed) are in the index
+  Binding inline_items[ENV_INLINE_BINDINGS];
 } Env;
 
+// Control flow leaving a statement list: `return` (with a tail call when
+// `tail` is set), `break` and `continue`.
+typedef struct ExecState {
+  bool returned;
+  bool broke;
+  bool cont;
+  bool in_call;          // running a function body, where `return f(...)` is a tail call
+  Value ret;
+  struct Function* tail; // set with returned: call tail(tail_args) in place of this frame
+  Value* tail_args;
+  size_t tail_argc;
+  Value* tail_buf;       // call_function's inline argument buffer
+} ExecState;
+
+// Arguments of calls with at most this many go in a caller-provided buffer
+// instead of the heap.
+#define CALL_INLINE_ARGS 4
+
+// A body compiled to C by --emit-c (emit_c.h). It runs its statements in
+// `env` like exec_block would and returns false with a message in errbuf
+// when one fails.
+typedef bool (*NativeBody)(Env* env, ExecState* st, char* errbuf, size_t errbuf_n);
+
+struct FnProto;
+
 typedef struct Function {
   Token name;
   Token* params;
   size_t param_count;
   Block* body;
   Env* closure;
+  const FrameLayout* layout;    // frame slots; parameters bind to param_slots
+  const int* param_slots;
+  const struct FnProto* proto;  // set for functions created by the VM
+  NativeBody native;            // set for functions compiled by --emit-c; body is NULL
+  size_t calls;                 // tree-walker calls while the JIT is on (jit.h)
+  size_t jit_bails;             // of those, run natively but given up on
+  struct JitCode* jit;
+  bool jit_rejected;            // outside the JIT's subset
 } Function;
 
 typedef struct Builtin {
   const char* name;
-  size_t arity;
-  Value (*fn)(const Value* args, size_t count);
+  Value (*fn)(const Value* args, size_t count);  // checks its own arg count
 } Builtin;
 
+#define MAX_DEPTH_DEFAULT 10000
+
+// Astralis call depth allowed by both engines (--max-depth)
+void set_max_depth(size_t depth);
+size_t max_depth(void);
+
 void env_init(Env* e);
 void env_free(Env* e);
-Env* env_push(Env* parent);
+// a function frame from the shared frame stack; NULL past the depth limit
+// or out of memory, with the reason in env_push_error()
+Env* env_push_frame(Env* parent, const FrameLayout* layout);
+const char* env_push_error(void);
 void env_pop(Env* env);
+// free the frame stack's Envs and the argument stack once a run is over
+void frames_release(void);
+// Room for the arguments of a call wider than CALL_INLINE_ARGS, on a stack
+// that never moves; NULL when out of memory. Release in reverse order.
+Value* call_args_alloc(size_t n);
+void call_args_release(Value* argv, size_t n);
+// release a frame's bindings and lay it out again for another call
+void env_reset_frame(Env* e, Env* parent, const FrameLayout* layout);
+// A tail call may run in the caller's frame unless the callee is a function
+// defined in that frame, or an argument is or holds one at any depth, since
+// such a function dies with the frame's bindings.
+bool tail_call_reusable(const Value* callee, const Value* args, size_t argc, const Env* frame);
+// give an empty Env (the globals) its resolver slots
+void env_bind_layout(Env* e, const FrameLayout* layout);
+
+// by-name access; names must be interned
+Value env_get(const Env* e, const char* name);
+bool env_set(Env* e, const char* name, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n);
+bool env_define_local(Env* e, const char* name, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n);
+
+static inline Binding* env_slot(Env* e, unsigned depth, int slot) {
+  STAT_INC(slot_refs);
+  STAT_ADD(slot_depth, depth);
+  while (depth--) e = e->parent;
+  return &e->items[slot];
+}
 
-Value env_get(const Env* e, const char* name, size_t n);
-bool env_set(Env* e, const char* name, size_t n, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n);
-bool env_define_local(Env* e, const char* name, size_t n, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n);
+// `define`: bind fn locked into `slot` (or by name when slot < 0); the
+// binding owns fn from then on. On failure fn is freed.
+bool env_bind_function(Env* e, int slot, const char* name, Function* fn, char* errbuf, size_t errbuf_n);
+// define_local semantics on a resolved slot: fill it, or overwrite unless locked
+bool env_slot_assign(Binding* b, const Value* v, bool is_lock, char* errbuf, size_t errbuf_n);
+// `repeat`'s counter: overwrite an unlocked int in place, otherwise assign
+// the slot like any other value
+static inline bool env_slot_set_int(Binding* b, long i, char* errbuf, size_t errbuf_n) {
+  if (b->is_set && !b->is_lock && b->value.type == VAL_INT) {
+    b->value.i = i;
+    return true;
+  }
+  Value v = value_int(i);
+  return env_slot_assign(b, &v, false, errbuf, errbuf_n);
+}
+// `set x to x + a + b ...` fast path: when `left` is the string `b` holds and
+// nobody else references it, append the pieces in place and consume `left`.
+// Returns false with nothing changed when the slot has to be assigned normally.
+bool env_slot_append(Binding* b, Value* left, const Value* pieces, size_t n);
 
 Value eval_expr(const Expr* e, Env* env);
+// call a function or builtin value; consumes callee, the arguments stay with
+// the caller
+Value call_value(Value* callee, Value* argv, size_t argc, Env* env);
+
+// --quick-stats: how often the tree-walker's quickened binary nodes took
+// their int path in this run
+void quick_stats_print(const Program* p, FILE* f);
+
+// operator semantics shared by the tree-walker and the VM
+Value eval_binary_op(BinOp op, const Value* l, const Value* r);
+Value eval_unary_op(UnOp op, const Value* v);
+
+// bind `ask` and the other builtins into the global environment
+bool define_builtins(Env* env, char* errbuf, size_t errbuf_n);
+extern const char* const BUILTIN_NAMES[];
+extern const size_t BUILTIN_COUNT;
 
 bool run_program(const Program* p, Env* env, char* errbuf, size_t errbuf_n);
+// run a top level compiled by --emit-c, whose globals are laid out as `globals`
+bool run_native(NativeBody top, const FrameLayout* globals, Env* env, char* errbuf, size_t errbuf_n);
@@ -0,0 +1,630 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "stats.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned threshold = JIT_THRESHOLD_DEFAULT;
+
+void set_jit_threshold(unsigned calls) {
+  threshold = calls;
+}
+
+unsigned jit_threshold(void) {
+  return threshold;
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+
+// definite assignment is tracked in one 64-bit mask per frame
+#define JIT_MAX_SLOTS 64
+#define JIT_MAX_PARAMS 16
+// operands an expression may hold on the native stack at once
+#define JIT_MAX_NESTING 256
+
+typedef int (*JitEntry)(const long* args, long* out);
+
+// Generated functions are called as entry(args, &result), where
+// args[argc - 1 - i] is parameter i (callers push them in order). They
+// return a JitResult, with the result in *out for JIT_OK.
+struct JitCode {
+  JitEntry entry;      // generated calls go through this cell, so callers can
+                       // be compiled before it is filled in
+  size_t argc;
+  uint8_t* text;       // machine code until the compile is done
+  size_t len;
+  void* mem;           // the executable mapping after that
+  size_t mem_size;
+  struct JitCode* next;
+};
+
+static JitCode* all_code;
+// call depth left and the native stack floor of the run in progress,
+// checked by every generated prologue
+static long jit_depth;
+static uintptr_t jit_floor;
+
+// One jit_compile: the root function and the callees compiled for it become
+// executable together or not at all.
+typedef struct Session {
+  Function** fns;
+  size_t count;
+  size_t cap;
+} Session;
+
+typedef enum JitType {
+  T_NONE = 0,        // outside the subset
+  T_INT,
+  T_BOOL             // 0 or 1 in rax
+} JitType;
+
+// condition codes for jcc/setcc; JMP is an unconditional jump
+enum { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF, JMP = -1 };
+
+// Jumps to a label not placed yet are chained through their own rel32
+// fields: a chain is the offset of its latest jump + 1, or 0 when empty.
+typedef struct Loop {
+  size_t breaks;
+  size_t conts;
+  struct Loop* outer;
+} Loop;
+
+// Native frame: slot i of the Astralis frame is the qword at rbp - 8 * (i + 1),
+// followed by the saved `out` pointer, the callee result and repeat counters.
+typedef struct Gen {
+  Session* ses;
+  Function* fn;
+  uint8_t* text;
+  size_t len;
+  size_t cap;
+  bool ok;
+  size_t slots;
+  size_t out_slot;
+  size_t result_slot;
+  size_t bails;        // chain to the JIT_BAIL exit
+  size_t too_deep;     // chain to the JIT_TOO_DEEP exit
+  size_t exits;        // chain to the exit, with the JitResult in eax
+  size_t body;         // where self tail calls jump back to
+  unsigned nesting;
+  Loop* loop;
+} Gen;
+
+static void emit(Gen* g, const uint8_t* bytes, size_t n) {
+  if (g->len + n > g->cap) {
+    size_t nc = g->cap ? g->cap * 2 : 256;
+    while (nc < g->len + n) nc *= 2;
+    uint8_t* grown = (uint8_t*)realloc(g->text, nc);
+    if (!grown) { g->ok = false; return; }
+    g->text = grown;
+    g->cap = nc;
+  }
+  memcpy(g->text + g->len, bytes, n);
+  g->len += n;
+}
+
+#define EMIT(g, ...) emit(g, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit32(Gen* g, int32_t v) {
+  emit(g, (const uint8_t*)&v, 4);
+}
+
+// mov rax/rcx (reg 0/1), imm64
+static void emit_imm(Gen* g, uint8_t reg, uint64_t v) {
+  EMIT(g, 0x48, (uint8_t)(0xB8 | reg));
+  emit(g, (const uint8_t*)&v, 8);
+}
+
+// REX.W `op` with a [rbp + disp32] operand for frame slot `slot`
+static void emit_slot(Gen* g, uint8_t op, uint8_t modrm, size_t slot) {
+  EMIT(g, 0x48, op, modrm);
+  emit32(g, -8 * (int32_t)(slot + 1));
+}
+
+static void load(Gen* g, size_t slot) {
+  emit_slot(g, 0x8B, 0x85, slot);  // mov rax, [slot]
+}
+
+static void store(Gen* g, size_t slot) {
+  emit_slot(g, 0x89, 0x85, slot);  // mov [slot], rax
+}
+
+static void push(Gen* g) {
+  EMIT(g, 0x50);  // push rax
+  if (++g->nesting > JIT_MAX_NESTING) g->ok = false;
+}
+
+static void emit_op(Gen* g, int cc) {
+  if (cc == JMP) EMIT(g, 0xE9);
+  else EMIT(g, 0x0F, (uint8_t)(0x80 | cc));
+}
+
+static void emit_jump(Gen* g, int cc, size_t* chain) {
+  emit_op(g, cc);
+  size_t at = g->len;
+  emit32(g, (int32_t)*chain);
+  *chain = at + 1;
+}
+
+static void emit_jump_to(Gen* g, int cc, size_t target) {
+  emit_op(g, cc);
+  emit32(g, (int32_t)((long)target - (long)(g->len + 4)));
+}
+
+static void bind_chain(Gen* g, size_t chain, size_t target) {
+  while (chain && g->ok) {
+    size_t at = chain - 1;
+    int32_t next;
+    memcpy(&next, g->text + at, 4);
+    int32_t rel = (int32_t)((long)target - (long)(at + 4));
+    memcpy(g->text + at, &rel, 4);
+    chain = (size_t)next;
+  }
+}
+
+// 0/1 for a value's truthiness; bools already are
+static void emit_truthy(Gen* g, JitType t) {
+  if (t == T_INT) EMIT(g, 0x48, 0x85, 0xC0, 0x0F, 0x95, 0xC0, 0x0F, 0xB6, 0xC0);  // test rax, rax; setne al; movzx eax, al
+}
+
+static bool compile_function(Session* ses, Function* fn);
+
+// Only top-level functions are compiled, so a global is one frame out. Its
+// binding has to be locked to be read at compile time.
+static const Binding* global_binding(const Gen* g, VarRef ref) {
+  const Env* globals = g->fn->closure;
+  if (ref.slot < 0 || ref.depth != 1 || (size_t)ref.slot >= globals->count) return NULL;
+  const Binding* b = &globals->items[ref.slot];
+  return b->is_set && b->is_lock ? b : NULL;
+}
+
+static Function* global_function(const Gen* g, const Expr* callee, size_t argc) {
+  if (callee->type != EXPR_IDENT) return NULL;
+  const Binding* b = global_binding(g, callee->ref);
+  if (!b || b->value.type != VAL_FUNC || b->value.func->param_count != argc) return NULL;
+  return b->value.func;
+}
+
+static JitType gen_expr(Gen* g, const Expr* e, uint64_t assigned);
+
+// push every argument, in order; all of them must be ints
+static bool gen_args(Gen* g, const CallExpr* call, uint64_t assigned) {
+  for (size_t i = 0; i < call->arg_count; i++) {
+    if (gen_expr(g, call->args[i], assigned) != T_INT) return false;
+    push(g);
+  }
+  return true;
+}
+
+static JitType gen_call(Gen* g, const CallExpr* call, uint64_t assigned) {
+  Function* callee = global_function(g, call->callee, call->arg_count);
+  if (!callee || !compile_function(g->ses, callee) || !gen_args(g, call, assigned)) return T_NONE;
+  EMIT(g, 0x48, 0x89, 0xE7);                        // mov rdi, rsp
+  emit_slot(g, 0x8D, 0xB5, g->result_slot);          // lea rsi, [result]
+  emit_imm(g, 0, (uint64_t)(uintptr_t)&callee->jit->entry);
+  EMIT(g, 0xFF, 0x10);                               // call [rax]
+  if (call->arg_count) {
+    EMIT(g, 0x48, 0x81, 0xC4);                       // add rsp, 8 * argc
+    emit32(g, (int32_t)(8 * call->arg_count));
+    g->nesting -= (unsigned)call->arg_count;
+  }
+  EMIT(g, 0x85, 0xC0);                               // test eax, eax
+  emit_jump(g, CC_NE, &g->exits);                    // with the callee's JitResult
+  load(g, g->result_slot);
+  return T_INT;
+}
+
+// EXPR_LOGICAL skips the right operand once the left one decides; the eager
+// BIN_AND/BIN_OR of --no-opt evaluate both
+static JitType gen_logic(Gen* g, const Expr* e, uint64_t assigned) {
+  JitType l = gen_expr(g, e->left, assigned);
+  if (!l) return T_NONE;
+  emit_truthy(g, l);
+  size_t decided = 0;
+  if (e->type == EXPR_LOGICAL) {
+    EMIT(g, 0x85, 0xC0);  // test eax, eax
+    emit_jump(g, e->op == BIN_OR ? CC_NE : CC_E, &decided);
+  }
+  push(g);
+  JitType r = gen_expr(g, e->right, assigned);
+  if (!r) return T_NONE;
+  emit_truthy(g, r);
+  EMIT(g, 0x59);  // pop rcx
+  g->nesting--;
+  if (e->op == BIN_AND) EMIT(g, 0x21, 0xC8);  // and eax, ecx
+  else EMIT(g, 0x09, 0xC8);                   // or eax, ecx
+  bind_chain(g, decided, g->len);
+  return T_BOOL;
+}
+
+// left operand in rax, right in rcx
+static JitType gen_binop(Gen* g, BinOp op, JitType l, JitType r) {
+  if (op == BIN_EQ || op == BIN_NEQ) {
+    if (l != r) return T_NONE;
+  } else if (l != T_INT || r != T_INT) {
+    return T_NONE;
+  }
+  int cc;
+  switch (op) {
+    case BIN_ADD: EMIT(g, 0x48, 0x01, 0xC8); return T_INT;        // add rax, rcx
+    case BIN_SUB: EMIT(g, 0x48, 0x29, 0xC8); return T_INT;        // sub rax, rcx
+    case BIN_MUL: EMIT(g, 0x48, 0x0F, 0xAF, 0xC1); return T_INT;  // imul rax, rcx
+    case BIN_DIV: {
+      // division by zero is an Astralis error, which the interpreter reports
+      EMIT(g, 0x48, 0x85, 0xC9);  // test rcx, rcx
+      emit_jump(g, CC_E, &g->bails);
+      // x / -1 is a negation; idiv would trap on LONG_MIN
+      EMIT(g, 0x48, 0x83, 0xF9, 0xFF);  // cmp rcx, -1
+      size_t divide = 0, done = 0;
+      emit_jump(g, CC_NE, &divide);
+      EMIT(g, 0x48, 0xF7, 0xD8);  // neg rax
+      emit_jump(g, JMP, &done);
+      bind_chain(g, divide, g->len);
+      EMIT(g, 0x48, 0x99, 0x48, 0xF7, 0xF9);  // cqo; idiv rcx
+      bind_chain(g, done, g->len);
+      return T_INT;
+    }
+    case BIN_EQ: cc = CC_E; break;
+    case BIN_NEQ: cc = CC_NE; break;
+    case BIN_LT: cc = CC_L; break;
+    case BIN_LTE: cc = CC_LE; break;
+    case BIN_GT: cc = CC_G; break;
+    case BIN_GTE: cc = CC_GE; break;
+    default: return T_NONE;
+  }
+  EMIT(g, 0x48, 0x39, 0xC8);  // cmp rax, rcx
+  EMIT(g, 0x0F, (uint8_t)(0x90 | cc), 0xC0, 0x0F, 0xB6, 0xC0);  // setcc al; movzx eax, al
+  return T_BOOL;
+}
+
+static JitType gen_expr(Gen* g, const Expr* e, uint64_t assigned) {
+  if (!e || !g->ok) return T_NONE;
+  switch (e->type) {
+    case EXPR_LITERAL:
+      if (e->lit.type == VAL_INT) { emit_imm(g, 0, (uint64_t)e->lit.i); return T_INT; }
+      if (e->lit.type == VAL_BOOL) { emit_imm(g, 0, e->lit.b ? 1 : 0); return T_BOOL; }
+      return T_NONE;
+    case EXPR_IDENT: {
+      if (e->ref.slot >= 0 && e->ref.depth == 0) {
+        if (!(assigned >> e->ref.slot & 1)) return T_NONE;
+        load(g, (size_t)e->ref.slot);
+        return T_INT;
+      }
+      const Binding* b = global_binding(g, e->ref);
+      if (!b || b->value.type != VAL_INT) return T_NONE;
+      emit_imm(g, 0, (uint64_t)b->value.i);
+      return T_INT;
+    }
+    case EXPR_GROUP:
+      return gen_expr(g, e->left, assigned);
+    case EXPR_UNARY: {
+      JitType t = gen_expr(g, e->left, assigned);
+      if (e->unop == UN_NEGATE) {
+        if (t != T_INT) return T_NONE;
+        EMIT(g, 0x48, 0xF7, 0xD8);  // neg rax
+        return T_INT;
+      }
+      if (!t) return T_NONE;
+      emit_truthy(g, t);
+      EMIT(g, 0x83, 0xF0, 0x01);  // xor eax, 1
+      return T_BOOL;
+    }
+    case EXPR_LOGICAL:
+      return gen_logic(g, e, assigned);
+    case EXPR_BINARY: {
+      if (e->op == BIN_AND || e->op == BIN_OR) return gen_logic(g, e, assigned);
+      JitType l = gen_expr(g, e->left, assigned);
+      if (!l) return T_NONE;
+      push(g);
+      JitType r = gen_expr(g, e->right, assigned);
+      if (!r) return T_NONE;
+      EMIT(g, 0x48, 0x89, 0xC1, 0x58);  // mov rcx, rax; pop rax
+      g->nesting--;
+      return gen_binop(g, e->op, l, r);
+    }
+    case EXPR_CONDITIONAL: {
+      if (!gen_expr(g, e->cond, assigned)) return T_NONE;
+      EMIT(g, 0x48, 0x85, 0xC0);  // test rax, rax
+      size_t other = 0, done = 0;
+      emit_jump(g, CC_E, &other);
+      JitType a = gen_expr(g, e->left, assigned);
+      emit_jump(g, JMP, &done);
+      bind_chain(g, other, g->len);
+      JitType b = gen_expr(g, e->right, assigned);
+      bind_chain(g, done, g->len);
+      return a == b ? a : T_NONE;
+    }
+    case EXPR_CALL:
+      return gen_call(g, &e->call, assigned);
+  }
+  return T_NONE;
+}
+
+static bool gen_block(Gen* g, const Block* b, uint64_t* assigned);
+
+// `return f(...)` to the function itself rebinds the parameters and jumps
+// back, like the interpreter's tail call, so it needs no native stack
+static bool gen_self_tail_call(Gen* g, const CallExpr* call, uint64_t assigned) {
+  if (!gen_args(g, call, assigned)) return false;
+  for (size_t i = call->arg_count; i-- > 0;) {
+    EMIT(g, 0x58);  // pop rax
+    store(g, (size_t)g->fn->param_slots[i]);
+  }
+  g->nesting -= (unsigned)call->arg_count;
+  emit_jump_to(g, JMP, g->body);
+  return true;
+}
+
+static bool gen_return(Gen* g, const Stmt* s, uint64_t assigned) {
+  if (!s->expr) return false;  // null
+  if (s->expr->type == EXPR_CALL &&
+      global_function(g, s->expr->call.callee, s->expr->call.arg_count) == g->fn) {
+    return gen_self_tail_call(g, &s->expr->call, assigned);
+  }
+  if (gen_expr(g, s->expr, assigned) != T_INT) return false;
+  emit_slot(g, 0x8B, 0x8D, g->out_slot);  // mov rcx, [out]
+  EMIT(g, 0x48, 0x89, 0x01, 0x31, 0xC0);   // mov [rcx], rax; xor eax, eax
+  emit_jump(g, JMP, &g->exits);
+  return true;
+}
+
+// The counter and bound live in hidden slots and are compared before the
+// increment, as in the interpreter, so an end of LONG_MAX terminates.
+static bool gen_repeat(Gen* g, const Stmt* s, uint64_t assigned) {
+  if (s->ref.slot < 0) return false;
+  size_t counter = g->slots++, end = g->slots++;
+  if (gen_expr(g, s->expr, assigned) != T_INT) return false;
+  store(g, counter);
+  if (gen_expr(g, s->expr_b, assigned) != T_INT) return false;
+  store(g, end);
+  Loop loop = {0, 0, g->loop};
+  load(g, counter);
+  emit_slot(g, 0x3B, 0x85, end);  // cmp rax, [end]
+  emit_jump(g, CC_G, &loop.breaks);
+  size_t top = g->len;
+  load(g, counter);
+  store(g, (size_t)s->ref.slot);
+  uint64_t inner = assigned | (uint64_t)1 << s->ref.slot;
+  g->loop = &loop;
+  bool ok = gen_block(g, s->block, &inner);
+  g->loop = loop.outer;
+  bind_chain(g, loop.conts, g->len);
+  load(g, counter);
+  emit_slot(g, 0x3B, 0x85, end);
+  emit_jump(g, CC_E, &loop.breaks);
+  emit_slot(g, 0xFF, 0x85, counter);  // inc qword [counter]
+  emit_jump_to(g, JMP, top);
+  bind_chain(g, loop.breaks, g->len);
+  return ok;
+}
+
+// Locals are ints that are definitely assigned where they are read:
+// `assigned` has a bit per slot, and branches keep what both sides assign.
+static bool gen_stmt(Gen* g, const Stmt* s, uint64_t* assigned) {
+  switch (s->type) {
+    case STMT_SET:
+      // an unset shadowed slot assigns the enclosing binding instead
+      if (s->ref.slot < 0 || s->ref.shadowed || gen_expr(g, s->expr, *assigned) != T_INT) return false;
+      store(g, (size_t)s->ref.slot);
+      *assigned |= (uint64_t)1 << s->ref.slot;
+      return true;
+    case STMT_EXPR:
+      return gen_expr(g, s->expr, *assigned) != T_NONE;
+    case STMT_IF: {
+      if (!gen_expr(g, s->expr, *assigned)) return false;
+      EMIT(g, 0x48, 0x85, 0xC0);  // test rax, rax
+      size_t other = 0, done = 0;
+      emit_jump(g, CC_E, &other);
+      uint64_t then = *assigned, otherwise = *assigned;
+      bool ok = gen_block(g, s->block, &then);
+      emit_jump(g, JMP, &done);
+      bind_chain(g, other, g->len);
+      ok = ok && gen_block(g, s->else_block, &otherwise);
+      bind_chain(g, done, g->len);
+      *assigned = then & otherwise;
+      return ok;
+    }
+    case STMT_LOOP_FOREVER: {
+      Loop loop = {0, 0, g->loop};
+      size_t top = g->len;
+      uint64_t inner = *assigned;
+      g->loop = &loop;
+      bool ok = gen_block(g, s->block, &inner);
+      g->loop = loop.outer;
+      emit_jump_to(g, JMP, top);
+      bind_chain(g, loop.conts, top);
+      bind_chain(g, loop.breaks, g->len);
+      return ok;
+    }
+    case STMT_REPEAT:
+      return gen_repeat(g, s, *assigned);
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+      if (!g->loop) return false;
+      emit_jump(g, JMP, s->type == STMT_BREAK ? &g->loop->breaks : &g->loop->conts);
+      return true;
+    case STMT_RETURN:
+      return gen_return(g, s, *assigned);
+    default:
+      return false;
+  }
+}
+
+static bool gen_block(Gen* g, const Block* b, uint64_t* assigned) {
+  if (!b) return true;
+  for (size_t i = 0; i < b->count; i++) {
+    if (!gen_stmt(g, &b->stmts[i], assigned) || !g->ok) return false;
+  }
+  return true;
+}
+
+static bool session_add(Session* ses, Function* fn) {
+  if (ses->count == ses->cap) {
+    size_t nc = ses->cap ? ses->cap * 2 : 8;
+    Function** grown = (Function**)realloc(ses->fns, nc * sizeof(Function*));
+    if (!grown) return false;
+    ses->fns = grown;
+    ses->cap = nc;
+  }
+  ses->fns[ses->count++] = fn;
+  return true;
+}
+
+// Compile fn unless it already has code, possibly still being generated
+// further up this session (recursion).
+static bool compile_function(Session* ses, Function* fn) {
+  if (fn->jit) return true;
+  if (fn->jit_rejected) return false;
+  if (!fn->body || fn->proto || (fn->param_count && !fn->param_slots) || !fn->layout || fn->layout->count > JIT_MAX_SLOTS ||
+      fn->param_count > JIT_MAX_PARAMS || !fn->closure || fn->closure->parent) {
+    fn->jit_rejected = true;
+    return false;
+  }
+  JitCode* code = (JitCode*)calloc(1, sizeof(JitCode));
+  if (!code || !session_add(ses, fn)) {
+    free(code);
+    return false;
+  }
+  code->argc = fn->param_count;
+  fn->jit = code;
+
+  Gen g;
+  memset(&g, 0, sizeof(g));
+  g.ses = ses;
+  g.fn = fn;
+  g.ok = true;
+  g.out_slot = fn->layout->count;
+  g.result_slot = g.out_slot + 1;
+  g.slots = g.out_slot + 2;
+  EMIT(&g, 0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC);  // push rbp; mov rbp, rsp; sub rsp, frame
+  size_t frame_at = g.len;
+  emit32(&g, 0);
+  emit_imm(&g, 0, (uint64_t)(uintptr_t)&jit_depth);
+  EMIT(&g, 0x48, 0xFF, 0x08);  // dec qword [rax]
+  emit_jump(&g, CC_S, &g.too_deep);
+  emit_imm(&g, 0, (uint64_t)(uintptr_t)&jit_floor);
+  EMIT(&g, 0x48, 0x3B, 0x20);  // cmp rsp, [rax]
+  emit_jump(&g, CC_B, &g.too_deep);
+  emit_slot(&g, 0x89, 0xB5, g.out_slot);  // mov [out], rsi
+  uint64_t assigned = 0;
+  for (size_t i = 0; i < fn->param_count; i++) {
+    EMIT(&g, 0x48, 0x8B, 0x87);  // mov rax, [rdi + 8 * (argc - 1 - i)]
+    emit32(&g, (int32_t)(8 * (fn->param_count - 1 - i)));
+    store(&g, (size_t)fn->param_slots[i]);
+    assigned |= (uint64_t)1 << fn->param_slots[i];
+  }
+  g.body = g.len;
+  bool ok = gen_block(&g, fn->body, &assigned);
+  // falling off the end returns null, which only the interpreter can
+  bind_chain(&g, g.bails, g.len);
+  EMIT(&g, 0xB8, JIT_BAIL, 0x00, 0x00, 0x00);  // mov eax, JIT_BAIL
+  emit_jump(&g, JMP, &g.exits);
+  bind_chain(&g, g.too_deep, g.len);
+  EMIT(&g, 0xB8, JIT_TOO_DEEP, 0x00, 0x00, 0x00);
+  bind_chain(&g, g.exits, g.len);
+  emit_imm(&g, 1, (uint64_t)(uintptr_t)&jit_depth);
+  EMIT(&g, 0x48, 0xFF, 0x01, 0xC9, 0xC3);  // inc qword [rcx]; leave; ret
+  if (!ok || !g.ok) {
+    free(g.text);
+    fn->jit_rejected = true;
+    return false;
+  }
+  int32_t frame = (int32_t)(8 * g.slots);
+  memcpy(g.text + frame_at, &frame, 4);
+  code->text = g.text;
+  code->len = g.len;
+  return true;
+}
+
+// W^X: the code is written into a fresh mapping, which is then made
+// executable and never written again
+static bool make_executable(JitCode* c) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (c->len + page - 1) / page * page;
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return false;
+  memcpy(mem, c->text, c->len);
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return false;
+  }
+  c->mem = mem;
+  c->mem_size = size;
+  return true;
+}
+
+bool jit_compile(Function* fn) {
+  Session ses = {NULL, 0, 0};
+  bool ok = compile_function(&ses, fn);
+  for (size_t i = 0; ok && i < ses.count; i++) ok = make_executable(ses.fns[i]->jit);
+  for (size_t i = 0; i < ses.count; i++) {
+    JitCode* c = ses.fns[i]->jit;
+    free(c->text);
+    c->text = NULL;
+    if (ok) {
+      // an object pointer cannot be cast to a function pointer in ISO C
+      memcpy(&c->entry, &c->mem, sizeof(c->entry));
+      c->next = all_code;
+      all_code = c;
+      continue;
+    }
+    if (c->mem) munmap(c->mem, c->mem_size);
+    free(c);
+    ses.fns[i]->jit = NULL;
+  }
+  free(ses.fns);
+  if (!ok) {
+    fn->jit_rejected = true;
+    return false;
+  }
+  STAT_ADD(jit_compiled, ses.count);
+  return true;
+}
+
+JitResult jit_run(const JitCode* code, const Value* args, size_t argc, size_t depth, uintptr_t stack_floor, Value* out) {
+  long argv[JIT_MAX_PARAMS];
+  if (argc != code->argc) return JIT_BAIL;
+  for (size_t i = 0; i < argc; i++) {
+    if (args[i].type != VAL_INT) return JIT_BAIL;
+    argv[argc - 1 - i] = args[i].i;
+  }
+  jit_depth = depth > LONG_MAX ? LONG_MAX : (long)depth;
+  jit_floor = stack_floor;
+  long result;
+  JitResult r = (JitResult)code->entry(argv, &result);
+  if (r != JIT_OK) {
+    STAT_INC(jit_bails);
+    return r;
+  }
+  STAT_INC(jit_runs);
+  *out = value_int(result);
+  return JIT_OK;
+}
+
+void jit_release(void) {
+  while (all_code) {
+    JitCode* c = all_code;
+    all_code = c->next;
+    munmap(c->mem, c->mem_size);
+    free(c);
+  }
+}
+
+#else
+
+bool jit_compile(Function* fn) {
+  fn->jit_rejected = true;
+  return false;
+}
+
+JitResult jit_run(const JitCode* code, const Value* args, size_t argc, size_t depth, uintptr_t stack_floor, Value* out) {
+  (void)code; (void)args; (void)argc; (void)depth; (void)stack_floor; (void)out;
+  return JIT_BAIL;
+}
+
+void jit_release(void) {
+}
+
+#endif
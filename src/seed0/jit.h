@@ -0,0 +1,39 @@
+#pragma once
+#include "interp.h"
+#include <stdint.h>
+
+// Baseline x86-64 JIT for the tree-walker. call_function counts the calls of
+// each Function, and once one reaches the threshold its body is compiled to
+// machine code if it stays inside a pure int subset:
+// - int parameters and locals, int/bool literals and locked int globals;
+// - + - * /, comparisons, not, and/or, `x if c otherwise y`;
+// - set, if/otherwise, repeat, loop forever, break, continue, return <int>;
+// - calls to other such functions bound by a top-level `define`.
+// Compiled code changes nothing outside its own native frame, so when it
+// meets a case it does not model (a non-int argument, division by zero,
+// falling off the end, the depth or stack limit) it gives up and the
+// interpreter runs the whole call again. Other platforms never compile.
+
+#define JIT_THRESHOLD_DEFAULT 1000
+
+typedef struct JitCode JitCode;
+
+// calls before a function is compiled; 0 turns the JIT off (--no-jit)
+void set_jit_threshold(unsigned calls);
+unsigned jit_threshold(void);
+
+// Compile fn together with the functions it calls. On success fn->jit is
+// set; otherwise fn is marked jit_rejected and stays interpreted.
+bool jit_compile(Function* fn);
+
+typedef enum JitResult {
+  JIT_OK = 0,        // *out is the call's result
+  JIT_BAIL,          // interpret the call instead
+  JIT_TOO_DEEP       // the same, and it ran out of call depth or native stack
+} JitResult;
+
+// Run fn->jit. `depth` is how many nested Astralis calls --max-depth still
+// allows and `stack_floor` the lowest usable native stack address.
+JitResult jit_run(const JitCode* code, const Value* args, size_t argc, size_t depth, uintptr_t stack_floor, Value* out);
+// unmap all generated code once a run is over
+void jit_release(void);
@@ -1,4 +1,5 @@
 #include "lexer.h"
+#include "intern.h"
 #include <ctype.h>
 #include <string.h>
 
@@ -180,12 +181,15 @@ Token lexer_next(Lexer* lx) {
       n++;
     }
     TokenType kt = keyword_type(start, n);
-    return make_token(lx, kt, start, n, 0, col_start);
+    // names are compared by pointer from here on
+    const char* name = kt == TOK_IDENT || kt == TOK_ASK ? intern(start, n) : NULL;
+    return make_token(lx, kt, name ? name : start, n, 0, col_start);
   }
 
   // unknown
   advance(lx);
-  return make_token(lx, TOK_IDENT, lx->src + lx->pos - 1, 1, 0, col_start);
+  const char* name = intern(lx->src + lx->pos - 1, 1);
+  return make_token(lx, TOK_IDENT, name ? name : lx->src + lx->pos - 1, 1, 0, col_start);
 }
 
 const char* token_type_name(TokenType t) {
@@ -61,7 +61,7 @@ typedef enum TokenType {
 
 typedef struct Token {
   TokenType type;
-  const char* start;   // pointer into source line buffer
+  const char* start;   // into the source; interned for TOK_IDENT and TOK_ASK
   size_t length;
   long number;         // if TOK_NUMBER
   size_t line;
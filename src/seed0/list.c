@@ -0,0 +1,345 @@
+#include "list.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LIST_MIN_CAP 8
+
+static Value list_error(const char* msg) {
+  return value_error(msg, strlen(msg));
+}
+
+static List* list_alloc(void) {
+  List* l = (List*)calloc(1, sizeof(List));
+  if (!l) return NULL;
+  STAT_INC(lists);
+  l->refs = 1;
+  l->packed = true;
+  return l;
+}
+
+static void list_release(List* l) {
+  if (!l || --l->refs) return;
+  if (l->base) {
+    list_release(l->base);
+  } else if (l->packed) {
+    free(l->ints);
+  } else {
+    for (size_t i = 0; i < l->len; i++) value_free(&l->items[i]);
+    free(l->items);
+  }
+  free(l);
+}
+
+void value_free_list(Value* v) {
+  list_release(v->list);
+  v->type = VAL_NULL;
+  v->i = 0;
+}
+
+Value value_copy_list(const Value* v) {
+  if (v->list) v->list->refs++;
+  return *v;
+}
+
+static Value list_value(List* l) {
+  Value v;
+  v.type = VAL_LIST;
+  v.list = l;
+  return v;
+}
+
+// packed ints become Values; the list stays boxed from then on
+static bool list_box(List* l) {
+  Value* items = (Value*)malloc((l->cap ? l->cap : 1) * sizeof(Value));
+  if (!items) return false;
+  STAT_INC(list_boxed);
+  for (size_t i = 0; i < l->len; i++) items[i] = value_int(l->ints[i]);
+  free(l->ints);
+  l->items = items;
+  l->packed = false;
+  return true;
+}
+
+static bool list_reserve(List* l, size_t n) {
+  if (l->len + n <= l->cap) return true;
+  size_t cap = l->cap * 2;
+  if (cap < l->len + n) cap = l->len + n;
+  if (cap < LIST_MIN_CAP) cap = LIST_MIN_CAP;
+  size_t size = l->packed ? sizeof(long) : sizeof(Value);
+  void* grown = realloc(l->packed ? (void*)l->ints : (void*)l->items, cap * size);
+  if (!grown) return false;
+  if (l->packed) l->ints = (long*)grown;
+  else l->items = (Value*)grown;
+  l->cap = cap;
+  return true;
+}
+
+// give a slice a copy of its window, so it can grow
+static bool list_detach(List* l) {
+  size_t off;
+  const List* s = list_store(l, &off);
+  List* base = l->base;
+  size_t cap = l->len > LIST_MIN_CAP ? l->len : LIST_MIN_CAP;
+  if (s->packed) {
+    long* ints = (long*)malloc(cap * sizeof(long));
+    if (!ints) return false;
+    memcpy(ints, s->ints + off, l->len * sizeof(long));
+    l->ints = ints;
+  } else {
+    Value* items = (Value*)malloc(cap * sizeof(Value));
+    if (!items) return false;
+    for (size_t i = 0; i < l->len; i++) items[i] = value_copy(&s->items[off + i]);
+    l->items = items;
+  }
+  l->packed = s->packed;
+  l->cap = cap;
+  l->base = NULL;
+  l->offset = 0;
+  list_release(base);
+  return true;
+}
+
+static bool list_append(List* l, const Value* item) {
+  if (l->base && !list_detach(l)) return false;
+  if (l->packed && item->type != VAL_INT && !list_box(l)) return false;
+  if (!list_reserve(l, 1)) return false;
+  if (l->packed) l->ints[l->len++] = item->i;
+  else l->items[l->len++] = value_copy(item);
+  return true;
+}
+
+// whether `target` is reachable from l, so storing l in target would make
+// a cycle that reference counting never frees
+static bool list_reaches(const List* l, const List* target) {
+  if (l == target) return true;
+  if (l->base) return list_reaches(l->base, target);
+  if (l->packed) return false;
+  for (size_t i = 0; i < l->len; i++) {
+    if (l->items[i].type == VAL_LIST && list_reaches(l->items[i].list, target)) return true;
+  }
+  return false;
+}
+
+Value list_new(const Value* items, size_t n) {
+  List* l = list_alloc();
+  if (!l) return list_error("out of memory");
+  Value v = list_value(l);
+  if (n && !list_reserve(l, n)) {
+    value_free(&v);
+    return list_error("out of memory");
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (!list_append(l, &items[i])) {
+      value_free(&v);
+      return list_error("out of memory");
+    }
+  }
+  return v;
+}
+
+Value list_push(const Value* list, const Value* item) {
+  if (list->type != VAL_LIST) return list_error("push expects a list");
+  if (item->type == VAL_LIST && list_reaches(item->list, list->list)) {
+    return list_error("push would put a list inside itself");
+  }
+  if (!list_append(list->list, item)) return list_error("out of memory");
+  return value_copy(list);
+}
+
+Value list_item(const Value* list, const Value* index) {
+  if (list->type != VAL_LIST) return list_error("item expects a list");
+  if (index->type != VAL_INT) return list_error("item expects an int index");
+  const List* l = list->list;
+  if (index->i < 0 || (size_t)index->i >= l->len) return list_error("index out of range");
+  return list_get(l, (size_t)index->i);
+}
+
+Value list_slice(const Value* list, const Value* from, const Value* to) {
+  if (list->type != VAL_LIST) return list_error("slice expects a list");
+  if (from->type != VAL_INT || to->type != VAL_INT) return list_error("slice expects int bounds");
+  List* l = list->list;
+  if (from->i < 0 || from->i > to->i || (size_t)to->i > l->len) return list_error("slice out of range");
+  size_t off;
+  List* base = (List*)list_store(l, &off);
+  List* s = list_alloc();
+  if (!s) return list_error("out of memory");
+  STAT_INC(list_slices);
+  base->refs++;
+  s->base = base;
+  s->offset = off + (size_t)from->i;
+  s->len = (size_t)(to->i - from->i);
+  return list_value(s);
+}
+
+Value list_sum(const Value* list) {
+  if (list->type != VAL_LIST) return list_error("sum expects a list");
+  size_t off;
+  const List* s = list_store(list->list, &off);
+  size_t n = list->list->len;
+  // wraps like the int operators of the compiled backends
+  unsigned long total = 0;
+  if (s->packed) {
+    const long* ints = s->ints + off;
+    for (size_t i = 0; i < n; i++) total += (unsigned long)ints[i];
+  } else {
+    const Value* items = s->items + off;
+    for (size_t i = 0; i < n; i++) {
+      if (items[i].type != VAL_INT) return list_error("sum expects a list of ints");
+      total += (unsigned long)items[i].i;
+    }
+  }
+  return value_int((long)total);
+}
+
+static int compare_str(const Value* a, const Value* b) {
+  size_t na = value_strlen(a), nb = value_strlen(b);
+  int cmp = memcmp(value_str(a), value_str(b), na < nb ? na : nb);
+  if (cmp) return cmp;
+  return na < nb ? -1 : na > nb;
+}
+
+// the smallest item when sign is 1, the largest when it is -1
+static Value list_extreme(const Value* list, int sign, const char* name) {
+  char msg[64];
+  if (list->type != VAL_LIST) {
+    snprintf(msg, sizeof(msg), "%s expects a list", name);
+    return list_error(msg);
+  }
+  size_t off;
+  const List* s = list_store(list->list, &off);
+  size_t n = list->list->len;
+  if (!n) {
+    snprintf(msg, sizeof(msg), "%s of an empty list", name);
+    return list_error(msg);
+  }
+  if (s->packed) {
+    const long* ints = s->ints + off;
+    long best = ints[0];
+    if (sign > 0) {
+      for (size_t i = 1; i < n; i++) if (ints[i] < best) best = ints[i];
+    } else {
+      for (size_t i = 1; i < n; i++) if (ints[i] > best) best = ints[i];
+    }
+    return value_int(best);
+  }
+  const Value* items = s->items + off;
+  const Value* best = &items[0];
+  for (size_t i = 0; i < n; i++) {
+    const Value* v = &items[i];
+    int cmp;
+    if (v->type == VAL_INT && best->type == VAL_INT) cmp = (v->i > best->i) - (v->i < best->i);
+    else if (v->type == VAL_STRING && best->type == VAL_STRING) cmp = compare_str(v, best);
+    else {
+      snprintf(msg, sizeof(msg), "%s expects ints or strings", name);
+      return list_error(msg);
+    }
+    if (cmp * sign < 0) best = v;
+  }
+  return value_copy(best);
+}
+
+Value list_min(const Value* list) {
+  return list_extreme(list, 1, "min");
+}
+
+Value list_max(const Value* list) {
+  return list_extreme(list, -1, "max");
+}
+
+static int sort_ints(const void* a, const void* b) {
+  long x = *(const long*)a, y = *(const long*)b;
+  return (x > y) - (x < y);
+}
+
+static int sort_strings(const void* a, const void* b) {
+  return compare_str((const Value*)a, (const Value*)b);
+}
+
+Value list_sort(const Value* list) {
+  if (list->type != VAL_LIST) return list_error("sort expects a list");
+  size_t off;
+  const List* s = list_store(list->list, &off);
+  size_t n = list->list->len;
+  // a window of a boxed list may still hold only ints; it sorts packed
+  bool ints = true, strings = !s->packed;
+  for (size_t i = 0; !s->packed && i < n; i++) {
+    ints = ints && s->items[off + i].type == VAL_INT;
+    strings = strings && s->items[off + i].type == VAL_STRING;
+    if (!ints && !strings) return list_error("sort expects ints or strings");
+  }
+  List* l = list_alloc();
+  if (!l) return list_error("out of memory");
+  Value out = list_value(l);
+  l->packed = ints;
+  if (n && !list_reserve(l, n)) {
+    value_free(&out);
+    return list_error("out of memory");
+  }
+  if (!n) return out;
+  if (ints) {
+    if (s->packed) memcpy(l->ints, s->ints + off, n * sizeof(long));
+    else for (size_t i = 0; i < n; i++) l->ints[i] = s->items[off + i].i;
+    qsort(l->ints, n, sizeof(long), sort_ints);
+  } else {
+    for (size_t i = 0; i < n; i++) l->items[i] = value_copy(&s->items[off + i]);
+    qsort(l->items, n, sizeof(Value), sort_strings);
+  }
+  l->len = n;
+  return out;
+}
+
+typedef struct Text {
+  char* data;
+  size_t len;
+  size_t cap;
+  bool failed;
+} Text;
+
+static void text_put(Text* t, const char* s, size_t n) {
+  if (t->failed) return;
+  if (t->len + n + 1 > t->cap) {
+    size_t cap = t->cap ? t->cap * 2 : 64;
+    while (cap < t->len + n + 1) cap *= 2;
+    char* grown = (char*)realloc(t->data, cap);
+    if (!grown) { t->failed = true; return; }
+    t->data = grown;
+    t->cap = cap;
+  }
+  memcpy(t->data + t->len, s, n);
+  t->len += n;
+  t->data[t->len] = '\0';
+}
+
+static void text_list(Text* t, const List* l) {
+  text_put(t, "[", 1);
+  for (size_t i = 0; i < l->len; i++) {
+    if (i) text_put(t, ", ", 2);
+    Value v = list_get(l, i);
+    if (v.type == VAL_LIST) {
+      text_list(t, v.list);
+    } else if (v.type == VAL_STRING) {
+      text_put(t, "\"", 1);
+      text_put(t, value_str(&v), value_strlen(&v));
+      text_put(t, "\"", 1);
+    } else {
+      char* s = value_to_cstring(&v);
+      if (s) text_put(t, s, strlen(s));
+      else t->failed = true;
+      free(s);
+    }
+    value_free(&v);
+  }
+  text_put(t, "]", 1);
+}
+
+char* list_to_cstring(const List* l) {
+  Text t = {0};
+  text_list(&t, l);
+  if (t.failed) {
+    free(t.data);
+    return NULL;
+  }
+  return t.data;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lists are mutable and shared by reference: value_copy bumps `refs` and a
+// push is seen through every copy. Items sit in one contiguous array that
+// grows geometrically, so pushes are amortized O(1). While a list has only
+// ever held ints they are packed as longs; the first other item boxes the
+// whole array into Values for good.
+//
+// A slice is a window of `len` items from `offset` in `base`, made in O(1)
+// without copying. Lists only grow at the end and never change an item once
+// pushed, so a window stays valid while its base grows or is boxed. Pushing
+// to a slice first copies its window into storage of its own.
+typedef struct List {
+  size_t refs;
+  size_t len;
+  size_t cap;          // items the storage has room for; 0 for a slice
+  bool packed;         // storage is `ints` rather than `items`
+  struct List* base;   // a slice: the list it is a window of, never a slice
+  size_t offset;       // a slice: where the window starts in base
+  union {
+    long* ints;
+    Value* items;
+  };
+} List;
+
+// the list whose storage holds l's items, and where l's first item is in it
+static inline const List* list_store(const List* l, size_t* offset) {
+  if (l->base) {
+    *offset = l->offset;
+    return l->base;
+  }
+  *offset = 0;
+  return l;
+}
+
+// item i < l->len, copied
+static inline Value list_get(const List* l, size_t i) {
+  size_t off;
+  const List* s = list_store(l, &off);
+  return s->packed ? value_int(s->ints[off + i]) : value_copy(&s->items[off + i]);
+}
+
+// The builtins' list operations. Each returns its result or an error value
+// naming the builtin, and leaves its arguments with the caller.
+Value list_new(const Value* items, size_t n);
+Value list_push(const Value* list, const Value* item);
+Value list_item(const Value* list, const Value* index);
+Value list_slice(const Value* list, const Value* from, const Value* to);
+Value list_sum(const Value* list);
+Value list_min(const Value* list);
+Value list_max(const Value* list);
+// a sorted copy; ints, or strings in byte order
+Value list_sort(const Value* list);
+
+// "[1, 2, 3]", with string items in double quotes; caller frees
+char* list_to_cstring(const List* l);
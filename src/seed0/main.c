@@ -1,61 +1,354 @@
+#define _POSIX_C_SOURCE 200809L
 #include "parser.h"
 #include "interp.h"
+#include "intern.h"
+#include "jit.h"
+#include "optimize.h"
+#include "resolve.h"
+#include "runtime.h"
+#include "compile.h"
+#include "emit_c.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static char* slurp_file(const char* path, size_t* out_len) {
-  FILE* f = fopen(path, "rb");
-  if (!f) return NULL;
-  fseek(f, 0, SEEK_END);
-  long n = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  if (n < 0) { fclose(f); return NULL; }
-  char* buf = (char*)malloc((size_t)n + 2);
-  if (!buf) { fclose(f); return NULL; }
-  size_t r = fread(buf, 1, (size_t)n, f);
-  fclose(f);
-  buf[r] = '\n';
-  buf[r+1] = '\0';
-  if (out_len) *out_len = r + 1;
-  return buf;
+// Script bytes stay alive for the whole run: tokens, binding names and
+// string literals are spans of them rather than copies. Regular files are
+// mapped read-only; pipes and other unseekable inputs are read instead.
+typedef struct Source {
+  char* data;
+  size_t len;
+  bool mapped;
+} Source;
+
+static bool read_all(int fd, Source* out) {
+  size_t cap = 64 * 1024, len = 0;
+  char* buf = (char*)malloc(cap);
+  if (!buf) return false;
+  for (;;) {
+    if (len == cap) {
+      char* grown = (char*)realloc(buf, cap * 2);
+      if (!grown) { free(buf); return false; }
+      buf = grown;
+      cap *= 2;
+    }
+    ssize_t r = read(fd, buf + len, cap - len);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) { free(buf); return false; }
+    if (r == 0) break;
+    len += (size_t)r;
+  }
+  out->data = buf;
+  out->len = len;
+  out->mapped = false;
+  return true;
+}
+
+static bool source_load(const char* path, Source* out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = false;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      out->data = (char*)m;
+      out->len = (size_t)st.st_size;
+      out->mapped = true;
+      ok = true;
+    }
+  }
+  if (!ok) ok = read_all(fd, out);
+  close(fd);
+  return ok;
+}
+
+static void source_release(Source* s) {
+  if (s->mapped) munmap(s->data, s->len);
+  else free(s->data);
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [--vm] [--no-opt] [--emit-astrb <out.astrb>] [--emit-c <out.c>] [--ast-stats] [--out-buffer <bytes>] [--max-depth <n>] [--no-jit | --jit-threshold <n>] [--profile <out> [--profile-hz <n>]] [--stats] [--stats-json <out>] [--quick-stats] [--trace <out.json> [--trace-events <n>]] <file.astr|file.astrb>\n", argv0);
+  fprintf(stderr, "  --vm                 run through the bytecode compiler and VM\n");
+  fprintf(stderr, "  --no-opt             skip constant folding and short-circuit and/or (eager reference semantics)\n");
+  fprintf(stderr, "  --emit-astrb <path>  write compiled bytecode to <path> and exit\n");
+  fprintf(stderr, "  --emit-c <path>      write the program as C to <path> and exit (link with libseed0.a)\n");
+  fprintf(stderr, "  --ast-stats          report AST arena and optimizer counters on stderr\n");
+  fprintf(stderr, "  --out-buffer <bytes> stdout buffer size (default %d)\n", RT_OUTPUT_DEFAULT);
+  fprintf(stderr, "  --max-depth <n>      Astralis call depth before a runtime error (default %d)\n", MAX_DEPTH_DEFAULT);
+  fprintf(stderr, "  --no-jit             never compile hot tree-walker functions to machine code\n");
+  fprintf(stderr, "  --jit-threshold <n>  calls before a function is compiled (default %d)\n", JIT_THRESHOLD_DEFAULT);
+  fprintf(stderr, "  --profile <out>      sample the run; write a flat profile to <out> and folded stacks to <out>.folded\n");
+  fprintf(stderr, "  --profile-hz <n>     samples per second of CPU time (default %d)\n", PROF_DEFAULT_HZ);
+  fprintf(stderr, "  --stats              runtime counters on stderr at exit (builds made with STATS=1)\n");
+  fprintf(stderr, "  --stats-json <out>   the same counters as JSON in <out>\n");
+  fprintf(stderr, "  --quick-stats        tree-walker: how often quickened operators took their int path, on stderr\n");
+  fprintf(stderr, "  --trace <out.json>   write a Chrome/Perfetto trace of calls, builtins and output flushes\n");
+  fprintf(stderr, "  --trace-events <n>   keep the last <n> spans (default %u)\n", TRACE_DEFAULT_EVENTS);
 }
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-    fprintf(stderr, "usage: %s <file.astr>\n", argv[0]);
+  bool use_vm = false;
+  bool optimize = true;
+  bool ast_stats = false;
+  size_t out_buffer = RT_OUTPUT_DEFAULT;
+  const char* emit_path = NULL;
+  const char* emit_c_path = NULL;
+  const char* profile_path = NULL;
+  const char* trace_path = NULL;
+  size_t trace_events = TRACE_DEFAULT_EVENTS;
+  bool stats = false;
+  const char* stats_json = NULL;
+  bool quick_stats = false;
+  unsigned profile_hz = PROF_DEFAULT_HZ;
+  const char* path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--vm") == 0) {
+      use_vm = true;
+    } else if (strcmp(argv[i], "--no-opt") == 0) {
+      optimize = false;
+    } else if (strcmp(argv[i], "--ast-stats") == 0) {
+      ast_stats = true;
+    } else if (strcmp(argv[i], "--out-buffer") == 0 && i + 1 < argc) {
+      char* end = NULL;
+      unsigned long long n = strtoull(argv[++i], &end, 10);
+      if (!end || *end || n == 0 || n > (1ULL << 30)) {
+        fprintf(stderr, "error: --out-buffer expects a size between 1 and %llu bytes\n", 1ULL << 30);
+        return 2;
+      }
+      out_buffer = (size_t)n;
+    } else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      char* end = NULL;
+      unsigned long long n = strtoull(argv[++i], &end, 10);
+      if (!end || *end || n == 0 || n > 1000000) {
+        fprintf(stderr, "error: --max-depth expects a depth between 1 and 1000000\n");
+        return 2;
+      }
+      set_max_depth((size_t)n);
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      set_jit_threshold(0);
+    } else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc) {
+      char* end = NULL;
+      unsigned long n = strtoul(argv[++i], &end, 10);
+      if (!end || *end || n == 0 || n > 1000000000) {
+        fprintf(stderr, "error: --jit-threshold expects a call count between 1 and 1000000000\n");
+        return 2;
+      }
+      set_jit_threshold((unsigned)n);
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--profile-hz") == 0 && i + 1 < argc) {
+      char* end = NULL;
+      unsigned long n = strtoul(argv[++i], &end, 10);
+      if (!end || *end || n == 0 || n > 100000) {
+        fprintf(stderr, "error: --profile-hz expects a rate between 1 and 100000\n");
+        return 2;
+      }
+      profile_hz = (unsigned)n;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--trace-events") == 0 && i + 1 < argc) {
+      char* end = NULL;
+      unsigned long long n = strtoull(argv[++i], &end, 10);
+      if (!end || *end || n == 0 || n > (1ULL << 28)) {
+        fprintf(stderr, "error: --trace-events expects a count between 1 and %llu\n", 1ULL << 28);
+        return 2;
+      }
+      trace_events = (size_t)n;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+      stats_json = argv[++i];
+    } else if (strcmp(argv[i], "--quick-stats") == 0) {
+      quick_stats = true;
+    } else if (strcmp(argv[i], "--emit-astrb") == 0 && i + 1 < argc) {
+      emit_path = argv[++i];
+    } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+      emit_c_path = argv[++i];
+    } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      usage(argv[0]);
+      return 2;
+    } else if (!path) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!path) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (quick_stats && use_vm) {
+    fprintf(stderr, "error: --quick-stats reports the tree-walker, not --vm\n");
     return 2;
   }
-  size_t len = 0;
-  char* src = slurp_file(argv[1], &len);
-  if (!src) {
-    fprintf(stderr, "error: could not read file: %s\n", argv[1]);
+  if ((stats || stats_json) && !STATS_ENABLED) {
+    fprintf(stderr, "error: this astralis was built without statistics; rebuild with `make clean && make STATS=1`\n");
     return 2;
   }
 
-  ParseError err;
-  Program p = parse_source(src, len, &err);
-  if (err.has_error) {
-    fprintf(stderr, "parse error at %zu:%zu: %s\n", err.line, err.col, err.message);
-    free(src);
-    return 1;
+  Source source;
+  if (!source_load(path, &source)) {
+    fprintf(stderr, "error: could not read file: %s\n", path);
+    return 2;
+  }
+
+  Program p;
+  memset(&p, 0, sizeof(p));
+  FnProto* script = NULL;
+  const char* src = source.data;
+  size_t len = source.len;
+  bool from_bytecode = astrb_is_bytecode(src, len);
+  if (from_bytecode) {
+    char lerr[256] = {0};
+    script = astrb_load(src, len, lerr, sizeof(lerr));
+    if (!script) {
+      fprintf(stderr, "error: %s: %s\n", path, lerr);
+      source_release(&source);
+      intern_release();
+      return 1;
+    }
+    if (emit_c_path || quick_stats) {
+      fprintf(stderr, "error: %s needs a source file, not bytecode\n", emit_c_path ? "--emit-c" : "--quick-stats");
+      proto_free(script);
+      source_release(&source);
+      intern_release();
+      return 1;
+    }
+    use_vm = true;
+  } else {
+    ParseError err;
+    p = parse_source(src, len, &err);
+    if (err.has_error) {
+      fprintf(stderr, "parse error at %zu:%zu: %s\n", err.line, err.col, err.message);
+      source_release(&source);
+      intern_release();
+      return 1;
+    }
+    resolve_program(&p, BUILTIN_NAMES, BUILTIN_COUNT);
+    OptStats ost;
+    if (optimize) optimize_program(&p, &ost);
+    if (ast_stats) {
+      const ArenaStats* st = &p.arena.stats;
+      fprintf(stderr, "ast: %zu allocations (%zu grown in place) in %zu chunks, %zu of %zu bytes used\n",
+              st->allocs, st->grows, st->chunks, st->used, st->reserved);
+      if (optimize) {
+        fprintf(stderr, "opt: %zu folded, %zu branches pruned, %zu lock reads propagated, %zu and/or short-circuited\n",
+                ost.folded, ost.pruned, ost.propagated, ost.short_circuits);
+      }
+    }
+    if (emit_c_path) {
+      char eerr[256] = {0};
+      FILE* out = fopen(emit_c_path, "w");
+      bool wrote = out && emit_c_program(&p, path, out, eerr, sizeof(eerr));
+      if (out && fclose(out) != 0) wrote = false;
+      if (!wrote) fprintf(stderr, "error: could not write %s%s%s\n", emit_c_path, eerr[0] ? ": " : "", eerr);
+      program_free(&p);
+      source_release(&source);
+      intern_release();
+      return wrote ? 0 : 1;
+    }
+    if (use_vm || emit_path) {
+      char cerr[256] = {0};
+      CompileOptions copts = {0};
+      copts.line_marks = profile_path != NULL;
+      script = compile_program(&p, &copts, cerr, sizeof(cerr));
+      if (!script) {
+        fprintf(stderr, "compile error: %s\n", cerr);
+        program_free(&p);
+        source_release(&source);
+        intern_release();
+        return 1;
+      }
+    }
+  }
+
+  if (emit_path) {
+    FILE* out = fopen(emit_path, "wb");
+    bool wrote = out && astrb_save(script, out);
+    if (out && fclose(out) != 0) wrote = false;
+    if (!wrote) fprintf(stderr, "error: could not write %s\n", emit_path);
+    proto_free(script);
+    program_free(&p);
+    source_release(&source);
+    intern_release();
+    return wrote ? 0 : 1;
   }
 
+  rt_output_init(out_buffer);
   Env env;
   env_init(&env);
 
   char rerr[256] = {0};
-  bool ok = run_program(&p, &env, rerr, sizeof(rerr));
+  // .astrb input has no source lines to quote
+  bool quote = !from_bytecode;
+  if (profile_path && !prof_start(quote ? src : NULL, quote ? len : 0, profile_hz, rerr, sizeof(rerr))) {
+    fprintf(stderr, "error: %s\n", rerr);
+    env_free(&env);
+    program_free(&p);
+    proto_free(script);
+    source_release(&source);
+    intern_release();
+    return 1;
+  }
+  if (trace_path && !trace_start(trace_events, rerr, sizeof(rerr))) {
+    fprintf(stderr, "error: %s\n", rerr);
+    env_free(&env);
+    program_free(&p);
+    proto_free(script);
+    source_release(&source);
+    intern_release();
+    return 1;
+  }
+  bool ok = use_vm ? vm_run(script, &env, rerr, sizeof(rerr)) : run_program(&p, &env, rerr, sizeof(rerr));
+  if (profile_path) {
+    char perr[256] = {0};
+    if (!prof_finish(profile_path, perr, sizeof(perr))) fprintf(stderr, "error: %s\n", perr);
+  }
+  if (trace_path) {
+    char terr[256] = {0};
+    rt_flush();  // so the last flush lands in the trace
+    if (!trace_finish(trace_path, terr, sizeof(terr))) fprintf(stderr, "error: %s\n", terr);
+  }
+  // reported before teardown, so frees cover only what the run released
+  if (stats) {
+    rt_flush();
+    stats_print(stderr);
+  }
+  if (quick_stats) {
+    rt_flush();
+    quick_stats_print(&p, stderr);
+  }
+  if (stats_json) {
+    FILE* out = fopen(stats_json, "w");
+    if (out) stats_print_json(out);
+    if (!out || fclose(out) != 0) fprintf(stderr, "error: could not write %s\n", stats_json);
+  }
   if (!ok) {
     fprintf(stderr, "runtime error: %s\n", rerr[0] ? rerr : "unknown");
-    program_free(&p);
     env_free(&env);
-    free(src);
+    program_free(&p);
+    proto_free(script);
+    source_release(&source);
+    intern_release();
     return 1;
   }
 
   env_free(&env);
   program_free(&p);
-  free(src);
+  proto_free(script);
+  source_release(&source);
+  intern_release();
   return 0;
 }
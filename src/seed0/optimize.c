@@ -0,0 +1,236 @@
+#include "optimize.h"
+#include "interp.h"
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+// How many statements anywhere in the program bind each name (set, lock,
+// define, repeat variable, parameter). A lock is only propagated when it is
+// the sole binder, so no other statement can change or shadow it.
+typedef struct Binder {
+  const char* name;    // interned
+  unsigned count;
+} Binder;
+
+typedef struct Opt {
+  Arena* arena;
+  OptStats* stats;
+  unsigned fn_depth;   // > 0 while inside a `define` body
+  Binder* binders;     // open addressing; name == NULL is empty
+  size_t binder_cap;
+  size_t binder_count;
+  Value* consts;       // per global slot, valid where is_const is set
+  bool* is_const;
+} Opt;
+
+static Binder* binder_slot(Binder* table, size_t cap, const char* name) {
+  size_t mask = cap - 1;
+  for (size_t i = intern_hash(name) & mask;; i = (i + 1) & mask) {
+    Binder* b = &table[i];
+    if (!b->name || b->name == name) return b;
+  }
+}
+
+static void count_binder(Opt* o, const Token* t) {
+  if ((o->binder_count + 1) * 2 > o->binder_cap) {
+    size_t nc = o->binder_cap ? o->binder_cap * 2 : 64;
+    Binder* grown = (Binder*)calloc(nc, sizeof(Binder));
+    for (size_t i = 0; i < o->binder_cap; i++) {
+      if (o->binders[i].name) *binder_slot(grown, nc, o->binders[i].name) = o->binders[i];
+    }
+    free(o->binders);
+    o->binders = grown;
+    o->binder_cap = nc;
+  }
+  Binder* b = binder_slot(o->binders, o->binder_cap, t->start);
+  if (!b->name) {
+    b->name = t->start;
+    o->binder_count++;
+  }
+  b->count++;
+}
+
+static unsigned binders_of(const Opt* o, const Token* t) {
+  if (!o->binder_cap) return 0;
+  return binder_slot(o->binders, o->binder_cap, t->start)->count;
+}
+
+static void count_block(Opt* o, const Block* b) {
+  if (!b) return;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    switch (s->type) {
+      case STMT_SET:
+      case STMT_LOCK:
+        count_binder(o, &s->name);
+        break;
+      case STMT_DEFINE:
+        count_binder(o, &s->name);
+        for (size_t k = 0; k < s->param_count; k++) count_binder(o, &s->params[k]);
+        break;
+      case STMT_REPEAT:
+        count_binder(o, &s->loop_var);
+        break;
+      default:
+        break;
+    }
+    count_block(o, s->block);
+    count_block(o, s->else_block);
+  }
+}
+
+// Folded strings are interned, like source literals, so they are shared by
+// reference and outlive the run.
+static bool make_literal(Opt* o, Expr* e, Value v) {
+  if (v.type == VAL_ERROR) {
+    value_free(&v);
+    return false;
+  }
+  if (v.type == VAL_STRING) {
+    const char* text = intern(value_str(&v), value_strlen(&v));
+    value_free(&v);
+    if (!text) return false;
+    v = intern_value(text);
+  }
+  e->type = EXPR_LITERAL;
+  e->lit = v;
+  o->stats->folded++;
+  return true;
+}
+
+static void opt_expr(Opt* o, Expr* e) {
+  if (!e) return;
+  switch (e->type) {
+    case EXPR_LITERAL:
+      return;
+    case EXPR_IDENT:
+      if (!o->fn_depth && e->ref.slot >= 0 && e->ref.depth == 0 && o->is_const[e->ref.slot]) {
+        e->type = EXPR_LITERAL;
+        e->lit = o->consts[e->ref.slot];
+        o->stats->propagated++;
+      }
+      return;
+    case EXPR_GROUP:
+      // grouping only shaped the parse
+      opt_expr(o, e->left);
+      *e = *e->left;
+      return;
+    case EXPR_UNARY:
+      opt_expr(o, e->left);
+      if (e->left->type == EXPR_LITERAL) make_literal(o, e, eval_unary_op(e->unop, &e->left->lit));
+      return;
+    case EXPR_BINARY:
+      opt_expr(o, e->left);
+      opt_expr(o, e->right);
+      if (e->left->type == EXPR_LITERAL && e->right->type == EXPR_LITERAL) {
+        if (make_literal(o, e, eval_binary_op(e->op, &e->left->lit, &e->right->lit))) return;
+      }
+      if (e->op == BIN_AND || e->op == BIN_OR) {
+        if (e->left->type == EXPR_LITERAL && value_is_truthy(&e->left->lit) == (e->op == BIN_OR)) {
+          make_literal(o, e, value_bool(e->op == BIN_OR));
+          return;
+        }
+        e->type = EXPR_LOGICAL;
+        o->stats->short_circuits++;
+      }
+      return;
+    case EXPR_CONDITIONAL:
+      opt_expr(o, e->cond);
+      opt_expr(o, e->left);
+      opt_expr(o, e->right);
+      if (e->cond->type == EXPR_LITERAL) {
+        *e = value_is_truthy(&e->cond->lit) ? *e->left : *e->right;
+        o->stats->pruned++;
+      }
+      return;
+    case EXPR_CALL:
+      opt_expr(o, e->call.callee);
+      for (size_t i = 0; i < e->call.arg_count; i++) opt_expr(o, e->call.args[i]);
+      return;
+    case EXPR_LOGICAL:
+      return;
+  }
+}
+
+static void opt_block(Opt* o, Block* b, bool top);
+
+static void opt_stmt(Opt* o, Stmt* s) {
+  opt_expr(o, s->expr);
+  opt_expr(o, s->expr_b);
+  if (s->type == STMT_DEFINE) {
+    o->fn_depth++;
+    opt_block(o, s->block, false);
+    o->fn_depth--;
+    return;
+  }
+  opt_block(o, s->block, false);
+  opt_block(o, s->else_block, false);
+}
+
+// the statements an `if` with a constant condition stands for
+static const Block* taken_branch(const Stmt* s) {
+  return value_is_truthy(&s->expr->lit) ? s->block : s->else_block;
+}
+
+static bool is_static_if(const Stmt* s) {
+  return s->type == STMT_IF && s->expr && s->expr->type == EXPR_LITERAL;
+}
+
+static void opt_block(Opt* o, Block* b, bool top) {
+  if (!b) return;
+  size_t kept = 0;
+  bool splice = false;
+  for (size_t i = 0; i < b->count; i++) {
+    Stmt* s = &b->stmts[i];
+    opt_stmt(o, s);
+    // top-level statements run once, in order, in the global frame
+    if (top && s->type == STMT_LOCK && s->expr->type == EXPR_LITERAL && s->ref.slot >= 0 &&
+        binders_of(o, &s->name) == 1) {
+      o->consts[s->ref.slot] = s->expr->lit;
+      o->is_const[s->ref.slot] = true;
+    }
+    if (is_static_if(s)) {
+      const Block* t = taken_branch(s);
+      kept += t ? t->count : 0;
+      splice = true;
+      o->stats->pruned++;
+    } else {
+      kept++;
+    }
+  }
+  if (!splice) return;
+  // blocks share their frame, so a taken branch can stand in for its `if`
+  Stmt* out = kept ? (Stmt*)arena_alloc(o->arena, kept * sizeof(Stmt)) : NULL;
+  size_t n = 0;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    if (!is_static_if(s)) {
+      out[n++] = *s;
+      continue;
+    }
+    const Block* t = taken_branch(s);
+    if (t && t->count) {
+      memcpy(out + n, t->stmts, t->count * sizeof(Stmt));
+      n += t->count;
+    }
+  }
+  b->stmts = out;
+  b->count = kept;
+  b->cap = kept;
+}
+
+void optimize_program(Program* p, OptStats* stats) {
+  Opt o;
+  memset(&o, 0, sizeof(o));
+  memset(stats, 0, sizeof(*stats));
+  o.arena = &p->arena;
+  o.stats = stats;
+  size_t globals = p->globals.count ? p->globals.count : 1;
+  o.consts = (Value*)calloc(globals, sizeof(Value));
+  o.is_const = (bool*)calloc(globals, sizeof(bool));
+  count_block(&o, &p->block);
+  opt_block(&o, &p->block, true);
+  free(o.binders);
+  free(o.consts);
+  free(o.is_const);
+}
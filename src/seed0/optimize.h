@@ -0,0 +1,22 @@
+#pragma once
+#include "parser.h"
+
+typedef struct OptStats {
+  size_t folded;          // operators replaced by their constant result
+  size_t pruned;          // if/otherwise and `x if c otherwise y` decided statically
+  size_t propagated;      // reads of a constant `lock` replaced by its value
+  size_t short_circuits;  // and/or rewritten to skip their right operand
+} OptStats;
+
+// Rewrite a resolved program in place before either engine runs it:
+// - fold operators whose operands are literals (errors such as `1 / 0` are
+//   left for run time, so they still fail where the program says);
+// - drop the dead side of if/otherwise and conditional expressions whose
+//   condition is constant;
+// - replace top-level reads of a top-level `lock X to <constant>` with the
+//   constant when nothing else in the program binds X;
+// - turn and/or into EXPR_LOGICAL, which skips the right operand once the
+//   left one decides the result.
+// Skipping this pass (`--no-opt`) keeps the eager reference semantics, so
+// the two can be diffed.
+void optimize_program(Program* p, OptStats* stats);
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "intern.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -12,57 +13,72 @@ static void set_error(ParseError* err, size_t line, size_t col, const char* msg)
   snprintf(err->message, sizeof(err->message), "%s", msg);
 }
 
-static Expr* expr_new(void) {
-  return (Expr*)calloc(1, sizeof(Expr));
-}
-
-static void expr_free(Expr* e) {
-  if (!e) return;
-  if (e->type == EXPR_LITERAL) value_free(&e->lit);
-  expr_free(e->left);
-  expr_free(e->right);
-  expr_free(e->cond);
-  if (e->type == EXPR_CALL) {
-    expr_free(e->call.callee);
-    for (size_t i = 0; i < e->call.arg_count; i++) expr_free(e->call.args[i]);
-    free(e->call.args);
-  }
-  free(e);
-}
-
-static void block_free(Block* b) {
-  if (!b) return;
-  for (size_t i = 0; i < b->count; i++) {
-    expr_free(b->stmts[i].expr);
-    expr_free(b->stmts[i].expr_b);
-    block_free(b->stmts[i].block);
-    block_free(b->stmts[i].else_block);
-    free(b->stmts[i].params);
-  }
-  free(b->stmts);
-  b->stmts = NULL; b->count = 0; b->cap = 0;
+void frame_layout_free(FrameLayout* l) {
+  if (!l) return;
+  free(l->names);
+  free(l->lens);
+  l->names = NULL; l->lens = NULL; l->count = 0;
 }
 
 void program_free(Program* p) {
   if (!p) return;
-  block_free(&p->block);
-}
-
-static void block_push(Block* b, Stmt s) {
-  if (b->count + 1 > b->cap) {
-    size_t nc = b->cap ? b->cap * 2 : 16;
-    b->stmts = (Stmt*)realloc(b->stmts, nc * sizeof(Stmt));
-    b->cap = nc;
-  }
-  b->stmts[b->count++] = s;
+  arena_free(&p->arena);
+  memset(p, 0, sizeof(*p));
 }
 
 typedef struct Parser {
   Lexer lx;
   Token cur;
   Token prev;
+  Arena* arena;
+  // statements and call arguments still being collected; nested blocks and
+  // calls stack on top, then move out as exact-size arena arrays
+  Stmt* pending;
+  size_t pending_count;
+  size_t pending_cap;
+  Expr** pending_args;
+  size_t pending_arg_count;
+  size_t pending_arg_cap;
 } Parser;
 
+static Expr* expr_new(Parser* ps) {
+  return (Expr*)arena_alloc(ps->arena, sizeof(Expr));
+}
+
+static Block* block_new(Parser* ps) {
+  return (Block*)arena_alloc(ps->arena, sizeof(Block));
+}
+
+static void pending_push(Parser* ps, Stmt s) {
+  if (ps->pending_count + 1 > ps->pending_cap) {
+    size_t nc = ps->pending_cap ? ps->pending_cap * 2 : 64;
+    ps->pending = (Stmt*)realloc(ps->pending, nc * sizeof(Stmt));
+    ps->pending_cap = nc;
+  }
+  ps->pending[ps->pending_count++] = s;
+}
+
+static Block block_take(Parser* ps, size_t mark) {
+  Block b; memset(&b, 0, sizeof(b));
+  b.count = ps->pending_count - mark;
+  b.cap = b.count;
+  if (b.count) {
+    b.stmts = (Stmt*)arena_alloc(ps->arena, b.count * sizeof(Stmt));
+    memcpy(b.stmts, ps->pending + mark, b.count * sizeof(Stmt));
+  }
+  ps->pending_count = mark;
+  return b;
+}
+
+static void pending_arg_push(Parser* ps, Expr* e) {
+  if (ps->pending_arg_count + 1 > ps->pending_arg_cap) {
+    size_t nc = ps->pending_arg_cap ? ps->pending_arg_cap * 2 : 32;
+    ps->pending_args = (Expr**)realloc(ps->pending_args, nc * sizeof(Expr*));
+    ps->pending_arg_cap = nc;
+  }
+  ps->pending_args[ps->pending_arg_count++] = e;
+}
+
 static void adv(Parser* ps) {
   ps->prev = ps->cur;
   ps->cur = lexer_next(&ps->lx);
@@ -86,15 +102,21 @@ static Expr* parse_primary(Parser* ps, ParseError* err) {
   if (err && err->has_error) return NULL;
 
   if (ps->cur.type == TOK_STRING) {
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_LITERAL;
     e->tok = ps->cur;
-    e->lit = value_string(ps->cur.start, ps->cur.length);
+    // evaluation shares the interned text without copying or counting
+    const char* text = intern(ps->cur.start, ps->cur.length);
+    if (!text) {
+      set_error(err, ps->cur.line, ps->cur.col, "out of memory");
+      return NULL;
+    }
+    e->lit = intern_value(text);
     adv(ps);
     return e;
   }
   if (ps->cur.type == TOK_NUMBER) {
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_LITERAL;
     e->tok = ps->cur;
     e->lit = value_int(ps->cur.number);
@@ -102,9 +124,10 @@ static Expr* parse_primary(Parser* ps, ParseError* err) {
     return e;
   }
   if (ps->cur.type == TOK_IDENT || ps->cur.type == TOK_ASK) {
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_IDENT;
     e->tok = ps->cur;
+    e->ref.slot = -1;
     adv(ps);
     return e;
   }
@@ -112,7 +135,7 @@ static Expr* parse_primary(Parser* ps, ParseError* err) {
     adv(ps);
     Expr* inner = parse_expr(ps, err);
     consume(ps, TOK_RPAREN, err, "expected ')' after group");
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_GROUP;
     e->left = inner;
     return e;
@@ -126,20 +149,21 @@ static Expr* parse_call(Parser* ps, ParseError* err) {
   Expr* expr = parse_primary(ps, err);
   while (ps->cur.type == TOK_LPAREN) {
     adv(ps); // consume '('
-    Expr** args = NULL;
-    size_t argc = 0, cap = 0;
+    size_t mark = ps->pending_arg_count;
     if (ps->cur.type != TOK_RPAREN) {
       do {
-        if (argc + 1 > cap) {
-          size_t nc = cap ? cap * 2 : 4;
-          args = (Expr**)realloc(args, nc * sizeof(Expr*));
-          cap = nc;
-        }
-        args[argc++] = parse_expr(ps, err);
+        pending_arg_push(ps, parse_expr(ps, err));
       } while (match(ps, TOK_COMMA));
     }
     consume(ps, TOK_RPAREN, err, "expected ')' after arguments");
-    Expr* call = expr_new();
+    size_t argc = ps->pending_arg_count - mark;
+    Expr** args = NULL;
+    if (argc) {
+      args = (Expr**)arena_alloc(ps->arena, argc * sizeof(Expr*));
+      memcpy(args, ps->pending_args + mark, argc * sizeof(Expr*));
+    }
+    ps->pending_arg_count = mark;
+    Expr* call = expr_new(ps);
     call->type = EXPR_CALL;
     call->call.callee = expr;
     call->call.args = args;
@@ -151,14 +175,14 @@ static Expr* parse_call(Parser* ps, ParseError* err) {
 
 static Expr* parse_unary(Parser* ps, ParseError* err) {
   if (match(ps, TOK_MINUS)) {
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_UNARY;
     e->unop = UN_NEGATE;
     e->left = parse_unary(ps, err);
     return e;
   }
   if (match(ps, TOK_NOT)) {
-    Expr* e = expr_new();
+    Expr* e = expr_new(ps);
     e->type = EXPR_UNARY;
     e->unop = UN_NOT;
     e->left = parse_unary(ps, err);
@@ -173,7 +197,7 @@ static Expr* parse_factor(Parser* ps, ParseError* err) {
     Token op = ps->cur;
     adv(ps);
     Expr* right = parse_unary(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     bin->op = (op.type == TOK_STAR) ? BIN_MUL : BIN_DIV;
@@ -190,7 +214,7 @@ static Expr* parse_term(Parser* ps, ParseError* err) {
     Token op = ps->cur;
     adv(ps);
     Expr* right = parse_factor(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     bin->op = (op.type == TOK_PLUS) ? BIN_ADD : BIN_SUB;
@@ -207,7 +231,7 @@ static Expr* parse_compare(Parser* ps, ParseError* err) {
     Token op = ps->cur;
     adv(ps);
     Expr* right = parse_term(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     switch (op.type) {
@@ -230,7 +254,7 @@ static Expr* parse_equality(Parser* ps, ParseError* err) {
     Token op = ps->cur;
     adv(ps);
     Expr* right = parse_compare(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     bin->op = (op.type == TOK_EQUAL_EQUAL) ? BIN_EQ : BIN_NEQ;
@@ -246,7 +270,7 @@ static Expr* parse_and(Parser* ps, ParseError* err) {
   while (match(ps, TOK_AND)) {
     Token op = ps->prev;
     Expr* right = parse_equality(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     bin->op = BIN_AND;
@@ -262,7 +286,7 @@ static Expr* parse_or(Parser* ps, ParseError* err) {
   while (match(ps, TOK_OR)) {
     Token op = ps->prev;
     Expr* right = parse_and(ps, err);
-    Expr* bin = expr_new();
+    Expr* bin = expr_new(ps);
     bin->type = EXPR_BINARY;
     bin->tok = op;
     bin->op = BIN_OR;
@@ -279,7 +303,7 @@ static Expr* parse_expr(Parser* ps, ParseError* err) {
     Expr* cond = parse_or(ps, err);
     consume(ps, TOK_OTHERWISE, err, "expected 'otherwise' in conditional expression");
     Expr* else_branch = parse_or(ps, err);
-    Expr* tern = expr_new();
+    Expr* tern = expr_new(ps);
     tern->type = EXPR_CONDITIONAL;
     tern->left = left;      // then branch
     tern->cond = cond;
@@ -302,7 +326,7 @@ static bool is_block_connector(TokenType t) {
 
 static Block* parse_inline_block(Parser* ps, ParseError* err, size_t indent) {
   (void)indent;
-  Block* b = (Block*)calloc(1, sizeof(Block));
+  Block* b = block_new(ps);
   Stmt s;
   memset(&s, 0, sizeof(s));
   s = (Stmt){0};
@@ -311,7 +335,9 @@ static Block* parse_inline_block(Parser* ps, ParseError* err, size_t indent) {
 
   // parse a single statement inline
   s = parse_stmt(ps, err, indent);
-  block_push(b, s);
+  b->stmts = (Stmt*)arena_alloc(ps->arena, sizeof(Stmt));
+  b->stmts[0] = s;
+  b->count = b->cap = 1;
   return b;
 }
 
@@ -319,6 +345,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
   Stmt s;
   memset(&s, 0, sizeof(s));
   s.type = STMT_UNSUPPORTED;
+  s.ref.slot = -1;
   s.line = ps->cur.line;
 
   if (match(ps, TOK_SHOW) || match(ps, TOK_SAY)) {
@@ -365,7 +392,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
     consume(ps, TOK_NEWLINE, err, "expected newline after if condition");
     skip_newlines(ps);
     size_t body_indent = ps->cur.col;
-    s.block = (Block*)calloc(1, sizeof(Block));
+    s.block = block_new(ps);
     *s.block = parse_block(ps, err, body_indent);
     if (ps->cur.type == TOK_OTHERWISE) {
       adv(ps);
@@ -377,7 +404,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
       consume(ps, TOK_NEWLINE, err, "expected newline after otherwise");
       skip_newlines(ps);
       size_t else_indent = ps->cur.col;
-      s.else_block = (Block*)calloc(1, sizeof(Block));
+      s.else_block = block_new(ps);
       *s.else_block = parse_block(ps, err, else_indent);
     }
     return s;
@@ -396,7 +423,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
     consume(ps, TOK_NEWLINE, err, "expected newline after loop forever");
     skip_newlines(ps);
     size_t body_indent = ps->cur.col;
-    s.block = (Block*)calloc(1, sizeof(Block));
+    s.block = block_new(ps);
     *s.block = parse_block(ps, err, body_indent);
     return s;
   }
@@ -410,7 +437,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
       consume(ps, TOK_NEWLINE, err, "expected newline after try");
       skip_newlines(ps);
       size_t body_indent = ps->cur.col;
-      s.block = (Block*)calloc(1, sizeof(Block));
+      s.block = block_new(ps);
       *s.block = parse_block(ps, err, body_indent);
     }
     if (ps->cur.type == TOK_OTHERWISE) {
@@ -423,7 +450,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
       consume(ps, TOK_NEWLINE, err, "expected newline after otherwise");
       skip_newlines(ps);
       size_t else_indent = ps->cur.col;
-      s.else_block = (Block*)calloc(1, sizeof(Block));
+      s.else_block = block_new(ps);
       *s.else_block = parse_block(ps, err, else_indent);
     }
     return s;
@@ -449,7 +476,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
     consume(ps, TOK_NEWLINE, err, "expected newline after repeat header");
     skip_newlines(ps);
     size_t body_indent = ps->cur.col;
-    s.block = (Block*)calloc(1, sizeof(Block));
+    s.block = block_new(ps);
     *s.block = parse_block(ps, err, body_indent);
     return s;
   }
@@ -469,7 +496,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
         if (ps->cur.type != TOK_IDENT) { set_error(err, ps->cur.line, ps->cur.col, "expected parameter name"); break; }
         if (pc + 1 > pcap) {
           size_t nc = pcap ? pcap * 2 : 4;
-          params = (Token*)realloc(params, nc * sizeof(Token));
+          params = (Token*)arena_grow(ps->arena, params, pcap * sizeof(Token), nc * sizeof(Token));
           pcap = nc;
         }
         params[pc++] = ps->cur;
@@ -487,7 +514,7 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
     consume(ps, TOK_NEWLINE, err, "expected newline after function header");
     skip_newlines(ps);
     size_t body_indent = ps->cur.col;
-    s.block = (Block*)calloc(1, sizeof(Block));
+    s.block = block_new(ps);
     *s.block = parse_block(ps, err, body_indent);
     return s;
   }
@@ -504,11 +531,11 @@ static Stmt parse_stmt(Parser* ps, ParseError* err, size_t indent) {
 }
 
 static Block parse_block(Parser* ps, ParseError* err, size_t indent) {
-  Block b; memset(&b, 0, sizeof(b));
+  size_t mark = ps->pending_count;
   while (ps->cur.type != TOK_EOF) {
     if (ps->cur.col < indent) break;
     Stmt s = parse_stmt(ps, err, indent);
-    block_push(&b, s);
+    pending_push(ps, s);
     if (ps->cur.type == TOK_NEWLINE) {
       adv(ps);
     } else if (ps->cur.type != TOK_EOF && ps->cur.col > indent) {
@@ -519,11 +546,7 @@ static Block parse_block(Parser* ps, ParseError* err, size_t indent) {
     if (err && err->has_error) break;
     if (ps->cur.col < indent) break;
   }
-  if (err && err->has_error) {
-    block_free(&b);
-    memset(&b, 0, sizeof(b));
-  }
-  return b;
+  return block_take(ps, mark);
 }
 
 Program parse_source(const char* src, size_t len, ParseError* err) {
@@ -531,11 +554,16 @@ Program parse_source(const char* src, size_t len, ParseError* err) {
   if (err) memset(err, 0, sizeof(*err));
 
   Parser ps;
+  memset(&ps, 0, sizeof(ps));
   lexer_init(&ps.lx, src, len, 1);
   ps.cur = lexer_next(&ps.lx);
   ps.prev = ps.cur;
+  ps.arena = &p.arena;
 
   skip_newlines(&ps);
   p.block = parse_block(&ps, err, ps.cur.col ? ps.cur.col : 1);
+  free(ps.pending);
+  free(ps.pending_args);
+  if (err && err->has_error) program_free(&p);
   return p;
 }
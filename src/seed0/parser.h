@@ -1,4 +1,5 @@
 #pragma once
+#include "arena.h"
 #include "lexer.h"
 #include "value.h"
 #include <stdbool.h>
@@ -10,7 +11,8 @@ typedef enum ExprType {
   EXPR_CALL,
   EXPR_GROUP,
   EXPR_UNARY,
-  EXPR_CONDITIONAL
+  EXPR_CONDITIONAL,
+  EXPR_LOGICAL       // short-circuit and/or, produced by optimize_program
 } ExprType;
 
 typedef struct Expr Expr;
@@ -35,18 +37,76 @@ typedef enum UnOp {
   UN_NOT
 } UnOp;
 
+// Resolver address of a variable: walk `depth` frames outward, then index
+// `slot`. slot < 0 means the name is looked up dynamically. `shadowed` marks
+// names that an enclosing frame also declares, so an unset slot must fall
+// back to the by-name walk to keep dynamic scoping exact.
+typedef struct VarRef {
+  int slot;
+  unsigned depth;
+  bool shadowed;
+} VarRef;
+
+// Static slot layout of one frame: slot i is named names[i]. Names are
+// interned (intern.h).
+typedef struct FrameLayout {
+  const char** names;
+  size_t* lens;
+  size_t count;
+} FrameLayout;
+
+// How the tree-walker evaluates an EXPR_BINARY arithmetic or comparison
+// node. Int operands specialize it to an int-only path that reads int
+// literals and slots in place behind a type guard; a guard failure turns
+// it generic again, for good after QUICK_MAX_MISSES failures.
+typedef enum Quick {
+  QUICK_NONE = 0,    // generic; specializes on the next int/int operands
+  QUICK_INT,
+  QUICK_GENERIC      // too polymorphic to keep specializing
+} Quick;
+
+#define QUICK_MAX_MISSES 4
+
+// The run-time half of such a node. Engines see the AST as const, so the
+// state hangs off the node instead of living in it; the resolver allocates
+// one per node from the arena and chains them for --quick-stats.
+typedef struct QuickSite {
+  unsigned char state;     // Quick
+  unsigned char misses;    // guard failures so far
+  unsigned long hits;      // evaluations on the specialized path
+  unsigned long generic;   // every other evaluation
+  struct QuickSite* next;
+} QuickSite;
+
+struct Env;
+
+// Inline cache of a call whose callee is a name the resolver could not
+// place: the global binding the tree-walker last found it in, or the
+// fallback builtin (list, sum, ...) it means when nothing binds it. It
+// holds while no binding has been added by name since (names_version in
+// interp.c), because only that can make a closer frame shadow it.
+typedef struct CallSite {
+  size_t version;       // 0 when empty
+  struct Env* frame;    // the global frame, or NULL for a fallback builtin
+  size_t slot;          // the binding's index there
+  const struct Builtin* builtin;
+} CallSite;
+
 typedef struct CallExpr {
   Expr* callee;
   Expr** args;
   size_t arg_count;
+  CallSite* site;       // callees with ref.slot < 0, from the resolver
 } CallExpr;
 
 struct Expr {
   ExprType type;
   Token tok;         // for ident or literal token (literal: STRING/NUMBER)
+  VarRef ref;        // if ident
   Value lit;         // if literal
   BinOp op;
   UnOp unop;
+  QuickSite* quick;  // arithmetic and comparison binary nodes
   Expr* left;
   Expr* right;
   Expr* cond;
@@ -80,6 +140,9 @@ typedef struct Stmt {
   struct Block* else_block; // otherwise block
   Token* params;     // function parameters
   size_t param_count;
+  VarRef ref;        // resolved set/lock/define target or repeat variable
+  FrameLayout frame; // define: slots of the function's frame
+  int* param_slots;  // define: frame slot bound to each parameter
   size_t line;
 } Stmt;
 
@@ -91,6 +154,9 @@ typedef struct Block {
 
 typedef struct Program {
   Block block;
+  FrameLayout globals; // filled by resolve_program
+  QuickSite* quick_sites; // chained by resolve_program
+  Arena arena;         // every node, array and literal of the AST
 } Program;
 
 typedef struct ParseError {
@@ -100,6 +166,9 @@ typedef struct ParseError {
   size_t col;
 } ParseError;
 
+// releases the whole AST, including resolver layouts, in one shot
 void program_free(Program* p);
+// for layouts owned by malloc (bytecode protos), not the AST arena
+void frame_layout_free(FrameLayout* l);
 
 Program parse_source(const char* src, size_t len, ParseError* err);
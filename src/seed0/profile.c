@@ -0,0 +1,463 @@
+#define _XOPEN_SOURCE 700
+#include "profile.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+bool prof_enabled = false;
+
+typedef struct ProfFunc {
+  char* name;
+  size_t len;
+  size_t calls;
+  size_t self;       // samples with this function on top
+  size_t total;      // samples with it anywhere on the stack
+  size_t stamp;      // last sample that counted it in `total`
+} ProfFunc;
+
+typedef struct ProfFrame {
+  size_t func;
+  size_t line;       // 0 until the first statement runs
+} ProfFrame;
+
+typedef struct ProfLine {
+  size_t count;      // statements started on this line
+  size_t samples;
+  size_t func;       // function the line was first executed in
+} ProfLine;
+
+typedef struct FoldedStack {
+  char* key;         // NULL marks an empty table entry
+  size_t len;
+  size_t samples;
+} FoldedStack;
+
+#define PROF_PTR_CACHE 64
+
+typedef struct PtrCache {
+  const char* name;
+  size_t len;
+  size_t id;
+} PtrCache;
+
+typedef struct Profiler {
+  const char* src;
+  size_t src_len;
+  unsigned hz;
+  clock_t cpu_start;
+  double cpu_s;
+  size_t samples;
+  size_t statements;
+
+  ProfFunc* funcs;
+  size_t func_count;
+  size_t func_cap;
+  size_t* func_table; // open addressing over funcs by name; SIZE_MAX is empty
+  size_t func_table_cap;
+  PtrCache ptr_cache[PROF_PTR_CACHE];
+
+  ProfFrame* frames;
+  size_t depth;
+  size_t frame_cap;
+
+  ProfLine* lines;    // indexed by source line
+  size_t line_cap;
+
+  FoldedStack* folded;
+  size_t folded_count;
+  size_t folded_cap;
+  char* key;          // scratch for building folded keys
+  size_t key_cap;
+  size_t stamp;
+} Profiler;
+
+static Profiler prof;
+static volatile sig_atomic_t pending_ticks;
+
+static void on_tick(int sig) {
+  (void)sig;
+  pending_ticks = pending_ticks + 1;
+}
+
+static size_t hash_bytes(const char* s, size_t n) {
+  size_t h = 1469598103934665603ULL;
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static void* grow(void* p, size_t* cap, size_t need, size_t elem) {
+  if (need <= *cap) return p;
+  size_t nc = *cap ? *cap : 16;
+  while (nc < need) nc *= 2;
+  void* np = realloc(p, nc * elem);
+  if (!np) {
+    fprintf(stderr, "error: profiler out of memory\n");
+    exit(1);
+  }
+  memset((char*)np + *cap * elem, 0, (nc - *cap) * elem);
+  *cap = nc;
+  return np;
+}
+
+static size_t func_lookup(const char* name, size_t n);
+
+static void func_table_insert(size_t id) {
+  size_t mask = prof.func_table_cap - 1;
+  size_t i = hash_bytes(prof.funcs[id].name, prof.funcs[id].len) & mask;
+  while (prof.func_table[i] != (size_t)-1) i = (i + 1) & mask;
+  prof.func_table[i] = id;
+}
+
+static size_t func_id(const char* name, size_t n) {
+  // callers pass the same name pointer for every call of a function
+  PtrCache* hit = &prof.ptr_cache[((uintptr_t)name >> 3) & (PROF_PTR_CACHE - 1)];
+  if (hit->name == name && hit->len == n && name) return hit->id;
+  size_t id = func_lookup(name, n);
+  hit->name = name;
+  hit->len = n;
+  hit->id = id;
+  return id;
+}
+
+static size_t func_lookup(const char* name, size_t n) {
+  if (prof.func_table_cap) {
+    size_t mask = prof.func_table_cap - 1;
+    for (size_t i = hash_bytes(name, n) & mask;; i = (i + 1) & mask) {
+      size_t id = prof.func_table[i];
+      if (id == (size_t)-1) break;
+      if (prof.funcs[id].len == n && memcmp(prof.funcs[id].name, name, n) == 0) return id;
+    }
+  }
+  // names are copied: VM protos are freed before the report is written
+  prof.funcs = (ProfFunc*)grow(prof.funcs, &prof.func_cap, prof.func_count + 1, sizeof(ProfFunc));
+  size_t id = prof.func_count++;
+  ProfFunc* f = &prof.funcs[id];
+  f->name = (char*)malloc(n + 1);
+  if (!f->name) {
+    fprintf(stderr, "error: profiler out of memory\n");
+    exit(1);
+  }
+  memcpy(f->name, name, n);
+  f->name[n] = '\0';
+  f->len = n;
+  if (prof.func_count * 2 > prof.func_table_cap) {
+    size_t nc = prof.func_table_cap ? prof.func_table_cap * 2 : 32;
+    free(prof.func_table);
+    prof.func_table = (size_t*)malloc(nc * sizeof(size_t));
+    if (!prof.func_table) {
+      fprintf(stderr, "error: profiler out of memory\n");
+      exit(1);
+    }
+    for (size_t i = 0; i < nc; i++) prof.func_table[i] = (size_t)-1;
+    prof.func_table_cap = nc;
+    for (size_t i = 0; i < prof.func_count; i++) func_table_insert(i);
+  } else {
+    func_table_insert(id);
+  }
+  return id;
+}
+
+static void key_put(size_t* at, const char* s, size_t n) {
+  prof.key = (char*)grow(prof.key, &prof.key_cap, *at + n + 1, 1);
+  memcpy(prof.key + *at, s, n);
+  *at += n;
+}
+
+static void add_folded(const char* key, size_t n, size_t ticks) {
+  if ((prof.folded_count + 1) * 2 > prof.folded_cap) {
+    size_t nc = prof.folded_cap ? prof.folded_cap * 2 : 64;
+    FoldedStack* nt = (FoldedStack*)calloc(nc, sizeof(FoldedStack));
+    if (!nt) {
+      fprintf(stderr, "error: profiler out of memory\n");
+      exit(1);
+    }
+    for (size_t i = 0; i < prof.folded_cap; i++) {
+      FoldedStack* old = &prof.folded[i];
+      if (!old->key) continue;
+      size_t j = hash_bytes(old->key, old->len) & (nc - 1);
+      while (nt[j].key) j = (j + 1) & (nc - 1);
+      nt[j] = *old;
+    }
+    free(prof.folded);
+    prof.folded = nt;
+    prof.folded_cap = nc;
+  }
+  size_t mask = prof.folded_cap - 1;
+  size_t i = hash_bytes(key, n) & mask;
+  for (; prof.folded[i].key; i = (i + 1) & mask) {
+    if (prof.folded[i].len == n && memcmp(prof.folded[i].key, key, n) == 0) {
+      prof.folded[i].samples += ticks;
+      return;
+    }
+  }
+  char* copy = (char*)malloc(n + 1);
+  if (!copy) {
+    fprintf(stderr, "error: profiler out of memory\n");
+    exit(1);
+  }
+  memcpy(copy, key, n);
+  copy[n] = '\0';
+  prof.folded[i].key = copy;
+  prof.folded[i].len = n;
+  prof.folded[i].samples = ticks;
+  prof.folded_count++;
+}
+
+// Charge ticks that arrived since the last hook to the stack as it is now,
+// i.e. as it was while they were counted.
+static void charge_pending(void) {
+  size_t ticks = (size_t)pending_ticks;
+  pending_ticks = 0;
+  if (!ticks || !prof.depth) return;
+  prof.samples += ticks;
+  const ProfFrame* top = &prof.frames[prof.depth - 1];
+  prof.funcs[top->func].self += ticks;
+  if (top->line) prof.lines[top->line].samples += ticks;
+
+  prof.stamp++;
+  size_t at = 0;
+  for (size_t i = 0; i < prof.depth; i++) {
+    const ProfFrame* fr = &prof.frames[i];
+    ProfFunc* f = &prof.funcs[fr->func];
+    if (f->stamp != prof.stamp) {
+      f->stamp = prof.stamp;
+      f->total += ticks;
+    }
+    if (i) key_put(&at, ";", 1);
+    key_put(&at, f->name, f->len);
+    if (fr->line) {
+      char num[32];
+      int k = snprintf(num, sizeof(num), ":%zu", fr->line);
+      key_put(&at, num, (size_t)k);
+    }
+  }
+  add_folded(prof.key, at, ticks);
+}
+
+void prof_line(size_t line) {
+  if (pending_ticks) charge_pending();
+  if (!prof.depth) return;
+  ProfFrame* top = &prof.frames[prof.depth - 1];
+  top->line = line;
+  prof.lines = (ProfLine*)grow(prof.lines, &prof.line_cap, line + 1, sizeof(ProfLine));
+  ProfLine* l = &prof.lines[line];
+  if (!l->count && !l->samples) l->func = top->func;
+  l->count++;
+  prof.statements++;
+}
+
+void prof_enter(const char* name, size_t n) {
+  if (pending_ticks) charge_pending();
+  size_t id = func_id(name, n);
+  prof.funcs[id].calls++;
+  prof.frames = (ProfFrame*)grow(prof.frames, &prof.frame_cap, prof.depth + 1, sizeof(ProfFrame));
+  prof.frames[prof.depth].func = id;
+  prof.frames[prof.depth].line = 0;
+  prof.depth++;
+}
+
+void prof_leave(void) {
+  if (pending_ticks) charge_pending();
+  // the script frame stays until the report
+  if (prof.depth > 1) prof.depth--;
+}
+
+bool prof_start(const char* src, size_t len, unsigned hz, char* errbuf, size_t errbuf_n) {
+  memset(&prof, 0, sizeof(prof));
+  prof.src = src;
+  prof.src_len = len;
+  prof.hz = hz ? hz : PROF_DEFAULT_HZ;
+  prof.cpu_start = clock();
+  pending_ticks = 0;
+  prof_enabled = true;
+  prof_enter("<script>", strlen("<script>"));
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_tick;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) != 0) {
+    snprintf(errbuf, errbuf_n, "could not install the profiling signal handler");
+    return false;
+  }
+  struct itimerval it;
+  long usec = 1000000L / (long)prof.hz;
+  if (usec < 1) usec = 1;
+  it.it_interval.tv_sec = usec / 1000000L;
+  it.it_interval.tv_usec = usec % 1000000L;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    snprintf(errbuf, errbuf_n, "could not start the profiling timer");
+    return false;
+  }
+  return true;
+}
+
+static const ProfFunc* sort_funcs;
+static const ProfLine* sort_lines;
+
+static int by_total(const void* a, const void* b) {
+  const ProfFunc* fa = &sort_funcs[*(const size_t*)a];
+  const ProfFunc* fb = &sort_funcs[*(const size_t*)b];
+  if (fa->total != fb->total) return fa->total < fb->total ? 1 : -1;
+  if (fa->self != fb->self) return fa->self < fb->self ? 1 : -1;
+  if (fa->calls != fb->calls) return fa->calls < fb->calls ? 1 : -1;
+  return *(const size_t*)a < *(const size_t*)b ? -1 : 1;
+}
+
+static int by_samples(const void* a, const void* b) {
+  size_t ia = *(const size_t*)a, ib = *(const size_t*)b;
+  const ProfLine* la = &sort_lines[ia];
+  const ProfLine* lb = &sort_lines[ib];
+  if (la->samples != lb->samples) return la->samples < lb->samples ? 1 : -1;
+  if (la->count != lb->count) return la->count < lb->count ? 1 : -1;
+  return ia < ib ? -1 : 1;
+}
+
+static int by_key(const void* a, const void* b) {
+  return strcmp(((const FoldedStack*)a)->key, ((const FoldedStack*)b)->key);
+}
+
+static double percent(size_t part, size_t whole) {
+  return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+// byte offset of every line start up to `max`, so quoting a line is O(1)
+static size_t* line_starts(size_t max) {
+  size_t* starts = (size_t*)calloc(max + 2, sizeof(size_t));
+  if (!starts) return NULL;
+  size_t line = 1, at = 0;
+  starts[1] = 0;
+  while (line < max && at < prof.src_len) {
+    const char* nl = (const char*)memchr(prof.src + at, '\n', prof.src_len - at);
+    at = nl ? (size_t)(nl - prof.src) + 1 : prof.src_len;
+    starts[++line] = at;
+  }
+  while (line < max) starts[++line] = prof.src_len;
+  return starts;
+}
+
+// source text of a line without indentation, at most 60 bytes
+static int line_text(const size_t* starts, size_t line, const char** out) {
+  *out = "";
+  if (!prof.src || !starts) return 0;
+  const char* p = prof.src + starts[line];
+  const char* end = prof.src + prof.src_len;
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  const char* e = p;
+  while (e < end && *e != '\n' && *e != '\r') e++;
+  *out = p;
+  return (int)(e - p > 60 ? 60 : e - p);
+}
+
+static void write_flat(FILE* f) {
+  // the kernel rounds the timer to its tick, so the real rate can be lower
+  fprintf(f, "# astralis profile: %zu samples over %.3f s of CPU time (%u Hz requested), %zu statements executed\n",
+          prof.samples, prof.cpu_s, prof.hz, prof.statements);
+
+  size_t* order = (size_t*)malloc((prof.func_count + 1) * sizeof(size_t));
+  if (!order) return;
+  for (size_t i = 0; i < prof.func_count; i++) order[i] = i;
+  sort_funcs = prof.funcs;
+  qsort(order, prof.func_count, sizeof(size_t), by_total);
+  fprintf(f, "\n# functions\n%7s %8s %7s %8s %12s  %s\n", "self%", "self", "total%", "total", "calls", "function");
+  for (size_t i = 0; i < prof.func_count; i++) {
+    const ProfFunc* fn = &prof.funcs[order[i]];
+    fprintf(f, "%6.1f%% %8zu %6.1f%% %8zu %12zu  %s\n", percent(fn->self, prof.samples), fn->self,
+            percent(fn->total, prof.samples), fn->total, fn->calls, fn->name);
+  }
+  free(order);
+
+  size_t used = 0;
+  for (size_t i = 0; i < prof.line_cap; i++) {
+    if (prof.lines[i].count || prof.lines[i].samples) used++;
+  }
+  order = (size_t*)malloc((used + 1) * sizeof(size_t));
+  if (!order) return;
+  used = 0;
+  for (size_t i = 0; i < prof.line_cap; i++) {
+    if (prof.lines[i].count || prof.lines[i].samples) order[used++] = i;
+  }
+  size_t* starts = line_starts(prof.line_cap);
+  sort_lines = prof.lines;
+  qsort(order, used, sizeof(size_t), by_samples);
+  fprintf(f, "\n# lines\n%7s %8s %12s %6s  %-16s %s\n", "self%", "samples", "count", "line", "function", "source");
+  for (size_t i = 0; i < used; i++) {
+    const ProfLine* l = &prof.lines[order[i]];
+    const char* text;
+    int n = line_text(starts, order[i], &text);
+    fprintf(f, "%6.1f%% %8zu %12zu %6zu  ", percent(l->samples, prof.samples), l->samples, l->count, order[i]);
+    if (n) fprintf(f, "%-16s %.*s\n", prof.funcs[l->func].name, n, text);
+    else fprintf(f, "%s\n", prof.funcs[l->func].name);
+  }
+  free(starts);
+  free(order);
+}
+
+static void write_folded(FILE* f) {
+  // sorted so runs of the same script diff cleanly
+  size_t n = 0;
+  for (size_t i = 0; i < prof.folded_cap; i++) {
+    if (prof.folded[i].key) prof.folded[n++] = prof.folded[i];
+  }
+  for (size_t i = n; i < prof.folded_cap; i++) prof.folded[i].key = NULL;
+  qsort(prof.folded, n, sizeof(FoldedStack), by_key);
+  for (size_t i = 0; i < n; i++) fprintf(f, "%s %zu\n", prof.folded[i].key, prof.folded[i].samples);
+}
+
+static void prof_free(void) {
+  for (size_t i = 0; i < prof.func_count; i++) free(prof.funcs[i].name);
+  free(prof.funcs);
+  free(prof.func_table);
+  free(prof.frames);
+  free(prof.lines);
+  for (size_t i = 0; i < prof.folded_cap; i++) free(prof.folded[i].key);
+  free(prof.folded);
+  free(prof.key);
+  memset(&prof, 0, sizeof(prof));
+}
+
+bool prof_finish(const char* path, char* errbuf, size_t errbuf_n) {
+  struct itimerval off;
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, NULL);
+  signal(SIGPROF, SIG_IGN);
+  charge_pending();
+  prof_enabled = false;
+  prof.cpu_s = (double)(clock() - prof.cpu_start) / CLOCKS_PER_SEC;
+
+  bool ok = true;
+  FILE* flat = fopen(path, "w");
+  if (flat) {
+    write_flat(flat);
+    if (fclose(flat) != 0) ok = false;
+  } else {
+    ok = false;
+  }
+  size_t n = strlen(path);
+  char* folded_path = (char*)malloc(n + sizeof(".folded"));
+  FILE* folded = NULL;
+  if (folded_path) {
+    memcpy(folded_path, path, n);
+    memcpy(folded_path + n, ".folded", sizeof(".folded"));
+    folded = fopen(folded_path, "w");
+  }
+  if (folded) {
+    write_folded(folded);
+    if (fclose(folded) != 0) ok = false;
+  } else {
+    ok = false;
+  }
+  if (!ok) snprintf(errbuf, errbuf_n, "could not write profile %s (and %s)", path, folded_path ? folded_path : ".folded");
+  free(folded_path);
+  prof_free();
+  return ok;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Statement-level sampling profiler behind `--profile`. A CPU-time timer
+// (SIGPROF) only counts ticks; the hooks below charge pending ticks to the
+// shadow stack before they change it, so samples land on the line and call
+// chain that was running when the timer fired. Every hook is guarded by
+// `prof_enabled`, which costs one branch per statement when profiling is off.
+extern bool prof_enabled;
+
+#define PROF_DEFAULT_HZ 1000
+
+// src is the script text, used to quote hot lines in the report
+bool prof_start(const char* src, size_t len, unsigned hz, char* errbuf, size_t errbuf_n);
+// Stop sampling and write the flat profile to `path` and folded stacks
+// (`<script>:4;fib:3;fib:3 42` lines, for flamegraph.pl and friends) to
+// `path.folded`.
+bool prof_finish(const char* path, char* errbuf, size_t errbuf_n);
+
+// a statement on `line` starts in the current function
+void prof_line(size_t line);
+// an Astralis function (not a builtin) was entered / returned or unwound
+void prof_enter(const char* name, size_t n);
+void prof_leave(void);
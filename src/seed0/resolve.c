@@ -0,0 +1,227 @@
+#include "resolve.h"
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Scope {
+  struct Scope* parent;
+  Arena* arena;        // the program's; layouts and param slots live there
+  FrameLayout* layout;
+  size_t layout_cap;
+  int* table;          // open addressing over layout names; -1 is empty
+  size_t table_cap;
+  QuickSite** quick_sites; // the program's chain
+} Scope;
+
+// names are interned, so they are found by pointer
+static int scope_find(const Scope* sc, const char* name) {
+  if (!sc->table_cap) return -1;
+  size_t mask = sc->table_cap - 1;
+  for (size_t i = intern_hash(name) & mask;; i = (i + 1) & mask) {
+    int slot = sc->table[i];
+    if (slot < 0) return -1;
+    if (sc->layout->names[slot] == name) return slot;
+  }
+}
+
+static void table_insert(Scope* sc, int slot) {
+  size_t mask = sc->table_cap - 1;
+  size_t i = intern_hash(sc->layout->names[slot]) & mask;
+  while (sc->table[i] >= 0) i = (i + 1) & mask;
+  sc->table[i] = slot;
+}
+
+static int scope_declare(Scope* sc, const char* s, size_t n) {
+  int found = scope_find(sc, s);
+  if (found >= 0) return found;
+  FrameLayout* l = sc->layout;
+  if (l->count + 1 > sc->layout_cap) {
+    size_t nc = sc->layout_cap ? sc->layout_cap * 2 : 8;
+    l->names = (const char**)arena_grow(sc->arena, l->names, sc->layout_cap * sizeof(char*), nc * sizeof(char*));
+    l->lens = (size_t*)arena_grow(sc->arena, l->lens, sc->layout_cap * sizeof(size_t), nc * sizeof(size_t));
+    sc->layout_cap = nc;
+  }
+  int slot = (int)l->count++;
+  l->names[slot] = s;
+  l->lens[slot] = n;
+  if (l->count * 2 > sc->table_cap) {
+    size_t nc = sc->table_cap ? sc->table_cap * 2 : 16;
+    free(sc->table);
+    sc->table = (int*)malloc(nc * sizeof(int));
+    for (size_t i = 0; i < nc; i++) sc->table[i] = -1;
+    sc->table_cap = nc;
+    for (size_t i = 0; i < l->count; i++) table_insert(sc, (int)i);
+  } else {
+    table_insert(sc, slot);
+  }
+  return slot;
+}
+
+static bool outer_declares(const Scope* sc, const char* name) {
+  for (const Scope* cur = sc->parent; cur; cur = cur->parent) {
+    if (scope_find(cur, name) >= 0) return true;
+  }
+  return false;
+}
+
+// Declarations belong to the frame whose body contains them, including
+// ones nested in if/loop/try blocks but not inside nested `define`s.
+static void collect_block(Scope* sc, const Block* b) {
+  if (!b) return;
+  for (size_t i = 0; i < b->count; i++) {
+    const Stmt* s = &b->stmts[i];
+    switch (s->type) {
+      case STMT_SET:
+      case STMT_LOCK:
+      case STMT_DEFINE:
+        scope_declare(sc, s->name.start, s->name.length);
+        break;
+      case STMT_REPEAT:
+        scope_declare(sc, s->loop_var.start, s->loop_var.length);
+        collect_block(sc, s->block);
+        break;
+      case STMT_IF:
+      case STMT_LOOP_FOREVER:
+      case STMT_TRY:
+        collect_block(sc, s->block);
+        collect_block(sc, s->else_block);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static VarRef local_ref(const Scope* sc, const Token* t, bool check_outer) {
+  VarRef r;
+  r.slot = scope_find(sc, t->start);
+  r.depth = 0;
+  r.shadowed = check_outer && outer_declares(sc, t->start);
+  return r;
+}
+
+static void resolve_expr(Scope* sc, Expr* e) {
+  if (!e) return;
+  switch (e->type) {
+    case EXPR_IDENT: {
+      unsigned depth = 0;
+      for (Scope* cur = sc; cur; cur = cur->parent, depth++) {
+        int slot = scope_find(cur, e->tok.start);
+        if (slot < 0) continue;
+        e->ref.slot = slot;
+        e->ref.depth = depth;
+        e->ref.shadowed = outer_declares(cur, e->tok.start);
+        return;
+      }
+      e->ref.slot = -1;
+      return;
+    }
+    case EXPR_CALL:
+      resolve_expr(sc, e->call.callee);
+      for (size_t i = 0; i < e->call.arg_count; i++) resolve_expr(sc, e->call.args[i]);
+      if (e->call.callee && e->call.callee->type == EXPR_IDENT && e->call.callee->ref.slot < 0) {
+        e->call.site = (CallSite*)arena_alloc(sc->arena, sizeof(CallSite));
+      }
+      return;
+    case EXPR_BINARY:
+      // and/or never quicken; a node without a site just stays generic
+      if (e->op <= BIN_GTE && (e->quick = (QuickSite*)arena_alloc(sc->arena, sizeof(QuickSite)))) {
+        e->quick->next = *sc->quick_sites;
+        *sc->quick_sites = e->quick;
+      }
+      resolve_expr(sc, e->left);
+      resolve_expr(sc, e->right);
+      return;
+    default:
+      resolve_expr(sc, e->left);
+      resolve_expr(sc, e->right);
+      resolve_expr(sc, e->cond);
+      return;
+  }
+}
+
+static void scope_release(Scope* sc) {
+  free(sc->table);
+  sc->table = NULL;
+  sc->table_cap = 0;
+}
+
+static void resolve_block(Scope* sc, Block* b);
+
+static void resolve_function(Scope* parent, Stmt* s) {
+  Scope sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.parent = parent;
+  sc.arena = parent->arena;
+  sc.quick_sites = parent->quick_sites;
+  sc.layout = &s->frame;
+  if (s->param_count) s->param_slots = (int*)arena_alloc(sc.arena, s->param_count * sizeof(int));
+  for (size_t i = 0; i < s->param_count; i++) {
+    s->param_slots[i] = scope_declare(&sc, s->params[i].start, s->params[i].length);
+  }
+  collect_block(&sc, s->block);
+  resolve_block(&sc, s->block);
+  scope_release(&sc);
+}
+
+static void resolve_block(Scope* sc, Block* b) {
+  if (!b) return;
+  for (size_t i = 0; i < b->count; i++) {
+    Stmt* s = &b->stmts[i];
+    resolve_expr(sc, s->expr);
+    resolve_expr(sc, s->expr_b);
+    switch (s->type) {
+      case STMT_SET:
+      case STMT_LOCK:
+        s->ref = local_ref(sc, &s->name, true);
+        break;
+      case STMT_DEFINE:
+        s->ref = local_ref(sc, &s->name, false);
+        resolve_function(sc, s);
+        continue;
+      case STMT_REPEAT:
+        s->ref = local_ref(sc, &s->loop_var, false);
+        break;
+      default:
+        break;
+    }
+    resolve_block(sc, s->block);
+    resolve_block(sc, s->else_block);
+  }
+}
+
+size_t resolve_append_pieces(const Stmt* s, const Expr** pieces) {
+  if (s->type != STMT_SET || s->ref.slot < 0 || s->ref.shadowed) return 0;
+  size_t n = 0;
+  const Expr* e = s->expr;
+  while (e && e->type == EXPR_BINARY && e->op == BIN_ADD) {
+    if (n == APPEND_MAX_PIECES) return 0;
+    pieces[n++] = e->right;
+    e = e->left;
+  }
+  if (!n || e->type != EXPR_IDENT || e->ref.slot != s->ref.slot || e->ref.depth != 0) return 0;
+  // collected outermost first; evaluation order is innermost first
+  for (size_t i = 0; i < n / 2; i++) {
+    const Expr* t = pieces[i];
+    pieces[i] = pieces[n - 1 - i];
+    pieces[n - 1 - i] = t;
+  }
+  return n;
+}
+
+void resolve_program(Program* p, const char* const* predeclared, size_t predeclared_n) {
+  Scope sc;
+  memset(&sc, 0, sizeof(sc));
+  memset(&p->globals, 0, sizeof(p->globals));
+  p->quick_sites = NULL;
+  sc.arena = &p->arena;
+  sc.quick_sites = &p->quick_sites;
+  sc.layout = &p->globals;
+  for (size_t i = 0; i < predeclared_n; i++) {
+    const char* name = intern(predeclared[i], strlen(predeclared[i]));
+    if (name) scope_declare(&sc, name, strlen(name));
+  }
+  collect_block(&sc, &p->block);
+  resolve_block(&sc, &p->block);
+  scope_release(&sc);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "parser.h"
+
+// Assign every identifier, set/lock/define target, repeat variable and
+// parameter a (depth, slot) address. Frames are the global scope and each
+// `define` body; blocks do not open scopes. `predeclared` names (builtins)
+// get global slots ahead of the program's own names.
+void resolve_program(Program* p, const char* const* predeclared, size_t predeclared_n);
+
+#define APPEND_MAX_PIECES 16
+
+// For `set x to x + a + b ...` on a resolved local, store the right-hand
+// operands a, b, ... in order and return how many there are (0 otherwise).
+// Engines use this to grow x in place instead of rebuilding it.
+size_t resolve_append_pieces(const Stmt* s, const Expr** pieces);
@@ -1,46 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
 #include "runtime.h"
+#include "trace.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-static char* dup_n(const char* s, size_t n) {
-  char* out = (char*)malloc(n + 1);
-  if (!out) return NULL;
-  memcpy(out, s, n);
-  out[n] = '\0';
-  return out;
+// Output engine: values are formatted straight into a reusable buffer that
+// goes to the stream in large writes. `warn` keeps stderr's unbuffered
+// behaviour by flushing its own buffer at the end of every line.
+typedef struct OutBuf {
+  FILE* f;
+  char* data;
+  size_t len;
+  size_t cap;
+  bool line_flush;   // flush after each line (TTY, or stderr)
+} OutBuf;
+
+static char out_small[256];
+static char err_small[256];
+static OutBuf out = {NULL, out_small, 0, sizeof(out_small), false};
+static OutBuf err = {NULL, err_small, 0, sizeof(err_small), true};
+static bool out_ready = false;
+
+void rt_flush(void) {
+  if (out.len) {
+    if (trace_enabled) trace_begin(TRACE_IO, "flush stdout", strlen("flush stdout"));
+    fwrite(out.data, 1, out.len, out.f ? out.f : stdout);
+    if (trace_enabled) trace_end();
+    out.len = 0;
+  }
+  fflush(out.f ? out.f : stdout);
+}
+
+static void buf_flush(OutBuf* b) {
+  if (b == &out) { rt_flush(); return; }
+  if (b->len) {
+    if (trace_enabled) trace_begin(TRACE_IO, "flush stderr", strlen("flush stderr"));
+    fwrite(b->data, 1, b->len, b->f);
+    if (trace_enabled) trace_end();
+  }
+  b->len = 0;
+  fflush(b->f);
+}
+
+void rt_output_init(size_t buffer_size) {
+  if (out_ready) rt_flush();
+  out.f = stdout;
+  err.f = stderr;
+  // the stdio layer underneath only ever sees full chunks
+  setvbuf(stdout, NULL, _IONBF, 0);
+  out.line_flush = isatty(fileno(stdout)) != 0;
+  if (buffer_size == 0) buffer_size = RT_OUTPUT_DEFAULT;
+  char* data = (char*)malloc(buffer_size);
+  if (out.data != out_small) free(out.data);
+  out.data = data ? data : out_small;
+  out.cap = data ? buffer_size : sizeof(out_small);
+  if (!out_ready) atexit(rt_flush);
+  out_ready = true;
+}
+
+static void out_ensure(void) {
+  if (!out_ready) rt_output_init(RT_OUTPUT_DEFAULT);
+}
+
+static void buf_put(OutBuf* b, const char* s, size_t n) {
+  if (b->len + n > b->cap) {
+    buf_flush(b);
+    if (n > b->cap) {
+      if (trace_enabled) trace_begin(TRACE_IO, b == &out ? "write stdout" : "write stderr", strlen("write stdout"));
+      fwrite(s, 1, n, b->f);
+      if (trace_enabled) trace_end();
+      return;
+    }
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+}
+
+static void buf_long(OutBuf* b, long x) {
+  char tmp[24];
+  char* p = tmp + sizeof(tmp);
+  unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+  do {
+    *--p = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (x < 0) *--p = '-';
+  buf_put(b, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+#define BUF_LIT(b, lit) buf_put((b), (lit), sizeof(lit) - 1)
+
+// same text as value_to_cstring, without the allocation
+static void buf_value(OutBuf* b, const Value* v) {
+  switch (v->type) {
+    case VAL_NULL: BUF_LIT(b, "null"); return;
+    case VAL_INT: buf_long(b, v->i); return;
+    case VAL_BOOL:
+      if (v->b) BUF_LIT(b, "true");
+      else BUF_LIT(b, "false");
+      return;
+    case VAL_STRING:
+      buf_put(b, value_str(v), value_strlen(v));
+      return;
+    case VAL_ERROR:
+      if (!v->str) { BUF_LIT(b, "error"); return; }
+      BUF_LIT(b, "error: ");
+      buf_put(b, value_str(v), value_strlen(v));
+      return;
+    case VAL_FUNC: BUF_LIT(b, "<function>"); return;
+    case VAL_BUILTIN: BUF_LIT(b, "<builtin>"); return;
+    case VAL_LIST: {
+      char* text = value_to_cstring(v);
+      if (text) buf_put(b, text, strlen(text));
+      free(text);
+      return;
+    }
+  }
+  BUF_LIT(b, "<?>");
+}
+
+static void buf_end_line(OutBuf* b) {
+  buf_put(b, "\n", 1);
+  if (b->line_flush) buf_flush(b);
 }
 
 void rt_show(const Value* v) {
-  char* s = value_to_cstring(v);
-  if (!s) return;
-  fputs(s, stdout);
-  fputc('\n', stdout);
-  free(s);
+  out_ensure();
+  buf_value(&out, v);
+  buf_end_line(&out);
 }
 
 void rt_warn(const Value* v) {
-  char* s = value_to_cstring(v);
-  if (!s) return;
-  fputs("warning: ", stderr);
-  fputs(s, stderr);
-  fputc('\n', stderr);
-  free(s);
+  err.f = stderr;
+  BUF_LIT(&err, "warning: ");
+  buf_value(&err, v);
+  buf_end_line(&err);
+}
+
+// Line input: each source reads large chunks into one buffer and hands out
+// lines as views into it, so a line is copied once, into its string value.
+// The buffer grows to fit lines longer than itself.
+#define READER_CHUNK (1024 * 1024)
+#define READER_FILES 16
+
+typedef struct LineReader {
+  FILE* f;
+  char* path;       // NULL for stdin
+  char* buf;
+  size_t start;     // next unread byte
+  size_t end;       // end of buffered data
+  size_t cap;
+  bool eof;
+} LineReader;
+
+static LineReader in_reader;
+static LineReader file_readers[READER_FILES];
+
+static bool reader_fill(LineReader* r) {
+  if (r->eof) return false;
+  if (r->start > 0) {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end == r->cap) {
+    size_t cap = r->cap ? r->cap * 2 : READER_CHUNK;
+    char* grown = (char*)realloc(r->buf, cap);
+    if (!grown) return false;
+    r->buf = grown;
+    r->cap = cap;
+  }
+  size_t got = fread(r->buf + r->end, 1, r->cap - r->end, r->f);
+  r->end += got;
+  if (got == 0) r->eof = true;
+  return got > 0;
+}
+
+// next line without its terminator; false at end of input
+static bool reader_line(LineReader* r, const char** line, size_t* n) {
+  size_t scanned = r->start;
+  for (;;) {
+    char* nl = r->end > scanned ? (char*)memchr(r->buf + scanned, '\n', r->end - scanned) : NULL;
+    if (nl) {
+      *line = r->buf + r->start;
+      *n = (size_t)(nl - *line);
+      r->start += *n + 1;
+      break;
+    }
+    size_t seen = r->end - r->start;
+    if (!reader_fill(r)) {
+      if (r->start == r->end) return false;
+      *line = r->buf + r->start;
+      *n = r->end - r->start;
+      r->start = r->end;
+      break;
+    }
+    scanned = r->start + seen;
+  }
+  while (*n > 0 && (*line)[*n - 1] == '\r') (*n)--;
+  return true;
+}
+
+static bool reader_has_line(LineReader* r) {
+  return r->start < r->end || reader_fill(r);
+}
+
+static LineReader* reader_for(const Value* source, Value* err) {
+  if (!source) {
+    if (!in_reader.f) in_reader.f = stdin;
+    return &in_reader;
+  }
+  if (source->type != VAL_STRING || !source->str) {
+    *err = value_error("line source must be a file path", strlen("line source must be a file path"));
+    return NULL;
+  }
+  // literal paths are spans of the script, so compare by length
+  const char* path = value_str(source);
+  size_t n = value_strlen(source);
+  LineReader* slot = NULL;
+  for (size_t i = 0; i < READER_FILES; i++) {
+    LineReader* r = &file_readers[i];
+    if (r->path && strlen(r->path) == n && memcmp(r->path, path, n) == 0) return r;
+    if (!r->path && !slot) slot = r;
+  }
+  if (!slot) {
+    *err = value_error("too many open line sources", strlen("too many open line sources"));
+    return NULL;
+  }
+  slot->path = (char*)malloc(n + 1);
+  if (!slot->path) {
+    *err = value_error("out of memory", strlen("out of memory"));
+    return NULL;
+  }
+  memcpy(slot->path, path, n);
+  slot->path[n] = '\0';
+  FILE* f = fopen(slot->path, "rb");
+  if (!f) {
+    free(slot->path);
+    slot->path = NULL;
+    *err = value_error("could not open line source", strlen("could not open line source"));
+    return NULL;
+  }
+  slot->f = f;
+  return slot;
+}
+
+Value rt_has_line(const Value* source) {
+  Value err;
+  LineReader* r = reader_for(source, &err);
+  if (!r) return err;
+  return value_bool(reader_has_line(r));
+}
+
+Value rt_next_line(const Value* source) {
+  Value err;
+  LineReader* r = reader_for(source, &err);
+  if (!r) return err;
+  const char* line;
+  size_t n;
+  if (!reader_line(r, &line, &n)) return value_error("end of input", strlen("end of input"));
+  return value_string(line, n);
 }
 
 Value rt_ask(const Value* prompt) {
-  char* p = value_to_cstring(prompt);
-  if (!p) p = dup_n("", 0);
-  fputs(p, stdout);
-  fflush(stdout);
-  free(p);
-
-  char buf[4096];
-  if (!fgets(buf, sizeof(buf), stdin)) {
+  out_ensure();
+  buf_value(&out, prompt);
+  rt_flush();
+
+  if (!in_reader.f) in_reader.f = stdin;
+  const char* line;
+  size_t n;
+  if (!reader_line(&in_reader, &line, &n)) {
     return value_error("stdin read failed", strlen("stdin read failed"));
   }
-  // strip trailing newline
-  size_t n = strlen(buf);
-  while (n > 0 && (buf[n-1] == '\n' || buf[n-1] == '\r')) buf[--n] = '\0';
-  return value_string(buf, n);
+  return value_string(line, n);
 }
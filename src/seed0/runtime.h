@@ -2,8 +2,18 @@
 #include "value.h"
 
 // output
+#define RT_OUTPUT_DEFAULT (64 * 1024)
+// Size the stdout buffer (0 picks the default) and pick the flush policy:
+// per line on a TTY, when full otherwise. Pending output is flushed by `ask`
+// and at exit.
+void rt_output_init(size_t buffer_size);
+void rt_flush(void);
 void rt_show(const Value* v);
 void rt_warn(const Value* v);
 
-// input
+// input: `ask`, `has_line` and `next_line` share one buffered stdin reader.
+// A NULL source means stdin; otherwise it is a file path string, opened on
+// first use. Lines come back without their "\n" or "\r\n" terminator.
 Value rt_ask(const Value* prompt);
+Value rt_has_line(const Value* source);
+Value rt_next_line(const Value* source);
@@ -0,0 +1,56 @@
+#include "stats.h"
+
+#ifdef ASTR_STATS
+Stats astr_stats;
+
+static double ratio(size_t a, size_t b) {
+  return b ? (double)a / (double)b : 0.0;
+}
+
+void stats_print(FILE* f) {
+  const Stats* s = &astr_stats;
+  fprintf(f, "stats: allocations %zu (%zu bytes requested), %zu reallocs, %zu frees\n",
+          s->allocs, s->alloc_bytes, s->reallocs, s->frees);
+  fprintf(f, "stats: strings     %zu created (%zu bytes), %zu shared, %zu appended in place\n",
+          s->strings, s->string_bytes, s->string_shares, s->string_appends);
+  fprintf(f, "stats: lists       %zu created (%zu slices), %zu boxed\n",
+          s->lists, s->list_slices, s->list_boxed);
+  fprintf(f, "stats: lookups     %zu by name (avg chain depth %.2f), %zu by slot (avg depth %.2f)\n",
+          s->lookups, ratio(s->lookup_frames, s->lookups), s->slot_refs, ratio(s->slot_depth, s->slot_refs));
+  fprintf(f, "stats: frames      %zu pushed, peak %zu live, peak %zu bindings in one Env\n",
+          s->frames, s->peak_frames, s->peak_bindings);
+  fprintf(f, "stats: calls       %zu functions (%zu tail calls), %zu builtins\n", s->calls, s->tail_calls, s->builtin_calls);
+  fprintf(f, "stats: jit         %zu compiled, %zu native runs, %zu bailed out\n", s->jit_compiled, s->jit_runs, s->jit_bails);
+}
+
+void stats_print_json(FILE* f) {
+  const Stats* s = &astr_stats;
+  fprintf(f, "{\"allocs\": %zu, \"reallocs\": %zu, \"frees\": %zu, \"alloc_bytes\": %zu, "
+             "\"strings\": %zu, \"string_bytes\": %zu, \"string_shares\": %zu, \"string_appends\": %zu, "
+             "\"lists\": %zu, \"list_slices\": %zu, \"list_boxed\": %zu, "
+             "\"lookups\": %zu, \"lookup_frames\": %zu, \"avg_lookup_depth\": %.4f, "
+             "\"slot_refs\": %zu, \"slot_depth\": %zu, "
+             "\"frames\": %zu, \"peak_frames\": %zu, \"peak_bindings\": %zu, "
+             "\"calls\": %zu, \"tail_calls\": %zu, \"builtin_calls\": %zu, "
+             "\"jit_compiled\": %zu, \"jit_runs\": %zu, \"jit_bails\": %zu}\n",
+          s->allocs, s->reallocs, s->frees, s->alloc_bytes,
+          s->strings, s->string_bytes, s->string_shares, s->string_appends,
+          s->lists, s->list_slices, s->list_boxed,
+          s->lookups, s->lookup_frames, ratio(s->lookup_frames, s->lookups),
+          s->slot_refs, s->slot_depth,
+          s->frames, s->peak_frames, s->peak_bindings,
+          s->calls, s->tail_calls, s->builtin_calls,
+          s->jit_compiled, s->jit_runs, s->jit_bails);
+}
+
+#else
+
+void stats_print(FILE* f) {
+  (void)f;
+}
+
+void stats_print_json(FILE* f) {
+  (void)f;
+}
+
+#endif
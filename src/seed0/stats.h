@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Runtime counters behind `--stats`. They exist only in builds made with
+// `make STATS=1` (-DASTR_STATS); otherwise every STAT_* macro expands to
+// nothing and the hot paths are untouched. Allocation counts come from
+// wrapping malloc/calloc/realloc/free at link time (-Wl,--wrap), so they
+// cover every allocation seed0 itself makes.
+#ifdef ASTR_STATS
+#define STATS_ENABLED 1
+
+typedef struct Stats {
+  size_t allocs;          // malloc + calloc
+  size_t reallocs;
+  size_t frees;           // non-NULL frees
+  size_t alloc_bytes;     // requested by malloc/calloc/realloc
+
+  size_t strings;         // string payloads created
+  size_t string_bytes;
+  size_t string_shares;   // value_copy of a counted string: a refcount bump
+  size_t string_appends;  // in-place appends that avoided a new string
+
+  size_t lists;           // lists created, slices included
+  size_t list_slices;     // windows onto another list's items
+  size_t list_boxed;      // packed int lists turned into Values
+
+  size_t lookups;         // by-name binding lookups
+  size_t lookup_frames;   // Env frames those lookups walked
+  size_t slot_refs;       // resolved (depth, slot) accesses through env_slot
+  size_t slot_depth;      // parent links those accesses followed
+
+  size_t frames;          // Envs pushed
+  size_t live_frames;
+  size_t peak_frames;
+  size_t peak_bindings;   // most bindings held by a single Env
+
+  size_t calls;           // Astralis function calls
+  size_t tail_calls;      // of those, run in the caller's frame
+  size_t builtin_calls;
+
+  size_t jit_compiled;    // functions compiled to machine code
+  size_t jit_runs;        // calls that ran natively from the interpreter
+  size_t jit_bails;       // native runs that gave up and were interpreted
+} Stats;
+
+extern Stats astr_stats;
+
+#define STAT_INC(field) (astr_stats.field++)
+#define STAT_ADD(field, n) (astr_stats.field += (size_t)(n))
+#define STAT_DEC(field) (astr_stats.field--)
+#define STAT_MAX(field, v) \
+  do { if ((size_t)(v) > astr_stats.field) astr_stats.field = (size_t)(v); } while (0)
+
+#else
+#define STATS_ENABLED 0
+#define STAT_INC(field) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_DEC(field) ((void)0)
+#define STAT_MAX(field, v) ((void)0)
+#endif
+
+// summary lines on `f`, or one JSON object; no-ops without ASTR_STATS
+void stats_print(FILE* f);
+void stats_print_json(FILE* f);
@@ -0,0 +1,34 @@
+#include "stats.h"
+
+// --wrap=malloc routes every call in our objects here; __real_* is libc's.
+// Only STATS=1 builds of astralis link this file, because only they pass the
+// --wrap flags. libseed0.a leaves it out, so programs built from --emit-c
+// output link without them.
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t count, size_t n);
+void* __real_realloc(void* p, size_t n);
+void __real_free(void* p);
+
+void* __wrap_malloc(size_t n) {
+  astr_stats.allocs++;
+  astr_stats.alloc_bytes += n;
+  return __real_malloc(n);
+}
+
+void* __wrap_calloc(size_t count, size_t n) {
+  astr_stats.allocs++;
+  astr_stats.alloc_bytes += count * n;
+  return __real_calloc(count, n);
+}
+
+void* __wrap_realloc(void* p, size_t n) {
+  if (p) astr_stats.reallocs++;
+  else astr_stats.allocs++;
+  astr_stats.alloc_bytes += n;
+  return __real_realloc(p, n);
+}
+
+void __wrap_free(void* p) {
+  if (p) astr_stats.frees++;
+  __real_free(p);
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+bool trace_enabled = false;
+
+// Names are borrowed: source tokens, proto names and builtin tables all
+// outlive the run, and the trace is written before they are freed.
+typedef struct TraceSpan {
+  uint64_t start;    // ns since trace_start
+  uint64_t dur;
+  const char* name;
+  uint32_t len;
+  uint8_t cat;
+} TraceSpan;
+
+typedef struct Tracer {
+  uint64_t origin;
+  TraceSpan* ring;
+  size_t cap;
+  size_t next;       // total spans recorded; ring index is next % cap
+  TraceSpan* open;   // spans begun but not ended, innermost last
+  size_t open_count;
+  size_t open_cap;
+  size_t lost;       // begins that found no room; their ends are ignored
+} Tracer;
+
+static Tracer tr;
+
+static const char* const CAT_NAMES[] = {"call", "builtin", "io"};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+bool trace_start(size_t capacity, char* errbuf, size_t errbuf_n) {
+  memset(&tr, 0, sizeof(tr));
+  tr.cap = capacity ? capacity : TRACE_DEFAULT_EVENTS;
+  // untouched pages of a large ring are never faulted in
+  tr.ring = (TraceSpan*)malloc(tr.cap * sizeof(TraceSpan));
+  if (!tr.ring) {
+    snprintf(errbuf, errbuf_n, "could not allocate a trace buffer of %zu events", tr.cap);
+    return false;
+  }
+  tr.origin = now_ns();
+  trace_enabled = true;
+  return true;
+}
+
+void trace_begin(TraceCat cat, const char* name, size_t n) {
+  if (tr.open_count == tr.open_cap) {
+    size_t nc = tr.open_cap ? tr.open_cap * 2 : 64;
+    TraceSpan* grown = (TraceSpan*)realloc(tr.open, nc * sizeof(TraceSpan));
+    if (!grown) { tr.lost++; return; }
+    tr.open = grown;
+    tr.open_cap = nc;
+  }
+  TraceSpan* s = &tr.open[tr.open_count++];
+  s->start = now_ns() - tr.origin;
+  s->dur = 0;
+  s->name = name;
+  s->len = (uint32_t)n;
+  s->cat = (uint8_t)cat;
+}
+
+void trace_end(void) {
+  if (tr.lost) { tr.lost--; return; }
+  if (!tr.open_count) return;
+  TraceSpan s = tr.open[--tr.open_count];
+  s.dur = now_ns() - tr.origin - s.start;
+  tr.ring[tr.next % tr.cap] = s;
+  tr.next++;
+}
+
+static void put_name(FILE* f, const char* s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+    else if (c < 0x20) fprintf(f, "\\u%04x", c);
+    else fputc(c, f);
+  }
+}
+
+bool trace_finish(const char* path, char* errbuf, size_t errbuf_n) {
+  tr.lost = 0;
+  while (tr.open_count) trace_end();
+  trace_enabled = false;
+
+  FILE* f = fopen(path, "w");
+  bool ok = f != NULL;
+  if (f) {
+    long pid = (long)getpid();
+    size_t kept = tr.next < tr.cap ? tr.next : tr.cap;
+    size_t dropped = tr.next - kept;
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"spans\": %zu, \"dropped\": %zu},\n", tr.next, dropped);
+    fprintf(f, "\"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": 1, \"args\": {\"name\": \"astralis\"}},\n", pid);
+    fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": 1, \"args\": {\"name\": \"main\"}}", pid);
+    // oldest first; spans are recorded when they end, so parents follow children
+    for (size_t i = tr.next - kept; i < tr.next; i++) {
+      const TraceSpan* s = &tr.ring[i % tr.cap];
+      fprintf(f, ",\n{\"name\": \"");
+      put_name(f, s->name, s->len);
+      fprintf(f, "\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %llu.%03u, \"dur\": %llu.%03u, \"pid\": %ld, \"tid\": 1}",
+              CAT_NAMES[s->cat], (unsigned long long)(s->start / 1000), (unsigned)(s->start % 1000),
+              (unsigned long long)(s->dur / 1000), (unsigned)(s->dur % 1000), pid);
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) ok = false;
+  }
+  if (!ok) snprintf(errbuf, errbuf_n, "could not write trace %s", path);
+  free(tr.ring);
+  free(tr.open);
+  memset(&tr, 0, sizeof(tr));
+  return ok;
+}
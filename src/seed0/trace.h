@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Timeline tracing behind `--trace`: spans for Astralis calls, builtin calls
+// and output flushes, written as a Chrome/Perfetto JSON trace at exit. Each
+// completed span is one record in a fixed-size ring, so a long run keeps its
+// most recent events and memory stays bounded. Hooks are guarded by
+// `trace_enabled`, which is a single branch when tracing is off.
+extern bool trace_enabled;
+
+#define TRACE_DEFAULT_EVENTS (1u << 20)
+
+typedef enum TraceCat {
+  TRACE_CALL = 0,    // Astralis function
+  TRACE_BUILTIN,     // ask, has_line, ...
+  TRACE_IO           // show/warn buffer flushed to its stream
+} TraceCat;
+
+bool trace_start(size_t capacity, char* errbuf, size_t errbuf_n);
+// spans nest: every begin is closed by the next unmatched end
+void trace_begin(TraceCat cat, const char* name, size_t n);
+void trace_end(void);
+// closes spans still open, writes the JSON and releases the ring
+bool trace_finish(const char* path, char* errbuf, size_t errbuf_n);
@@ -1,4 +1,6 @@
 #include "value.h"
+#include "list.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,50 +13,103 @@ static char* dup_n(const char* s, size_t n) {
   return out;
 }
 
+_Static_assert(sizeof(Value) <= 16, "Value must stay two words");
+
+static bool has_string(const Value* v) {
+  return (v->type == VAL_STRING || v->type == VAL_ERROR) && v->str;
+}
+
+static char* str_inline(Str* h) {
+  return (char*)(h + 1);
+}
+
+static Str* str_new(const char* s, size_t n, char** data) {
+  Str* h = (Str*)malloc(sizeof(Str) + n + 1);
+  if (!h) return NULL;
+  STAT_INC(strings);
+  STAT_ADD(string_bytes, n);
+  h->refs = 1;
+  h->len = n;
+  h->cap = n;
+  char* out = str_inline(h);
+  h->data = out;
+  if (s) memcpy(out, s, n);
+  out[n] = '\0';
+  if (data) *data = out;
+  return h;
+}
+
 Value value_null(void) {
-  Value v; v.type = VAL_NULL; v.i = 0; v.s = NULL; return v;
+  Value v; v.type = VAL_NULL; v.i = 0; return v;
 }
 Value value_int(long x) {
-  Value v; v.type = VAL_INT; v.i = x; v.s = NULL; return v;
+  Value v; v.type = VAL_INT; v.i = x; return v;
 }
 Value value_string(const char* s, size_t n) {
-  Value v; v.type = VAL_STRING; v.i = 0; v.s = dup_n(s, n); return v;
+  Value v; v.type = VAL_STRING; v.str = str_new(s, n, NULL); return v;
 }
+Value value_string_uninit(size_t n, char** data) {
+  Value v; v.type = VAL_STRING; v.str = str_new(NULL, n, data); return v;
+}
+bool value_string_reserve(Value* v, size_t n) {
+  if (v->type != VAL_STRING || !v->str) return false;
+  Str* h = v->str;
+  if (h->refs != 1) return false;
+  if (h->len + n > h->cap) {
+    size_t cap = h->cap * 2;
+    if (cap < h->len + n) cap = h->len + n;
+    if (cap < 32) cap = 32;
+    Str* grown = (Str*)realloc(h, sizeof(Str) + cap + 1);
+    if (!grown) return false;
+    h = grown;
+    h->cap = cap;
+    h->data = str_inline(h);
+    v->str = h;
+  }
+  return true;
+}
+
+bool value_string_append(Value* v, const char* s, size_t n) {
+  if (!value_string_reserve(v, n)) return false;
+  Str* h = v->str;
+  char* data = str_inline(h);
+  memcpy(data + h->len, s, n);
+  STAT_INC(string_appends);
+  h->len += n;
+  data[h->len] = '\0';
+  return true;
+}
+
 Value value_error(const char* s, size_t n) {
-  Value v; v.type = VAL_ERROR; v.i = 0; v.s = dup_n(s, n); return v;
+  Value v; v.type = VAL_ERROR; v.str = str_new(s, n, NULL); return v;
 }
 Value value_bool(bool b) {
-  Value v; v.type = VAL_BOOL; v.b = b; v.s = NULL; v.i = 0; v.func = NULL; v.builtin = NULL; return v;
+  Value v; v.type = VAL_BOOL; v.i = 0; v.b = b; return v;
 }
 Value value_func(struct Function* fn) {
-  Value v; v.type = VAL_FUNC; v.func = fn; v.s = NULL; v.i = 0; v.builtin = NULL; return v;
+  Value v; v.type = VAL_FUNC; v.func = fn; return v;
 }
 Value value_builtin(const struct Builtin* b) {
-  Value v; v.type = VAL_BUILTIN; v.builtin = b; v.s = NULL; v.i = 0; v.func = NULL; return v;
+  Value v; v.type = VAL_BUILTIN; v.builtin = b; return v;
 }
 
-void value_free(Value* v) {
-  if (!v) return;
-  if (v->s) free(v->s);
-  v->s = NULL;
+void value_free_string(Value* v) {
+  if (has_string(v)) {
+    Str* h = v->str;
+    if (h->refs && --h->refs == 0) free(h);
+  }
   v->type = VAL_NULL;
   v->i = 0;
-  v->b = false;
-  v->func = NULL;
-  v->builtin = NULL;
 }
 
-Value value_copy(const Value* v) {
-  if (!v) return value_null();
-  Value out;
-  out.type = v->type;
-  out.i = v->i;
-  out.s = NULL;
-  out.b = v->b;
-  out.func = v->func;
-  out.builtin = v->builtin;
-  if ((v->type == VAL_STRING || v->type == VAL_ERROR) && v->s) {
-    out.s = dup_n(v->s, strlen(v->s));
+Value value_copy_string(const Value* v) {
+  Value out = *v;
+  if (has_string(v)) {
+    Str* h = v->str;
+    if (h->refs) {
+      h->refs++;
+      STAT_INC(string_shares);
+    }
   }
   return out;
 }
@@ -71,19 +126,18 @@ char* value_to_cstring(const Value* v) {
     return dup_n(v->b ? "true" : "false", v->b ? 4 : 5);
   }
   if (v->type == VAL_STRING) {
-    if (!v->s) return dup_n("", 0);
-    return dup_n(v->s, strlen(v->s));
+    return dup_n(value_str(v), value_strlen(v));
   }
   if (v->type == VAL_ERROR) {
-    if (!v->s) return dup_n("error", 5);
+    if (!v->str) return dup_n("error", 5);
     // prefix
     const char* p = "error: ";
     size_t pn = strlen(p);
-    size_t sn = strlen(v->s);
+    size_t sn = value_strlen(v);
     char* out = (char*)malloc(pn + sn + 1);
     if (!out) return NULL;
     memcpy(out, p, pn);
-    memcpy(out + pn, v->s, sn);
+    memcpy(out + pn, value_str(v), sn);
     out[pn + sn] = '\0';
     return out;
   }
@@ -93,6 +147,9 @@ char* value_to_cstring(const Value* v) {
   if (v->type == VAL_BUILTIN) {
     return dup_n("<builtin>", strlen("<builtin>"));
   }
+  if (v->type == VAL_LIST) {
+    return list_to_cstring(v->list);
+  }
   return dup_n("<?>", 3);
 }
 
@@ -102,8 +159,9 @@ bool value_is_truthy(const Value* v) {
     case VAL_NULL: return false;
     case VAL_BOOL: return v->b;
     case VAL_INT: return v->i != 0;
-    case VAL_STRING: return v->s && v->s[0] != '\0';
+    case VAL_STRING: return value_strlen(v) != 0;
     case VAL_ERROR: return false;
+    case VAL_LIST: return v->list->len != 0;
     default: return true;
   }
 }
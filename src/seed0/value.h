@@ -9,31 +9,103 @@ typedef enum ValueType {
   VAL_ERROR,
   VAL_BOOL,
   VAL_FUNC,
-  VAL_BUILTIN
+  VAL_BUILTIN,
+  VAL_LIST
 } ValueType;
 
 struct Function;
 struct Builtin;
+struct List;
 
+// String payloads are immutable and shared. Owned strings keep their text
+// right after the Str, NUL-terminated. refs == 0 marks an interned string
+// (intern.h): copies share it without counting, and two interned strings
+// are equal only when they are the same Str.
+typedef struct Str {
+  size_t refs;
+  size_t len;
+  size_t cap;        // bytes available for text; > len after in-place appends
+  const char* data;
+} Str;
+
+// 16 bytes: a tag plus one payload word. Only the member named by `type`
+// is meaningful; read the others and you get another type's bits.
 typedef struct Value {
   ValueType type;
-  long i;
-  char* s;       // heap string for VAL_STRING or VAL_ERROR message
-  bool b;
-  struct Function* func;
-  const struct Builtin* builtin;
+  union {
+    long i;                          // VAL_INT
+    Str* str;                        // VAL_STRING, or VAL_ERROR message
+    bool b;                          // VAL_BOOL
+    struct Function* func;           // VAL_FUNC
+    const struct Builtin* builtin;   // VAL_BUILTIN
+    struct List* list;               // VAL_LIST (list.h)
+  };
 } Value;
 
 Value value_null(void);
 Value value_int(long x);
 Value value_string(const char* s, size_t n);
+// new string of n bytes for the caller to fill through *data before sharing it
+Value value_string_uninit(size_t n, char** data);
+// Append to a string in place when `v` holds its only reference, growing the
+// buffer geometrically so repeated appends are amortized linear. Returns false
+// and leaves `v` untouched when the string is shared or unowned.
+bool value_string_append(Value* v, const char* s, size_t n);
+// make room for n more bytes under the same conditions, so the appends that
+// follow cannot fail
+bool value_string_reserve(Value* v, size_t n);
 Value value_error(const char* s, size_t n);
 Value value_bool(bool b);
 Value value_func(struct Function* fn);
 Value value_builtin(const struct Builtin* b);
 
-void value_free(Value* v);
-Value value_copy(const Value* v);
+// the string and list cases of value_free/value_copy; the rest is inline so
+// scalars never leave the caller
+void value_free_string(Value* v);
+Value value_copy_string(const Value* v);
+void value_free_list(Value* v);
+Value value_copy_list(const Value* v);
+
+// drops one reference; strings and lists are released with their last one
+static inline void value_free(Value* v) {
+  if (!v) return;
+  if (v->type == VAL_STRING || v->type == VAL_ERROR) {
+    value_free_string(v);
+    return;
+  }
+  if (v->type == VAL_LIST) {
+    value_free_list(v);
+    return;
+  }
+  v->type = VAL_NULL;
+  v->i = 0;
+}
+// shares strings and lists by bumping their refcount
+static inline Value value_copy(const Value* v) {
+  if (v && (v->type == VAL_STRING || v->type == VAL_ERROR)) return value_copy_string(v);
+  if (v && v->type == VAL_LIST) return value_copy_list(v);
+  return v ? *v : value_null();
+}
+
+// text of a VAL_STRING/VAL_ERROR payload, NUL-terminated; pair it with
+// value_strlen rather than scanning for the NUL
+static inline const char* value_str(const Value* v) {
+  return v->str ? v->str->data : "";
+}
+// length of a VAL_STRING/VAL_ERROR payload without scanning it
+static inline size_t value_strlen(const Value* v) {
+  return v->str ? v->str->len : 0;
+}
+
+// Int arithmetic wraps around in two's complement, as the JIT's machine
+// code and --emit-c output do. It is done on unsigned long, so it never
+// reaches C's undefined signed overflow.
+static inline long int_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }
+static inline long int_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }
+static inline long int_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }
+static inline long int_neg(long a) { return (long)(0UL - (unsigned long)a); }
+// b != 0; LONG_MIN / -1 wraps to LONG_MIN instead of trapping
+static inline long int_div(long a, long b) { return b == -1 ? int_neg(a) : a / b; }
 
 // convert to printable string (allocated); caller frees
 char* value_to_cstring(const Value* v);
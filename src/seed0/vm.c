@@ -0,0 +1,436 @@
+#include "vm.h"
+#include "profile.h"
+#include "runtime.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef struct CallFrame {
+  const FnProto* proto;
+  const uint8_t* ip;     // resume point while a callee runs
+  size_t base;           // first operand slot owned by this frame
+  Env* env;
+} CallFrame;
+
+typedef struct VM {
+  Value* stack;
+  size_t sp;
+  size_t cap;
+  CallFrame* frames;
+  size_t frame_count;
+  size_t frame_cap;
+  char err[256];
+} VM;
+
+static bool reserve_stack(VM* vm, size_t need) {
+  if (vm->sp + need <= vm->cap) return true;
+  size_t nc = vm->cap ? vm->cap : 256;
+  while (nc < vm->sp + need) nc *= 2;
+  Value* ns = (Value*)realloc(vm->stack, nc * sizeof(Value));
+  if (!ns) return false;
+  vm->stack = ns;
+  vm->cap = nc;
+  return true;
+}
+
+static bool push_frame(VM* vm, const FnProto* proto, Env* env) {
+  if (vm->frame_count + 1 > vm->frame_cap) {
+    size_t nc = vm->frame_cap ? vm->frame_cap * 2 : 64;
+    CallFrame* nf = (CallFrame*)realloc(vm->frames, nc * sizeof(CallFrame));
+    if (!nf) return false;
+    vm->frames = nf;
+    vm->frame_cap = nc;
+  }
+  if (!reserve_stack(vm, proto->max_stack)) return false;
+  CallFrame* f = &vm->frames[vm->frame_count++];
+  f->proto = proto;
+  f->ip = proto->code;
+  f->base = vm->sp;
+  f->env = env;
+  return true;
+}
+
+static void unwind_stack(VM* vm, size_t to) {
+  while (vm->sp > to) value_free(&vm->stack[--vm->sp]);
+}
+
+static Value error_message(const char* msg) {
+  return value_error(msg, strlen(msg));
+}
+
+static Value make_function(const FnProto* proto, Env* closure) {
+  Function* fn = (Function*)calloc(1, sizeof(Function));
+  fn->name.type = TOK_IDENT;
+  fn->name.start = proto->name;
+  fn->name.length = proto->name ? strlen(proto->name) : 0;
+  fn->param_count = proto->param_count;
+  fn->closure = closure;
+  fn->layout = &proto->layout;
+  fn->proto = proto;
+  return value_func(fn);
+}
+
+#define READ_U16() (ip += 2, read_u16(ip - 2))
+
+bool vm_run(const FnProto* script, Env* env, char* errbuf, size_t errbuf_n) {
+  env_bind_layout(env, &script->layout);
+  if (!define_builtins(env, errbuf, errbuf_n)) return false;
+
+  VM vm;
+  memset(&vm, 0, sizeof(vm));
+  if (!push_frame(&vm, script, env)) {
+    snprintf(errbuf, errbuf_n, "out of memory");
+    return false;
+  }
+
+  CallFrame* frame = &vm.frames[0];
+  const uint8_t* ip = frame->ip;
+  bool ok = true;
+  Value err = value_null();
+
+  for (;;) {
+    switch ((OpCode)*ip++) {
+      case OP_CONST: {
+        uint16_t k = READ_U16();
+        vm.stack[vm.sp++] = value_copy(&frame->proto->consts[k]);
+        break;
+      }
+      case OP_NULL:
+        vm.stack[vm.sp++] = value_null();
+        break;
+      case OP_POP:
+        value_free(&vm.stack[--vm.sp]);
+        break;
+      case OP_GET: {
+        uint16_t k = READ_U16();
+        Value v = env_get(frame->env, frame->proto->names[k]);
+        if (v.type == VAL_ERROR) { err = v; goto raise; }
+        vm.stack[vm.sp++] = v;
+        break;
+      }
+      case OP_GET_SLOT: {
+        uint8_t depth = *ip++;
+        uint16_t slot = READ_U16();
+        uint16_t k = READ_U16();
+        Binding* b = env_slot(frame->env, depth, slot);
+        if (b->is_set) {
+          vm.stack[vm.sp++] = value_copy(&b->value);
+          break;
+        }
+        Value v = env_get(frame->env, frame->proto->names[k]);
+        if (v.type == VAL_ERROR) { err = v; goto raise; }
+        vm.stack[vm.sp++] = v;
+        break;
+      }
+      case OP_SET_SLOT:
+      case OP_LOCK_SLOT: {
+        bool is_lock = ip[-1] == OP_LOCK_SLOT;
+        uint16_t slot = READ_U16();
+        Value v = vm.stack[--vm.sp];
+        bool set_ok = env_slot_assign(&frame->env->items[slot], &v, is_lock, vm.err, sizeof(vm.err));
+        value_free(&v);
+        if (!set_ok) { err = error_message(vm.err); goto raise; }
+        break;
+      }
+      case OP_APPEND_SLOT: {
+        uint16_t slot = READ_U16();
+        uint8_t n = *ip++;
+        Value* pieces = &vm.stack[vm.sp - n];
+        Value l = vm.stack[vm.sp - n - 1];
+        Binding* b = &frame->env->items[slot];
+        bool appended = env_slot_append(b, &l, pieces, n);
+        for (uint8_t i = 0; i < n; i++) {
+          if (!appended) {
+            Value next = l.type == VAL_INT && pieces[i].type == VAL_INT
+              ? value_int(int_add(l.i, pieces[i].i)) : eval_binary_op(BIN_ADD, &l, &pieces[i]);
+            value_free(&l);
+            l = next;
+          }
+          value_free(&pieces[i]);
+        }
+        vm.sp -= n + 1;
+        if (appended) break;
+        if (l.type == VAL_ERROR) { err = l; goto raise; }
+        bool set_ok = env_slot_assign(b, &l, false, vm.err, sizeof(vm.err));
+        value_free(&l);
+        if (!set_ok) { err = error_message(vm.err); goto raise; }
+        break;
+      }
+      case OP_SET:
+      case OP_LOCK: {
+        bool is_lock = ip[-1] == OP_LOCK;
+        uint16_t k = READ_U16();
+        Value v = vm.stack[--vm.sp];
+        bool set_ok = env_set(frame->env, frame->proto->names[k], &v, is_lock, vm.err, sizeof(vm.err));
+        value_free(&v);
+        if (!set_ok) { err = error_message(vm.err); goto raise; }
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      case OP_EQ: case OP_NEQ: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+      case OP_AND: case OP_OR: {
+        OpCode op = (OpCode)ip[-1];
+        Value* l = &vm.stack[vm.sp - 2];
+        Value* r = &vm.stack[vm.sp - 1];
+        if (l->type == VAL_INT && r->type == VAL_INT) {
+          long a = l->i, b = r->i;
+          vm.sp--;
+          switch (op) {
+            case OP_ADD: l->i = int_add(a, b); continue;
+            case OP_SUB: l->i = int_sub(a, b); continue;
+            case OP_MUL: l->i = int_mul(a, b); continue;
+            case OP_LT: *l = value_bool(a < b); continue;
+            case OP_LTE: *l = value_bool(a <= b); continue;
+            case OP_GT: *l = value_bool(a > b); continue;
+            case OP_GTE: *l = value_bool(a >= b); continue;
+            case OP_EQ: *l = value_bool(a == b); continue;
+            case OP_NEQ: *l = value_bool(a != b); continue;
+            default: vm.sp++; break;
+          }
+        }
+        Value out = eval_binary_op((BinOp)(BIN_ADD + (op - OP_ADD)), l, r);
+        value_free(l);
+        value_free(r);
+        vm.sp -= 2;
+        if (out.type == VAL_ERROR) { err = out; goto raise; }
+        vm.stack[vm.sp++] = out;
+        break;
+      }
+      case OP_NEGATE:
+      case OP_NOT: {
+        Value* v = &vm.stack[vm.sp - 1];
+        Value out = eval_unary_op(ip[-1] == OP_NEGATE ? UN_NEGATE : UN_NOT, v);
+        value_free(v);
+        vm.sp--;
+        if (out.type == VAL_ERROR) { err = out; goto raise; }
+        vm.stack[vm.sp++] = out;
+        break;
+      }
+      case OP_JUMP: {
+        uint16_t off = READ_U16();
+        ip += off;
+        break;
+      }
+      case OP_JUMP_IF_FALSE: {
+        uint16_t off = READ_U16();
+        Value* c = &vm.stack[--vm.sp];
+        bool truth = value_is_truthy(c);
+        value_free(c);
+        if (!truth) ip += off;
+        break;
+      }
+      case OP_LOOP: {
+        uint16_t off = READ_U16();
+        ip -= off;
+        break;
+      }
+      case OP_TAIL_CALL: {
+        size_t argc = *ip;
+        size_t callee_at = vm.sp - argc - 1;
+        Value callee = vm.stack[callee_at];
+        if (vm.frame_count > 1 && callee.type == VAL_FUNC && callee.func && callee.func->proto &&
+            tail_call_reusable(&callee, &vm.stack[callee_at + 1], argc, frame->env)) {
+          const Function* fn = callee.func;
+          const FnProto* proto = fn->proto;
+          STAT_INC(calls);
+          STAT_INC(tail_calls);
+          env_reset_frame(frame->env, fn->closure, &proto->layout);
+          for (size_t i = 0; i < argc; i++) {
+            env_slot_assign(&frame->env->items[proto->params[i]], &vm.stack[callee_at + 1 + i], false, vm.err, sizeof(vm.err));
+          }
+          unwind_stack(&vm, frame->base);
+          if (!reserve_stack(&vm, proto->max_stack)) { err = error_message("out of memory"); goto raise; }
+          frame->proto = proto;
+          ip = proto->code;
+          if (prof_enabled) { prof_leave(); prof_enter(fn->name.start, fn->name.length); }
+          if (trace_enabled) { trace_end(); trace_begin(TRACE_CALL, fn->name.start, fn->name.length); }
+          break;
+        }
+        // otherwise an ordinary call, returned by the OP_RETURN after it
+      }
+      // fallthrough
+      case OP_CALL: {
+        size_t argc = *ip++;
+        size_t callee_at = vm.sp - argc - 1;
+        Value callee = vm.stack[callee_at];
+        Value* args = &vm.stack[callee_at + 1];
+        if (callee.type == VAL_BUILTIN) {
+          STAT_INC(builtin_calls);
+          if (trace_enabled) trace_begin(TRACE_BUILTIN, callee.builtin->name, strlen(callee.builtin->name));
+          Value out = callee.builtin->fn(args, argc);
+          if (trace_enabled) trace_end();
+          unwind_stack(&vm, callee_at);
+          if (out.type == VAL_ERROR) { err = out; goto raise; }
+          vm.stack[vm.sp++] = out;
+          break;
+        }
+        if (callee.type != VAL_FUNC || !callee.func || !callee.func->proto) {
+          unwind_stack(&vm, callee_at);
+          err = error_message("unsupported call");
+          goto raise;
+        }
+        const Function* fn = callee.func;
+        const FnProto* proto = fn->proto;
+        if (argc != proto->param_count) {
+          unwind_stack(&vm, callee_at);
+          err = error_message("arity mismatch");
+          goto raise;
+        }
+        STAT_INC(calls);
+        Env* fenv = env_push_frame(fn->closure ? fn->closure : frame->env, &proto->layout);
+        if (!fenv) {
+          unwind_stack(&vm, callee_at);
+          err = error_message(env_push_error());
+          goto raise;
+        }
+        for (size_t i = 0; i < argc; i++) {
+          env_slot_assign(&fenv->items[proto->params[i]], &args[i], false, vm.err, sizeof(vm.err));
+        }
+        unwind_stack(&vm, callee_at);
+        frame->ip = ip;
+        if (!push_frame(&vm, proto, fenv)) {
+          env_pop(fenv);
+          frame = &vm.frames[vm.frame_count - 1];
+          err = error_message("out of memory");
+          goto raise;
+        }
+        frame = &vm.frames[vm.frame_count - 1];
+        ip = frame->ip;
+        if (prof_enabled) prof_enter(fn->name.start, fn->name.length);
+        if (trace_enabled) trace_begin(TRACE_CALL, fn->name.start, fn->name.length);
+        break;
+      }
+      case OP_RETURN: {
+        Value result = vm.stack[--vm.sp];
+        unwind_stack(&vm, frame->base);
+        if (vm.frame_count == 1) {
+          value_free(&result);
+          goto done;
+        }
+        env_pop(frame->env);
+        vm.frame_count--;
+        frame = &vm.frames[vm.frame_count - 1];
+        ip = frame->ip;
+        if (prof_enabled) prof_leave();
+        if (trace_enabled) trace_end();
+        if (result.type == VAL_ERROR) { err = result; goto raise; }
+        vm.stack[vm.sp++] = result;
+        break;
+      }
+      case OP_SHOW:
+      case OP_WARN: {
+        Value* v = &vm.stack[--vm.sp];
+        if (ip[-1] == OP_SHOW) rt_show(v);
+        else rt_warn(v);
+        value_free(v);
+        break;
+      }
+      case OP_DEFINE: {
+        uint16_t pi = READ_U16();
+        uint16_t slot = READ_U16();
+        Value fv = make_function(frame->proto->protos[pi], frame->env);
+        if (!env_bind_function(frame->env, slot, NULL, fv.func, vm.err, sizeof(vm.err))) {
+          err = error_message(vm.err);
+          goto raise;
+        }
+        break;
+      }
+      case OP_EXPECT_INT: {
+        uint16_t k = READ_U16();
+        if (vm.stack[vm.sp - 1].type != VAL_INT) {
+          err = error_message(value_str(&frame->proto->consts[k]));
+          goto raise;
+        }
+        break;
+      }
+      case OP_REPEAT_ITER: {
+        uint16_t slot = READ_U16();
+        uint16_t off = READ_U16();
+        Value* i = &vm.stack[vm.sp - 2];
+        if (i->i > vm.stack[vm.sp - 1].i) { ip += off; break; }
+        if (!env_slot_set_int(&frame->env->items[slot], i->i, vm.err, sizeof(vm.err))) {
+          err = error_message(vm.err);
+          goto raise;
+        }
+        break;
+      }
+      case OP_REPEAT_STEP: {
+        uint16_t slot = READ_U16();
+        uint16_t off = READ_U16();
+        Value* i = &vm.stack[vm.sp - 2];
+        if (i->i == vm.stack[vm.sp - 1].i) break;
+        i->i++;
+        if (!env_slot_set_int(&frame->env->items[slot], i->i, vm.err, sizeof(vm.err))) {
+          err = error_message(vm.err);
+          goto raise;
+        }
+        ip -= off;
+        break;
+      }
+      case OP_LINE: {
+        uint32_t line = read_u32(ip);
+        ip += 4;
+        if (prof_enabled) prof_line(line);
+        break;
+      }
+      case OP_FAIL: {
+        uint16_t k = READ_U16();
+        err = error_message(value_str(&frame->proto->consts[k]));
+        goto raise;
+      }
+      default:
+        err = error_message("bad opcode");
+        goto raise;
+    }
+    continue;
+
+  raise:
+    // Find the innermost handler covering the failing instruction; frames
+    // without one end with the error and pass it on to their caller.
+    for (;;) {
+      uint32_t off = (uint32_t)(ip - frame->proto->code);
+      const Handler* hit = NULL;
+      for (size_t h = 0; h < frame->proto->handler_count; h++) {
+        const Handler* hd = &frame->proto->handlers[h];
+        if (!(hd->start < off && off <= hd->end)) continue;
+        if (hd->kind == HANDLER_MESSAGE) {
+          value_free(&err);
+          err = error_message(value_str(&frame->proto->consts[hd->arg]));
+          continue;
+        }
+        hit = hd;
+        break;
+      }
+      if (hit && hit->kind == HANDLER_TRY) {
+        value_free(&err);
+        unwind_stack(&vm, frame->base + hit->depth);
+        ip = frame->proto->code + hit->target;
+        break;
+      }
+      unwind_stack(&vm, frame->base);
+      if (vm.frame_count == 1) {
+        // `return <error>` at top level ends the program quietly
+        if (!hit) {
+          snprintf(errbuf, errbuf_n, "%s", err.str ? err.str->data : "error");
+          ok = false;
+        }
+        value_free(&err);
+        goto done;
+      }
+      env_pop(frame->env);
+      vm.frame_count--;
+      frame = &vm.frames[vm.frame_count - 1];
+      ip = frame->ip;
+      if (prof_enabled) prof_leave();
+      if (trace_enabled) trace_end();
+    }
+  }
+
+done:
+  unwind_stack(&vm, 0);
+  free(vm.stack);
+  free(vm.frames);
+  frames_release();
+  return ok;
+}
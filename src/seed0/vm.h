@@ -0,0 +1,7 @@
+#pragma once
+#include "bytecode.h"
+#include "interp.h"
+
+// Execute a compiled script in `env` (builtins are bound first). Calls to
+// Astralis functions push VM frames instead of recursing in C.
+bool vm_run(const FnProto* script, Env* env, char* errbuf, size_t errbuf_n);
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Benchmark runner for seed0.
+
+Runs every `benchmarks/*.astr` workload (skipping files with a matching
+`.skip` flag) on the tree-walker and the VM, several times each, and prints
+the results as JSON: median/min/max wall time, user-space instructions (when
+the kernel lets `perf_event_open` count them) and peak RSS. Each run goes
+through `benchmarks/runstat.c` (built as `src/seed0/runstat`). With `--baseline` it compares against a
+previous run and exits non-zero when a workload got slower than the
+threshold allows.
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+
+REPO_ROOT = Path(__file__).resolve().parent.parent
+DEFAULT_BIN = REPO_ROOT / "src" / "seed0" / "astralis"
+RUNSTAT = REPO_ROOT / "src" / "seed0" / "runstat"
+BENCH_DIR = REPO_ROOT / "benchmarks"
+# "nojit" is the tree-walker with every call interpreted; it only runs on request
+ENGINES = {"tree": [], "vm": ["--vm"], "nojit": ["--no-jit"]}
+
+
+def workloads(selected: List[str]) -> List[Path]:
+    found = []
+    for astr in sorted(BENCH_DIR.glob("*.astr")):
+        if astr.with_suffix(".skip").exists():
+            continue
+        if selected and astr.stem not in selected:
+            continue
+        found.append(astr)
+    return found
+
+
+def run_once(cmd: List[str]) -> Tuple[float, Optional[int], int]:
+    """Returns (wall seconds, instructions or None, peak RSS in KiB)."""
+    fd, result_path = tempfile.mkstemp(prefix="astr-bench-", suffix=".json")
+    os.close(fd)
+    try:
+        with tempfile.TemporaryFile() as err:
+            proc = subprocess.run([str(RUNSTAT), "-o", result_path, "--"] + cmd,
+                                  stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+                                  stderr=err)
+            err.seek(0)
+            message = err.read().decode(errors="replace").strip()
+        if proc.returncode != 0:
+            raise RuntimeError(f"{' '.join(cmd)} exited with {proc.returncode}: {message}")
+        with open(result_path) as fh:
+            stat = json.load(fh)
+    finally:
+        os.unlink(result_path)
+    return stat["wall_s"], stat["instructions"], stat["peak_rss_kb"]
+
+
+def bench(binary: Path, runs: int, selected: List[str], engines: List[str]) -> Dict:
+    results = []
+    for astr in workloads(selected):
+        for engine in engines:
+            cmd = [str(binary)] + ENGINES[engine] + [str(astr)]
+            walls, counts, rss = [], [], 0
+            for _ in range(runs):
+                wall, instructions, peak = run_once(cmd)
+                walls.append(wall)
+                if instructions is not None:
+                    counts.append(instructions)
+                rss = max(rss, peak)
+            result = {
+                "name": astr.stem,
+                "engine": engine,
+                "wall_s": {
+                    "median": round(statistics.median(walls), 6),
+                    "min": round(min(walls), 6),
+                    "max": round(max(walls), 6),
+                },
+                "instructions": int(statistics.median(counts)) if counts else None,
+                "peak_rss_kb": rss,
+            }
+            results.append(result)
+            print(f"{astr.stem:16} {engine:5} {result['wall_s']['median']:9.4f} s "
+                  f"{rss:8d} KB", file=sys.stderr)
+    return {
+        "binary": str(binary),
+        "runs": runs,
+        "results": results,
+    }
+
+
+def compare(current: Dict, baseline: Dict, threshold: float) -> bool:
+    """Prints per-workload ratios; returns False on any regression."""
+    old = {(r["name"], r["engine"]): r for r in baseline.get("results", [])}
+    ok = True
+    for r in current["results"]:
+        prev = old.get((r["name"], r["engine"]))
+        if not prev:
+            print(f"{r['name']:16} {r['engine']:5} (no baseline)", file=sys.stderr)
+            continue
+        # instruction counts are far less noisy than wall time, so prefer them
+        if r["instructions"] and prev.get("instructions"):
+            metric, ratio = "instructions", r["instructions"] / prev["instructions"]
+        else:
+            metric, ratio = "wall", r["wall_s"]["median"] / max(prev["wall_s"]["median"], 1e-9)
+        regressed = ratio > 1.0 + threshold / 100.0
+        ok = ok and not regressed
+        print(f"{r['name']:16} {r['engine']:5} {metric:12} x{ratio:6.3f}"
+              f"{'  REGRESSION' if regressed else ''}", file=sys.stderr)
+    return ok
+
+
+def main(argv: List[str]) -> int:
+    parser = argparse.ArgumentParser(description="Run the seed0 benchmark suite")
+    parser.add_argument("workloads", nargs="*", help="workload names (default: all)")
+    parser.add_argument("--bin", type=Path, default=DEFAULT_BIN, help="astralis binary")
+    parser.add_argument("--runs", type=int, default=5, help="runs per workload and engine")
+    parser.add_argument("--engine", choices=sorted(ENGINES), action="append",
+                        help="engine to run (default: tree and vm)")
+    parser.add_argument("-o", "--output", type=Path, help="also write the JSON to this file")
+    parser.add_argument("--baseline", type=Path, help="JSON from an earlier run to compare against")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown against the baseline, in percent (default 10)")
+    args = parser.parse_args(argv)
+
+    for needed in (args.bin, RUNSTAT):
+        if not os.access(needed, os.X_OK):
+            print(f"error: {needed} is not built (run `make bench`)", file=sys.stderr)
+            return 1
+    if args.runs < 1:
+        print("error: --runs must be at least 1", file=sys.stderr)
+        return 2
+
+    report = bench(args.bin, args.runs, args.workloads, args.engine or ["tree", "vm"])
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.output:
+        args.output.write_text(text + "\n")
+    if args.baseline:
+        baseline = json.loads(args.baseline.read_text())
+        if not compare(report, baseline, args.threshold):
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
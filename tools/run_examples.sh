@@ -10,16 +10,42 @@ if [ ! -x "$BIN" ]; then
   exit 1
 fi
 
+CC="${CC:-cc}"
+LIB="$REPO_ROOT/src/seed0/libseed0.a"
+
 status=0
+# every example runs on the tree-walker and on the bytecode VM, with and
+# without the AST optimizer, and on the tree-walker with every function
+# compiled on its first call or none at all
+modes=("" "--vm" "--no-opt" "--vm --no-opt" "--jit-threshold 1" "--no-jit")
+# and translated by --emit-c, when there is a C compiler to build the result
+if command -v "$CC" >/dev/null 2>&1 && [ -f "$LIB" ]; then
+  modes+=("--emit-c")
+fi
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+run() {
+  if [ "$1" = "--emit-c" ]; then
+    "$BIN" --emit-c "$work/prog.c" "$2" &&
+      "$CC" -O1 -I "$REPO_ROOT/src/seed0" "$work/prog.c" "$LIB" -pthread -o "$work/prog" &&
+      "$work/prog"
+  else
+    "$BIN" $1 "$2"
+  fi
+}
+
+for mode in "${modes[@]}"; do
 for astr in "$EXAMPLE_DIR"/*.astr; do
   base="${astr##*/}"
   stem="${base%.astr}"
   expected="$EXAMPLE_DIR/$stem.out"
   input="$EXAMPLE_DIR/$stem.in"
   skip="$EXAMPLE_DIR/$stem.skip"
+  label="$base${mode:+ ($mode)}"
 
   if [ -f "$skip" ]; then
-    echo "skip: $base"
+    echo "skip: $label"
     continue
   fi
 
@@ -31,16 +57,16 @@ for astr in "$EXAMPLE_DIR"/*.astr; do
 
   tmp=$(mktemp)
   if [ -f "$input" ]; then
-    if ! "$BIN" "$astr" <"$input" >"$tmp" 2>&1; then
-      echo "program $base failed" >&2
+    if ! run "$mode" "$astr" <"$input" >"$tmp" 2>&1; then
+      echo "program $label failed" >&2
       cat "$tmp"
       status=1
       rm -f "$tmp"
       continue
     fi
   else
-    if ! "$BIN" "$astr" >"$tmp" 2>&1; then
-      echo "program $base failed" >&2
+    if ! run "$mode" "$astr" >"$tmp" 2>&1; then
+      echo "program $label failed" >&2
       cat "$tmp"
       status=1
       rm -f "$tmp"
@@ -49,13 +75,14 @@ for astr in "$EXAMPLE_DIR"/*.astr; do
   fi
 
   if ! diff -u "$expected" "$tmp" >/dev/null; then
-    echo "output mismatch for $base" >&2
+    echo "output mismatch for $label" >&2
     diff -u "$expected" "$tmp" || true
     status=1
   else
-    echo "ok: $base"
+    echo "ok: $label"
   fi
   rm -f "$tmp"
 
+done
 done
 exit $status